@@ -1,40 +1,272 @@
-#include <cstdlib>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
 #include <unistd.h>
 #include "buffer_ring.h"
 #include "io_uring.h"
+#include "metrics.h"
 
 namespace WebServer {
+    // 一个大小类的缓冲区组的环占用的内存，按页对齐
+    size_t get_ring_memory_size(const unsigned int size_class) {
+        const size_t page_size = sysconf(_SC_PAGESIZE);
+        return (BUFFER_RING_SIZE_LIST[size_class] * sizeof(io_uring_buf) + page_size - 1) / page_size * page_size;
+    }
+
     buffer_ring &buffer_ring::get_instance() noexcept {
         thread_local buffer_ring instance;
         return instance;
     }
 
-    void buffer_ring::register_buffer_ring(
-            const unsigned int buffer_ring_size, const size_t buffer_size
-    ) {
-        const size_t ring_entries_size = buffer_ring_size * sizeof(io_uring_buf);
-        const size_t page_alignment = sysconf(_SC_PAGESIZE);
-        void *buffer_ring = nullptr;
-        posix_memalign(&buffer_ring, page_alignment, ring_entries_size);
-        buffer_ring_.reset(reinterpret_cast<io_uring_buf_ring *>(buffer_ring));
+    buffer_ring::~buffer_ring() {
+        for (const std::span<char> slab: slab_list_) {
+            munmap(slab.data(), slab.size());
+        }
+    }
 
-        buffer_list_.reserve(buffer_ring_size);
-        for (unsigned int i = 0; i < buffer_ring_size; ++i) {
-            buffer_list_.emplace_back(buffer_size);
+    void buffer_ring::register_buffer_ring() {
+        // 所有大小类的环放在 slab 的开头，之后依次是每个大小类的缓冲区
+        size_t size = 0;
+        for (unsigned int size_class = 0; size_class < BUFFER_SIZE_CLASS_COUNT; ++size_class) {
+            size += get_ring_memory_size(size_class) + BUFFER_RING_SIZE_LIST[size_class] * BUFFER_SIZE_LIST[size_class];
+        }
+        char *ring_memory = allocate_slab(size);
+        char *buffer_area = ring_memory;
+        for (unsigned int size_class = 0; size_class < BUFFER_SIZE_CLASS_COUNT; ++size_class) {
+            buffer_area += get_ring_memory_size(size_class);
         }
 
-        io_uring::get_instance().setup_buffer_ring(buffer_ring_.get(), buffer_list_, buffer_list_.size());
+        for (unsigned int size_class = 0; size_class < BUFFER_SIZE_CLASS_COUNT; ++size_class) {
+            add_buffer_group(size_class, ring_memory, buffer_area);
+            ring_memory += get_ring_memory_size(size_class);
+            buffer_area += BUFFER_RING_SIZE_LIST[size_class] * BUFFER_SIZE_LIST[size_class];
+        }
     }
 
-    std::span<char> buffer_ring::borrow_buffer(const unsigned int buffer_id, const size_t size) {
-        borrowed_buffer_set_[buffer_id] = true;
-        return {buffer_list_[buffer_id].data(), size};
+    char *buffer_ring::allocate_slab(const size_t size) {
+        const size_t slab_size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+        // 优先使用预留的大页（ /proc/sys/vm/nr_hugepages ），没有预留时使用普通的页，并建议内核使用透明大页
+        // 用一整块内存代替几千个小的堆分配，接收数据时的 TLB 缺失更少，启动时也只需要一次系统调用
+        void *slab = mmap(
+                nullptr, slab_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE,
+                -1, 0
+        );
+        if (slab == MAP_FAILED) {
+            slab = mmap(nullptr, slab_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (slab == MAP_FAILED) {
+                throw std::runtime_error("failed to invoke 'mmap'");
+            }
+            madvise(slab, slab_size, MADV_HUGEPAGE);
+            // 在当前线程上立即访问所有的页，让它们分配在当前线程所在的 NUMA 节点上
+            std::memset(slab, 0, slab_size);
+        }
+        slab_list_.emplace_back(static_cast<char *>(slab), slab_size);
+        return static_cast<char *>(slab);
     }
 
-    void buffer_ring::return_buffer(const unsigned int buffer_id) {
-        borrowed_buffer_set_[buffer_id] = false;
+    void buffer_ring::add_buffer_group(const unsigned int size_class, char *ring_memory, char *buffer_area) {
+        const auto buffer_group = static_cast<unsigned int>(group_list_.size());
+        group_state &state = group_list_.emplace_back();
+        state.ring = reinterpret_cast<io_uring_buf_ring *>(ring_memory);
+        state.buffer_area = buffer_area;
+        state.buffer_size = BUFFER_SIZE_LIST[size_class];
+        state.ring_size = BUFFER_RING_SIZE_LIST[size_class];
+        state.size_class = size_class;
+
+        state.ring_buffer_id_list.resize(state.ring_size);
+        state.buffer_position_list.resize(state.ring_size);
+        for (unsigned int buffer_id = 0; buffer_id < state.ring_size; ++buffer_id) {
+            state.ring_buffer_id_list[buffer_id] = buffer_id;
+            state.buffer_position_list[buffer_id] = buffer_id;
+        }
+        state.ring_tail = state.ring_size;
+
+        io_uring::get_instance().setup_buffer_ring(
+                state.ring, buffer_group, state.buffer_area, state.buffer_size, state.ring_size
+        );
+
+        size_class_state &size_class_state = size_class_list_[size_class];
+        if (size_class_state.buffer_group_list.empty()) {
+            size_class_state.low_watermark = state.ring_size;
+        }
+        size_class_state.buffer_group_list.emplace_back(buffer_group);
+    }
+
+    void buffer_ring::grow(const unsigned int size_class) {
+        char *const ring_memory = allocate_slab(
+                get_ring_memory_size(size_class) + BUFFER_RING_SIZE_LIST[size_class] * BUFFER_SIZE_LIST[size_class]
+        );
+        add_buffer_group(size_class, ring_memory, ring_memory + get_ring_memory_size(size_class));
+    }
+
+    unsigned int buffer_ring::select_size_class(const size_t size) noexcept {
+        for (unsigned int size_class = 0; size_class < BUFFER_SIZE_CLASS_COUNT; ++size_class) {
+            if (BUFFER_SIZE_LIST[size_class] >= size) {
+                return size_class;
+            }
+        }
+        return BUFFER_SIZE_CLASS_COUNT - 1;
+    }
+
+    unsigned int buffer_ring::get_size_class(const unsigned int buffer_group) const noexcept {
+        return group_list_[buffer_group].size_class;
+    }
+
+    void buffer_ring::submit_recv(recv_request &request, const unsigned int size_class) {
+        const std::vector<unsigned int> &buffer_group_list = size_class_list_[size_class].buffer_group_list;
+        const unsigned int buffer_group = *std::ranges::max_element(
+                buffer_group_list, {},
+                [this](const unsigned int group) { return group_list_[group].get_free_count(); }
+        );
+        if (group_list_[buffer_group].get_free_count() > 0) {
+            submit_recv_to_group(request, buffer_group);
+            return;
+        }
+
+        // 整个大小类都没有空闲的缓冲区，现在提交只会立即得到 -ENOBUFS
+        std::list<recv_request *> &waiting_list = size_class_list_[size_class].waiting_list;
+        request.buffer_group = buffer_group;
+        request.waiting = true;
+        request.position = waiting_list.emplace(waiting_list.end(), &request);
+    }
+
+    void buffer_ring::submit_recv_to_group(recv_request &request, const unsigned int buffer_group) {
+        request.buffer_group = buffer_group;
+        io_uring::get_instance().submit_multishot_recv_request(
+                request.recv_sqe_data, request.raw_file_descriptor, request.fixed_file, buffer_group
+        );
+    }
+
+    void buffer_ring::cancel_recv(recv_request &request) {
+        if (request.waiting) {
+            size_class_list_[group_list_[request.buffer_group].size_class].waiting_list.erase(request.position);
+            request.waiting = false;
+        }
+    }
+
+    void buffer_ring::report_exhausted(const unsigned int buffer_group) {
+        group_state &state = group_list_[buffer_group];
+        size_class_state &size_class_state = size_class_list_[state.size_class];
+        ++size_class_state.exhaustion_count;
+        state.exhausted = true;
+        size_class_state.low_watermark = std::min(size_class_state.low_watermark, get_free_count(state.size_class));
+    }
+
+    std::span<char> buffer_ring::group_state::get_buffer(const unsigned int buffer_id) const noexcept {
+        return {buffer_area + buffer_id * buffer_size, buffer_size};
+    }
+
+    size_t buffer_ring::group_state::get_free_count() const noexcept {
+        return exhausted ? 0 : ring_size - borrowed_count;
+    }
+
+    size_t buffer_ring::get_free_count(const unsigned int size_class) const noexcept {
+        size_t free_count = 0;
+        for (const unsigned int buffer_group: size_class_list_[size_class].buffer_group_list) {
+            free_count += group_list_[buffer_group].get_free_count();
+        }
+        return free_count;
+    }
+
+    std::span<char> buffer_ring::borrow_buffer(
+            const unsigned int buffer_group, const unsigned int buffer_id, const size_t size
+    ) {
+        group_state &state = group_list_[buffer_group];
+        ++state.borrowed_count;
+        size_class_state &size_class_state = size_class_list_[state.size_class];
+        size_class_state.low_watermark = std::min(size_class_state.low_watermark, get_free_count(state.size_class));
+        metrics::get_instance().add(metrics::gauge::borrowed_buffer, 1);
+        return state.get_buffer(buffer_id).first(size);
+    }
+
+    void buffer_ring::borrow_buffer_list(
+            const unsigned int buffer_group, const unsigned int buffer_id, size_t size,
+            std::vector<borrowed_buffer> &buffer_list
+    ) {
+        buffer_list.clear();
+
+        // 内核只会使用从第一个缓冲区开始、在环中连续的缓冲区，除了最后一个，每个缓冲区都会被填满
+        const group_state &state = group_list_[buffer_group];
+        const unsigned int mask = state.ring_size - 1;
+        unsigned int position = state.buffer_position_list[buffer_id];
+        while (size > 0) {
+            const unsigned int current_buffer_id = state.ring_buffer_id_list[position & mask];
+            const size_t current_size = std::min(size, state.buffer_size);
+            buffer_list.emplace_back(
+                    buffer_group, current_buffer_id, borrow_buffer(buffer_group, current_buffer_id, current_size)
+            );
+            size -= current_size;
+            ++position;
+        }
+    }
+
+    void buffer_ring::return_buffer(const unsigned int buffer_group, const unsigned int buffer_id) {
+        group_state &state = group_list_[buffer_group];
+        const unsigned int mask = state.ring_size - 1;
+        state.ring_buffer_id_list[state.ring_tail & mask] = buffer_id;
+        state.buffer_position_list[buffer_id] = state.ring_tail;
+        ++state.ring_tail;
+
         io_uring::get_instance().add_buffer(
-                buffer_ring_.get(), buffer_list_[buffer_id], buffer_id, buffer_list_.size()
+                state.ring, state.get_buffer(buffer_id), buffer_id, state.ring_size, state.pending_count
         );
+        ++state.pending_count;
+        metrics::get_instance().add(metrics::gauge::borrowed_buffer, -1);
+    }
+
+    void buffer_ring::flush() {
+        io_uring &io_uring = io_uring::get_instance();
+        for (group_state &state: group_list_) {
+            if (state.pending_count == 0) {
+                continue;
+            }
+            // 这一轮事件循环中归还的所有缓冲区只需要一次原子写入
+            io_uring.advance_buffer_ring(state.ring, state.pending_count);
+            state.borrowed_count -= state.pending_count;
+            state.exhausted = false;
+            state.pending_count = 0;
+        }
+
+        for (unsigned int size_class = 0; size_class < BUFFER_SIZE_CLASS_COUNT; ++size_class) {
+            std::list<recv_request *> &waiting_list = size_class_list_[size_class].waiting_list;
+            // 每个请求至少需要一个缓冲区，所以最多提交 budget 个请求，每次都选择空闲缓冲区最多的组
+            const auto submit_waiting = [&](size_t budget) {
+                for (; !waiting_list.empty() && budget > 0; --budget) {
+                    recv_request &request = *waiting_list.front();
+                    waiting_list.pop_front();
+                    request.waiting = false;
+                    submit_recv(request, size_class);
+                }
+            };
+
+            size_class_state &size_class_state = size_class_list_[size_class];
+            submit_waiting(get_free_count(size_class));
+            if (waiting_list.empty()) {
+                size_class_state.starving_count = 0;
+                continue;
+            }
+
+            // 缓冲区被持续耗尽，说明这个大小类的缓冲区不够，增加一个新的组，并立即提交剩下的请求
+            if (++size_class_state.starving_count >= BUFFER_RING_GROW_THRESHOLD &&
+                size_class_state.buffer_group_list.size() < MAX_BUFFER_GROUP_PER_SIZE_CLASS) {
+                grow(size_class);
+                size_class_state.starving_count = 0;
+                submit_waiting(BUFFER_RING_SIZE_LIST[size_class]);
+            }
+        }
+    }
+
+    buffer_ring::statistics buffer_ring::get_statistics() const noexcept {
+        statistics statistics;
+        for (unsigned int size_class = 0; size_class < BUFFER_SIZE_CLASS_COUNT; ++size_class) {
+            const size_class_state &size_class_state = size_class_list_[size_class];
+            statistics.group_count[size_class] = size_class_state.buffer_group_list.size();
+            statistics.low_watermark[size_class] = size_class_state.low_watermark;
+            statistics.exhaustion_count[size_class] = size_class_state.exhaustion_count;
+            statistics.waiting_count[size_class] = size_class_state.waiting_list.size();
+        }
+        return statistics;
     }
-}
\ No newline at end of file
+}
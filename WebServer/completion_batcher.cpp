@@ -0,0 +1,68 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include "completion_batcher.h"
+#include "constant.h"
+
+namespace WebServer {
+    // 阻塞之前忙轮询的时间（微秒），为 0 表示不忙轮询，必须在创建任何 completion_batcher 之前设置
+    std::atomic<std::chrono::microseconds::rep> busy_poll_time = 0;
+
+    void completion_batcher::enable_busy_poll(const std::chrono::microseconds busy_poll_time) noexcept {
+        WebServer::busy_poll_time.store(busy_poll_time.count(), std::memory_order_relaxed);
+    }
+
+    completion_batcher::completion_batcher()
+            : busy_poll_time_{std::chrono::microseconds(busy_poll_time.load(std::memory_order_relaxed))},
+              last_wait_end_{std::chrono::steady_clock::now()} {}
+
+    void completion_batcher::submit_and_wait(io_uring &io_uring) {
+        if (average_completion_count_ >= COMPLETION_BATCH_THRESHOLD) {
+            // 等待的数量比平均值略多，等得到时平均值会慢慢增加，超时时减少，最终停在预算之内能等到的数量
+            const auto wait_count = std::min(
+                    static_cast<unsigned int>(std::ceil(average_completion_count_)), COMPLETION_BATCH_SIZE
+            );
+            const auto wait_time = std::min<std::chrono::nanoseconds>(
+                    std::chrono::nanoseconds(static_cast<int64_t>(wait_count * average_completion_interval_)),
+                    COMPLETION_WAIT_BUDGET
+            );
+            io_uring.submit_and_wait_timeout(wait_count, wait_time);
+        } else if (busy_poll_time_.count() > 0 && average_completion_interval_ <= busy_poll_time_.count()) {
+            // 只有下一个完成事件预计会在忙轮询的时间内到达时才忙轮询，空闲的线程直接阻塞，不浪费 CPU
+            io_uring.submit_and_wait(0);
+            if (!busy_poll(io_uring)) {
+                io_uring.submit_and_wait(1);
+            }
+        } else {
+            io_uring.submit_and_wait(1);
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        update(io_uring.cq_ready(), now - last_wait_end_);
+        last_wait_end_ = now;
+    }
+
+    bool completion_batcher::busy_poll(io_uring &io_uring) const {
+        const auto deadline = std::chrono::steady_clock::now() + busy_poll_time_;
+        do {
+            io_uring.get_events();
+            if (io_uring.cq_ready() > 0) {
+                return true;
+            }
+        } while (std::chrono::steady_clock::now() < deadline);
+        return false;
+    }
+
+    void completion_batcher::update(
+            const unsigned int completion_count, const std::chrono::nanoseconds elapsed
+    ) noexcept {
+        // 新的值占 1/8 的权重，几十轮之内就能跟上负载的变化，又不会因为一轮的波动而频繁切换
+        constexpr double weight = 1.0 / 8;
+        average_completion_count_ += (completion_count - average_completion_count_) * weight;
+        // 没有完成事件时（超时）这一轮花费的时间都是在等待，算作一个间隔
+        const double completion_interval =
+                static_cast<double>(elapsed.count()) / std::max(completion_count, 1u);
+        average_completion_interval_ += (completion_interval - average_completion_interval_) * weight;
+    }
+}
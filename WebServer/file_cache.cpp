@@ -0,0 +1,250 @@
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <fcntl.h>
+#include <linux/openat2.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "constant.h"
+#include "file_cache.h"
+
+namespace WebServer {
+    // 目录中的文件被创建、修改、删除、移动，或者目录本身被删除、移动时，都需要让缓存失效
+    constexpr uint32_t INOTIFY_WATCH_MASK = IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                                            IN_DELETE_SELF | IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM |
+                                            IN_MOVED_TO | IN_ONLYDIR;
+
+    // 每个线程的文件缓存最多保存的条目数，由 file_cache::set_capacity() 设置
+    size_t file_cache_capacity = FILE_CACHE_SIZE;
+
+    // path 是 directory 本身或者在 directory 下，空的 directory 表示文档根目录
+    bool is_beneath(const std::string &path, const std::string &directory) {
+        return directory.empty() || path == directory ||
+               (path.starts_with(directory) && path[directory.size()] == '/');
+    }
+
+    // 强 ETag 的格式是 "<inode>-<大小>-<修改时间的纳秒数>" ，都使用十六进制
+    // 文件被替换或者修改之后，至少有一个部分会改变
+    std::string make_entity_tag(const struct statx &file_status) {
+        std::array<char, 3 * (std::numeric_limits<uint64_t>::digits / 4 + 1) + 2> entity_tag;
+        char *end = entity_tag.data();
+        *end++ = '"';
+        const auto append_hex = [&end, &entity_tag](const uint64_t value) {
+            end = std::to_chars(end, entity_tag.data() + entity_tag.size(), value, 16).ptr;
+        };
+        append_hex(file_status.stx_ino);
+        *end++ = '-';
+        append_hex(file_status.stx_size);
+        *end++ = '-';
+        append_hex(static_cast<uint64_t>(file_status.stx_mtime.tv_sec) * 1000000000 + file_status.stx_mtime.tv_nsec);
+        *end++ = '"';
+        return {entity_tag.data(), end};
+    }
+
+    file_cache &file_cache::get_instance() noexcept {
+        thread_local file_cache instance;
+        return instance;
+    }
+
+    void file_cache::set_capacity(const size_t capacity) noexcept { file_cache_capacity = capacity; }
+
+    file_cache::file_cache() {
+        const int raw_directory_file_descriptor = ::open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (raw_directory_file_descriptor == -1) {
+            throw std::runtime_error("failed to invoke 'open'");
+        }
+        root_directory_ = file_descriptor{raw_directory_file_descriptor};
+
+        // 这里不能使用 IN_NONBLOCK ，否则 io_uring 的 read 请求会直接返回 -EAGAIN
+        if (const int raw_file_descriptor = inotify_init1(IN_CLOEXEC); raw_file_descriptor != -1) {
+            inotify_file_descriptor_ = file_descriptor{raw_file_descriptor};
+            enabled_ = true;
+        }
+    }
+
+    task<std::shared_ptr<const file_cache::entry>> file_cache::lookup(const std::filesystem::path &path) {
+        const std::string &key = path.native();
+        if (const auto iterator = cache_map_.find(key); iterator != cache_map_.end()) {
+            // 命中，把条目移到 LRU 链表的头部
+            lru_list_.splice(lru_list_.begin(), lru_list_, iterator->second.lru_iterator);
+            co_return iterator->second.cache_entry;
+        }
+
+        // 先监听所在的目录，再打开文件，这样打开之后发生的变化一定能收到事件
+        const bool watched = enabled_ && watch_directory(path.parent_path());
+        const uint64_t invalidation_count = invalidation_count_;
+
+        auto new_entry = std::make_shared<entry>();
+
+        // 使用 O_NONBLOCK 打开，防止打开 FIFO 之类的特殊文件时阻塞
+        // 路径中的 ".." 、绝对路径和符号链接都会被内核拒绝，而不是依赖对 URL 的字符串处理
+        open_how how{};
+        how.flags = O_RDONLY | O_NONBLOCK | O_CLOEXEC;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS;
+        const int raw_file_descriptor = co_await openat2_awaiter(
+                root_directory_.get_raw_file_descriptor(), path, how
+        );
+        // 等待期间当前线程可能已经处理了其他请求，只有没有发生失效时，打开的结果才一定是最新的
+        const auto cacheable = [this, watched, invalidation_count]() {
+            return watched && invalidation_count == invalidation_count_;
+        };
+        if (raw_file_descriptor < 0) {
+            // 只有确定文件不存在时才加入负缓存，fd 耗尽之类的临时错误不缓存
+            new_entry->error = -raw_file_descriptor;
+            if (cacheable() && !new_entry->failed()) {
+                insert(key, new_entry);
+            }
+            co_return new_entry;
+        }
+
+        auto file = std::make_shared<const file_descriptor>(raw_file_descriptor);
+        struct statx file_status{};
+        constexpr unsigned int status_mask = STATX_TYPE | STATX_SIZE | STATX_MTIME | STATX_INO;
+        if (const int result = co_await statx_awaiter(raw_file_descriptor, status_mask, file_status); result < 0) {
+            new_entry->error = -result;
+            co_return new_entry;
+        }
+        if (S_ISREG(file_status.stx_mode)) {
+            // 普通文件不需要 O_NONBLOCK ，去掉它以免 splice 返回 -EAGAIN
+            fcntl(raw_file_descriptor, F_SETFL, fcntl(raw_file_descriptor, F_GETFL) & ~O_NONBLOCK);
+            new_entry->file = std::move(file);
+            new_entry->size = file_status.stx_size;
+            new_entry->modify_time = timespec{file_status.stx_mtime.tv_sec, file_status.stx_mtime.tv_nsec};
+            new_entry->entity_tag = make_entity_tag(file_status);
+            new_entry->last_modified = format_http_date(file_status.stx_mtime.tv_sec);
+        }
+
+        if (cacheable()) {
+            insert(key, new_entry);
+        }
+        co_return new_entry;
+    }
+
+    void file_cache::erase(const std::filesystem::path &path) { invalidate(path.native(), false); }
+
+    task<> file_cache::watch() {
+        alignas(inotify_event) std::array<char, INOTIFY_BUFFER_SIZE> buffer;
+
+        while (enabled_) {
+            const ssize_t result = co_await read_awaiter(
+                    inotify_file_descriptor_.get_raw_file_descriptor(), buffer, -1
+            );
+            if (result <= 0) {
+                // 无法再收到文件变化的通知，清空并禁用缓存，之后每次请求都直接访问文件系统
+                enabled_ = false;
+                invalidate({}, true);
+                co_return;
+            }
+
+            for (ssize_t offset = 0; offset < result;) {
+                const auto *event = reinterpret_cast<const inotify_event *>(buffer.data() + offset);
+                offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+
+                // 事件队列溢出，丢失了部分事件，只能清空整个缓存
+                if (event->mask & IN_Q_OVERFLOW) {
+                    invalidate({}, true);
+                    continue;
+                }
+
+                const auto iterator = watch_directory_map_.find(event->wd);
+                if (iterator == watch_directory_map_.end()) {
+                    continue;
+                }
+                const std::string directory = iterator->second;
+
+                // 目录本身被删除或移动，目录下的所有条目都失效，并且不再监听这个目录以及它下面的目录
+                if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                    invalidate(directory, true);
+                    unwatch(directory);
+                    continue;
+                }
+
+                if (event->len > 0) {
+                    const std::string name{event->name};
+                    const std::string path = directory.empty() ? name : directory + '/' + name;
+                    // 子目录发生变化时，子目录下的条目也要失效
+                    // 子目录被移动之后，它和它下面的目录的监听仍然有效，但是记录的路径已经过期，也要一起删除
+                    invalidate(path, event->mask & IN_ISDIR);
+                    if (event->mask & IN_ISDIR) {
+                        unwatch(path);
+                    }
+                }
+            }
+        }
+    }
+
+    bool file_cache::watch_directory(const std::filesystem::path &directory) {
+        const std::string &key = directory.native();
+        if (watch_descriptor_map_.contains(key)) {
+            return true;
+        }
+        // 先监听上一级目录，这样祖先目录被移动或删除时也能收到事件，已经监听的目录的祖先目录一定也被监听
+        if (!key.empty() && !watch_directory(directory.parent_path())) {
+            return false;
+        }
+
+        const int watch_descriptor = inotify_add_watch(
+                inotify_file_descriptor_.get_raw_file_descriptor(), key.empty() ? "." : key.c_str(),
+                INOTIFY_WATCH_MASK
+        );
+        if (watch_descriptor == -1) {
+            return false;
+        }
+        watch_directory_map_[watch_descriptor] = key;
+        watch_descriptor_map_[key] = watch_descriptor;
+        return true;
+    }
+
+    void file_cache::unwatch(const std::string &directory) {
+        for (auto iterator = watch_descriptor_map_.begin(); iterator != watch_descriptor_map_.end();) {
+            if (is_beneath(iterator->first, directory)) {
+                // 内核已经删除的监听（比如收到了 IN_IGNORED ）会返回 EINVAL ，可以忽略
+                inotify_rm_watch(inotify_file_descriptor_.get_raw_file_descriptor(), iterator->second);
+                watch_directory_map_.erase(iterator->second);
+                iterator = watch_descriptor_map_.erase(iterator);
+            } else {
+                ++iterator;
+            }
+        }
+    }
+
+    void file_cache::invalidate(const std::string &path, const bool recursive) {
+        ++invalidation_count_;
+        if (!recursive) {
+            if (const auto iterator = cache_map_.find(path); iterator != cache_map_.end()) {
+                lru_list_.erase(iterator->second.lru_iterator);
+                cache_map_.erase(iterator);
+            }
+            return;
+        }
+
+        // 空路径表示文档根目录，也就是所有的条目
+        for (auto iterator = cache_map_.begin(); iterator != cache_map_.end();) {
+            if (is_beneath(iterator->first, path)) {
+                lru_list_.erase(iterator->second.lru_iterator);
+                iterator = cache_map_.erase(iterator);
+            } else {
+                ++iterator;
+            }
+        }
+    }
+
+    void file_cache::insert(const std::string &path, std::shared_ptr<const entry> entry) {
+        // 同一个文件可能被两个请求同时打开，后打开的条目替换先打开的
+        if (const auto iterator = cache_map_.find(path); iterator != cache_map_.end()) {
+            lru_list_.erase(iterator->second.lru_iterator);
+            cache_map_.erase(iterator);
+        }
+        lru_list_.push_front(path);
+        cache_map_[path] = cache_node{std::move(entry), lru_list_.begin()};
+
+        // 超出预算时淘汰最久没有使用的条目，正在使用中的 fd 由 shared_ptr 保证不会被提前关闭
+        if (cache_map_.size() > file_cache_capacity) {
+            cache_map_.erase(lru_list_.back());
+            lru_list_.pop_back();
+        }
+    }
+}
@@ -1,10 +1,13 @@
+#include <algorithm>
 #include <array>
+#include <cerrno>
 #include <optional>
 #include <stdexcept>
 #include <utility>
 #include <fcntl.h>
 #include <unistd.h>
 #include "file_descriptor.h"
+#include "pipe_pool.h"
 
 namespace WebServer {
     file_descriptor::file_descriptor() = default;
@@ -14,12 +17,16 @@ namespace WebServer {
 
     file_descriptor::~file_descriptor() {
         if (raw_file_descriptor_.has_value()) {
-            close(raw_file_descriptor_.value());
+            if (fixed_file_) {
+                io_uring::get_instance().submit_close_direct_request(raw_file_descriptor_.value());
+            } else {
+                close(raw_file_descriptor_.value());
+            }
         }
     }
 
     file_descriptor::file_descriptor(file_descriptor &&other) noexcept
-            : raw_file_descriptor_{other.raw_file_descriptor_} {
+            : raw_file_descriptor_{other.raw_file_descriptor_}, fixed_file_{other.fixed_file_} {
         other.raw_file_descriptor_ = std::nullopt;
     }
 
@@ -28,6 +35,7 @@ namespace WebServer {
             return *this;
         }
         raw_file_descriptor_ = std::exchange(other.raw_file_descriptor_, std::nullopt);
+        fixed_file_ = other.fixed_file_;
         return *this;
     }
 
@@ -39,11 +47,139 @@ namespace WebServer {
         return raw_file_descriptor_.value();
     }
 
+    bool file_descriptor::is_fixed_file() const { return fixed_file_; }
+
+    read_awaiter::read_awaiter(
+            const int raw_file_descriptor, const std::span<char> buffer, const int64_t offset
+    )
+            : raw_file_descriptor_{raw_file_descriptor}, buffer_{buffer}, offset_{offset} {}
+
+    bool read_awaiter::await_ready() const { return false; }
+
+    void read_awaiter::await_suspend(std::coroutine_handle<> coroutine) {
+        sqe_data_.coroutine = coroutine.address();
+
+        io_uring::get_instance().submit_read_request(&sqe_data_, raw_file_descriptor_, buffer_, offset_);
+    }
+
+    ssize_t read_awaiter::await_resume() const { return sqe_data_.cqe_res; }
+
+    openat2_awaiter::openat2_awaiter(
+            const int raw_directory_file_descriptor, const std::filesystem::path &path, const open_how how
+    )
+            : raw_directory_file_descriptor_{raw_directory_file_descriptor}, path_{path}, how_{how} {}
+
+    bool openat2_awaiter::await_ready() const { return false; }
+
+    void openat2_awaiter::await_suspend(std::coroutine_handle<> coroutine) {
+        sqe_data_.coroutine = coroutine.address();
+
+        io_uring::get_instance().submit_openat2_request(
+                &sqe_data_, raw_directory_file_descriptor_, path_.c_str(), &how_
+        );
+    }
+
+    int openat2_awaiter::await_resume() const { return sqe_data_.cqe_res; }
+
+    statx_awaiter::statx_awaiter(const int raw_file_descriptor, const unsigned int mask, struct statx &statx)
+            : statx_awaiter(raw_file_descriptor, "", AT_EMPTY_PATH, mask, statx) {}
+
+    statx_awaiter::statx_awaiter(
+            const int raw_directory_file_descriptor, const char *path, const int flags, const unsigned int mask,
+            struct statx &statx
+    )
+            : raw_file_descriptor_{raw_directory_file_descriptor}, path_{path}, flags_{flags}, mask_{mask},
+              statx_{statx} {}
+
+    bool statx_awaiter::await_ready() const { return false; }
+
+    void statx_awaiter::await_suspend(std::coroutine_handle<> coroutine) {
+        sqe_data_.coroutine = coroutine.address();
+
+        io_uring::get_instance().submit_statx_request(
+                &sqe_data_, raw_file_descriptor_, path_, flags_, mask_, &statx_
+        );
+    }
+
+    int statx_awaiter::await_resume() const { return sqe_data_.cqe_res; }
+
+    linkat_awaiter::linkat_awaiter(
+            const int raw_old_directory_file_descriptor, const char *old_path,
+            const int raw_new_directory_file_descriptor, const char *new_path, const int flags
+    )
+            : raw_old_directory_file_descriptor_{raw_old_directory_file_descriptor}, old_path_{old_path},
+              raw_new_directory_file_descriptor_{raw_new_directory_file_descriptor}, new_path_{new_path},
+              flags_{flags} {}
+
+    bool linkat_awaiter::await_ready() const { return false; }
+
+    void linkat_awaiter::await_suspend(std::coroutine_handle<> coroutine) {
+        sqe_data_.coroutine = coroutine.address();
+
+        io_uring::get_instance().submit_linkat_request(
+                &sqe_data_, raw_old_directory_file_descriptor_, old_path_, raw_new_directory_file_descriptor_,
+                new_path_, flags_
+        );
+    }
+
+    int linkat_awaiter::await_resume() const { return sqe_data_.cqe_res; }
+
+    renameat_awaiter::renameat_awaiter(
+            const int raw_old_directory_file_descriptor, const char *old_path,
+            const int raw_new_directory_file_descriptor, const char *new_path
+    )
+            : raw_old_directory_file_descriptor_{raw_old_directory_file_descriptor}, old_path_{old_path},
+              raw_new_directory_file_descriptor_{raw_new_directory_file_descriptor}, new_path_{new_path} {}
+
+    bool renameat_awaiter::await_ready() const { return false; }
+
+    void renameat_awaiter::await_suspend(std::coroutine_handle<> coroutine) {
+        sqe_data_.coroutine = coroutine.address();
+
+        io_uring::get_instance().submit_renameat_request(
+                &sqe_data_, raw_old_directory_file_descriptor_, old_path_, raw_new_directory_file_descriptor_,
+                new_path_
+        );
+    }
+
+    int renameat_awaiter::await_resume() const { return sqe_data_.cqe_res; }
+
+    unlinkat_awaiter::unlinkat_awaiter(const int raw_directory_file_descriptor, const char *path)
+            : raw_directory_file_descriptor_{raw_directory_file_descriptor}, path_{path} {}
+
+    bool unlinkat_awaiter::await_ready() const { return false; }
+
+    void unlinkat_awaiter::await_suspend(std::coroutine_handle<> coroutine) {
+        sqe_data_.coroutine = coroutine.address();
+
+        io_uring::get_instance().submit_unlinkat_request(&sqe_data_, raw_directory_file_descriptor_, path_);
+    }
+
+    int unlinkat_awaiter::await_resume() const { return sqe_data_.cqe_res; }
+
+    write_awaiter::write_awaiter(
+            const int raw_file_descriptor, const std::span<const char> buffer, const int64_t offset
+    )
+            : raw_file_descriptor_{raw_file_descriptor}, buffer_{buffer}, offset_{offset} {}
+
+    bool write_awaiter::await_ready() const { return false; }
+
+    void write_awaiter::await_suspend(std::coroutine_handle<> coroutine) {
+        sqe_data_.coroutine = coroutine.address();
+
+        io_uring::get_instance().submit_write_request(&sqe_data_, raw_file_descriptor_, buffer_, offset_);
+    }
+
+    ssize_t write_awaiter::await_resume() const { return sqe_data_.cqe_res; }
+
     splice_awaiter::splice_awaiter(
-            const int raw_file_descriptor_in, const int raw_file_descriptor_out, const size_t length
+            const int raw_file_descriptor_in, const bool fixed_file_in, const int64_t offset_in,
+            const int raw_file_descriptor_out, const bool fixed_file_out, const int64_t offset_out,
+            const size_t length
     )
-            : raw_file_descriptor_in_{raw_file_descriptor_in},
-              raw_file_descriptor_out_{raw_file_descriptor_out}, length_{length} {}
+            : raw_file_descriptor_in_{raw_file_descriptor_in}, fixed_file_in_{fixed_file_in}, offset_in_{offset_in},
+              raw_file_descriptor_out_{raw_file_descriptor_out}, fixed_file_out_{fixed_file_out},
+              offset_out_{offset_out}, length_{length} {}
 
     bool splice_awaiter::await_ready() const { return false; }
 
@@ -51,12 +187,40 @@ namespace WebServer {
         sqe_data_.coroutine = coroutine.address();
 
         io_uring::get_instance().submit_splice_request(
-                &sqe_data_, raw_file_descriptor_in_, raw_file_descriptor_out_, length_
+                &sqe_data_, raw_file_descriptor_in_, fixed_file_in_, offset_in_,
+                raw_file_descriptor_out_, fixed_file_out_, offset_out_, length_
         );
     }
 
     ssize_t splice_awaiter::await_resume() const { return sqe_data_.cqe_res; }
 
+    linked_splice_awaiter::linked_splice_awaiter(
+            const int raw_file_descriptor_in, const bool fixed_file_in, const int64_t offset_in,
+            const int raw_pipe_write_file_descriptor, const int raw_pipe_read_file_descriptor,
+            const int raw_file_descriptor_out, const bool fixed_file_out, const size_t length
+    )
+            : raw_file_descriptor_in_{raw_file_descriptor_in}, fixed_file_in_{fixed_file_in}, offset_in_{offset_in},
+              raw_pipe_write_file_descriptor_{raw_pipe_write_file_descriptor},
+              raw_pipe_read_file_descriptor_{raw_pipe_read_file_descriptor},
+              raw_file_descriptor_out_{raw_file_descriptor_out}, fixed_file_out_{fixed_file_out}, length_{length} {}
+
+    bool linked_splice_awaiter::await_ready() const { return false; }
+
+    void linked_splice_awaiter::await_suspend(std::coroutine_handle<> coroutine) {
+        // 只有第二个请求完成时才唤醒协程，链接的请求按顺序完成，所以这时第一个请求的结果也已经写入了
+        write_sqe_data_.coroutine = coroutine.address();
+
+        io_uring::get_instance().submit_linked_splice_request(
+                &read_sqe_data_, &write_sqe_data_, raw_file_descriptor_in_, fixed_file_in_, offset_in_,
+                raw_pipe_write_file_descriptor_, raw_pipe_read_file_descriptor_,
+                raw_file_descriptor_out_, fixed_file_out_, length_
+        );
+    }
+
+    std::tuple<ssize_t, ssize_t> linked_splice_awaiter::await_resume() const {
+        return {read_sqe_data_.cqe_res, write_sqe_data_.cqe_res};
+    }
+
     std::tuple<file_descriptor, file_descriptor> pipe() {
         std::array<int, 2> fd;
         if (::pipe(fd.data()) == -1) {
@@ -65,37 +229,90 @@ namespace WebServer {
         return {file_descriptor{fd[0]}, file_descriptor{fd[1]}};
     };
 
-    task <ssize_t> splice(
-            const file_descriptor &file_descriptor_in,
-            const file_descriptor &file_descriptor_out,
-            const size_t length
+    task<ssize_t> splice(
+            const file_descriptor &file_descriptor_in, const int64_t offset,
+            const file_descriptor &file_descriptor_out, const size_t length, timer_wheel::timer *timer
     ) {
-        const auto [read_pipe, write_pipe] = pipe();
+        pipe_pool &pipe_pool = pipe_pool::get_instance();
+        pipe_pool::pipe_pair pipe = pipe_pool.acquire();
 
+        // bytes_read 是已经从文件移入管道的字节数，bytes_sent 是已经从管道移入 file_descriptor_out 的字节数
+        // 两者之差就是还留在管道中的数据
+        size_t bytes_read = 0;
         size_t bytes_sent = 0;
 
         // 已发送的字节小于要传输的总长度前，一直发送
         while (bytes_sent < length) {
-            {
-                ssize_t result = co_await splice_awaiter(
-                        file_descriptor_in.get_raw_file_descriptor(),
-                        write_pipe.get_raw_file_descriptor(),
-                        length);
-                if (result < 0) {
+            if (bytes_read == bytes_sent && offset == -1) {
+                // 从套接字读取时几乎总是只能移动一部分数据，链接的第二个请求总会被取消
+                // 所以只提交套接字到管道的请求，管道中的数据由下面的分支发送
+                const ssize_t result = co_await splice_awaiter(
+                        file_descriptor_in.get_raw_file_descriptor(), file_descriptor_in.is_fixed_file(), -1,
+                        pipe.write_end.get_raw_file_descriptor(), false, -1,
+                        std::min(pipe.capacity, length - bytes_read)
+                );
+                if (timer != nullptr && timer->is_expired()) {
                     co_return -1;
                 }
-            }
-            {
-                ssize_t result = co_await splice_awaiter(
-                        read_pipe.get_raw_file_descriptor(),
-                        file_descriptor_out.get_raw_file_descriptor(),
-                        length);
-                if (result < 0) {
+                if (result <= 0) {
+                    pipe_pool.release(std::move(pipe));
+                    co_return -1;
+                }
+                bytes_read += result;
+                if (timer != nullptr) {
+                    timer->restart();
+                }
+            } else if (bytes_read == bytes_sent) {
+                // 管道已经排空，一次提交文件到管道、管道到 fd 两个链接在一起的请求，每次最多移动一整个管道的数据
+                // 普通文件通常能一次读满，这时两个请求只需要一次提交和一次唤醒
+                const size_t chunk_length = std::min(pipe.capacity, length - bytes_read);
+                const auto [read_result, write_result] = co_await linked_splice_awaiter(
+                        file_descriptor_in.get_raw_file_descriptor(), file_descriptor_in.is_fixed_file(),
+                        offset + static_cast<int64_t>(bytes_read),
+                        pipe.write_end.get_raw_file_descriptor(), pipe.read_end.get_raw_file_descriptor(),
+                        file_descriptor_out.get_raw_file_descriptor(), file_descriptor_out.is_fixed_file(),
+                        chunk_length
+                );
+                // 返回 0 说明文件在发送过程中被截断了，或者套接字的对端关闭了连接，这时管道中没有数据，可以归还
+                // 超时取消了套接字上的请求时，文件到管道的请求可能已经完成，管道中的数据不能再使用
+                if (timer != nullptr && timer->is_expired()) {
+                    co_return -1;
+                }
+                if (read_result <= 0) {
+                    pipe_pool.release(std::move(pipe));
+                    co_return -1;
+                }
+                bytes_read += read_result;
+
+                // 第一个请求只移动了部分数据时，第二个请求会被取消，管道中剩下的数据由下面的分支发送
+                if (write_result == -ECANCELED) {
+                    continue;
+                }
+                if (write_result < 0) {
+                    co_return -1;
+                }
+                bytes_sent += write_result;
+                if (timer != nullptr) {
+                    timer->restart();
+                }
+            } else {
+                // 管道中还有没发送完的数据，先把它们发送出去
+                const ssize_t result = co_await splice_awaiter(
+                        pipe.read_end.get_raw_file_descriptor(), false, -1,
+                        file_descriptor_out.get_raw_file_descriptor(), file_descriptor_out.is_fixed_file(), -1,
+                        bytes_read - bytes_sent
+                );
+                if (result < 0 || (timer != nullptr && timer->is_expired())) {
                     co_return -1;
                 }
                 bytes_sent += result;
+                if (timer != nullptr) {
+                    timer->restart();
+                }
             }
         }
+
+        pipe_pool.release(std::move(pipe));
         co_return bytes_sent;
     }
 
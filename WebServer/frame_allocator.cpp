@@ -0,0 +1,93 @@
+#include <bit>
+#include <new>
+#include "frame_allocator.h"
+
+namespace WebServer {
+    // 返回能容纳 size 字节的最小的大小类
+    constexpr size_t size_class_of(const size_t size) {
+        return size <= MIN_FRAME_SIZE ? 0 : std::bit_width(size - 1) - std::bit_width(MIN_FRAME_SIZE - 1);
+    }
+
+    frame_allocator &frame_allocator::get_instance() noexcept {
+        // 故意不释放：线程退出之后，其他线程仍然可能释放这个线程分配的帧，需要访问 remote_free_list_
+        thread_local frame_allocator *const instance = new frame_allocator();
+        return *instance;
+    }
+
+    void *frame_allocator::allocate(const size_t size) {
+        const size_t size_class = size_class_of(size);
+        if (size_class >= FRAME_SIZE_CLASS_COUNT) {
+            ++statistics_.large_allocation_count;
+            auto *header = static_cast<frame_header *>(::operator new(sizeof(frame_header) + size));
+            header->owner = nullptr;
+            return header + 1;
+        }
+        ++statistics_.allocation_count[size_class];
+
+        if (free_list_[size_class] == nullptr) {
+            collect_remote_free_list();
+        }
+
+        frame_header *header;
+        if (free_frame *frame = free_list_[size_class]; frame != nullptr) {
+            ++statistics_.reuse_count;
+            free_list_[size_class] = frame->next;
+            --free_count_[size_class];
+            header = reinterpret_cast<frame_header *>(frame) - 1;
+        } else {
+            header = static_cast<frame_header *>(::operator new(sizeof(frame_header) + (MIN_FRAME_SIZE << size_class)));
+        }
+        header->owner = this;
+        header->size_class = size_class;
+        return header + 1;
+    }
+
+    void frame_allocator::deallocate(void *const frame) noexcept {
+        frame_header *const header = static_cast<frame_header *>(frame) - 1;
+        if (header->owner == nullptr) {
+            ::operator delete(header);
+            return;
+        }
+
+        // 其他线程分配的帧，压入所属线程的 remote_free_list_
+        if (header->owner != this) {
+            ++statistics_.remote_free_count;
+            frame_allocator *const owner = header->owner;
+            auto *const free_frame = static_cast<frame_allocator::free_frame *>(frame);
+            frame_header *head = owner->remote_free_list_.load(std::memory_order_relaxed);
+            do {
+                free_frame->next = head == nullptr ? nullptr : reinterpret_cast<frame_allocator::free_frame *>(head + 1);
+            } while (!owner->remote_free_list_.compare_exchange_weak(
+                    head, header, std::memory_order_release, std::memory_order_relaxed
+            ));
+            return;
+        }
+
+        // 空闲的帧超过了 FRAME_POOL_SIZE 时直接释放，防止连接数的峰值过后一直占用内存
+        const size_t size_class = header->size_class;
+        if (free_count_[size_class] * (MIN_FRAME_SIZE << size_class) >= FRAME_POOL_SIZE) {
+            ::operator delete(header);
+            return;
+        }
+        auto *const free_frame = static_cast<frame_allocator::free_frame *>(frame);
+        free_frame->next = free_list_[size_class];
+        free_list_[size_class] = free_frame;
+        ++free_count_[size_class];
+    }
+
+    const frame_allocator::statistics &frame_allocator::get_statistics() const noexcept { return statistics_; }
+
+    void frame_allocator::collect_remote_free_list() noexcept {
+        if (remote_free_list_.load(std::memory_order_relaxed) == nullptr) {
+            return;
+        }
+        frame_header *header = remote_free_list_.exchange(nullptr, std::memory_order_acquire);
+        while (header != nullptr) {
+            auto *const frame = reinterpret_cast<free_frame *>(header + 1);
+            free_frame *const next = frame->next;
+            // 放回空闲链表，超过 FRAME_POOL_SIZE 时直接释放
+            deallocate(frame);
+            header = next == nullptr ? nullptr : reinterpret_cast<frame_header *>(next) - 1;
+        }
+    }
+}
@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <utility>
+#include "constant.h"
+#include "handoff.h"
+
+namespace WebServer {
+    // 把 path 写入 Unix 套接字的地址，path 过长时抛出异常
+    sockaddr_un make_unix_address(const char *path) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (std::strlen(path) >= sizeof(address.sun_path)) {
+            throw std::runtime_error("the handoff path is too long");
+        }
+        std::strcpy(address.sun_path, path);
+        return address;
+    }
+
+    // 让 connection 上的读写最多阻塞 HANDOFF_TIMEOUT ，对端没有响应时交接失败，而不是一直等待
+    void set_handoff_timeout(const file_descriptor &connection) {
+        const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(HANDOFF_TIMEOUT).count();
+        const timeval timeout{.tv_sec = seconds, .tv_usec = 0};
+        setsockopt(connection.get_raw_file_descriptor(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(connection.get_raw_file_descriptor(), SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+
+    std::vector<int> receive_listening_sockets(const char *path, file_descriptor &connection) {
+        const sockaddr_un address = make_unix_address(path);
+        file_descriptor socket{::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+        if (socket.get_raw_file_descriptor() == -1) {
+            throw std::runtime_error("failed to invoke 'socket'");
+        }
+        // 没有旧进程在监听，正常启动
+        if (connect(socket.get_raw_file_descriptor(), reinterpret_cast<const sockaddr *>(&address),
+                    sizeof(address)) == -1) {
+            return {};
+        }
+        set_handoff_timeout(socket);
+
+        char data = 0;
+        iovec data_iovec{.iov_base = &data, .iov_len = sizeof(data)};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_HANDOFF_SOCKET_COUNT)];
+        msghdr message{};
+        message.msg_iov = &data_iovec;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if (recvmsg(socket.get_raw_file_descriptor(), &message, MSG_CMSG_CLOEXEC) != sizeof(data)) {
+            return {};
+        }
+
+        std::vector<int> socket_list;
+        for (cmsghdr *header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header)) {
+            if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+            const size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const auto *raw_file_descriptor_list = reinterpret_cast<const int *>(CMSG_DATA(header));
+            socket_list.insert(socket_list.end(), raw_file_descriptor_list, raw_file_descriptor_list + count);
+        }
+        connection = std::move(socket);
+        return socket_list;
+    }
+
+    void acknowledge_handoff(const file_descriptor &connection) {
+        const char data = 0;
+        send(connection.get_raw_file_descriptor(), &data, sizeof(data), MSG_NOSIGNAL);
+    }
+
+    file_descriptor listen_handoff(const char *path) {
+        const sockaddr_un address = make_unix_address(path);
+        file_descriptor listener{::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+        if (listener.get_raw_file_descriptor() == -1) {
+            throw std::runtime_error("failed to invoke 'socket'");
+        }
+        // 旧进程在交接完成之后才退出，并且不会删除 path ，所以这里删除的只可能是旧进程的套接字
+        unlink(path);
+        if (bind(listener.get_raw_file_descriptor(), reinterpret_cast<const sockaddr *>(&address),
+                 sizeof(address)) == -1) {
+            throw std::runtime_error("failed to invoke 'bind'");
+        }
+        if (::listen(listener.get_raw_file_descriptor(), 1) == -1) {
+            throw std::runtime_error("failed to invoke 'listen'");
+        }
+        return listener;
+    }
+
+    bool send_listening_sockets(const file_descriptor &listener, const std::span<const int> socket_list) {
+        file_descriptor connection{accept4(listener.get_raw_file_descriptor(), nullptr, nullptr, SOCK_CLOEXEC)};
+        if (connection.get_raw_file_descriptor() == -1) {
+            return false;
+        }
+
+        // 拿到监听套接字就可以接收这个服务器的所有连接，只交给同一个用户的进程
+        ucred credential{};
+        socklen_t credential_size = sizeof(credential);
+        if (getsockopt(connection.get_raw_file_descriptor(), SOL_SOCKET, SO_PEERCRED, &credential,
+                       &credential_size) == -1 || credential.uid != getuid()) {
+            return false;
+        }
+        set_handoff_timeout(connection);
+
+        const size_t count = std::min(socket_list.size(), MAX_HANDOFF_SOCKET_COUNT);
+        char data = 0;
+        iovec data_iovec{.iov_base = &data, .iov_len = sizeof(data)};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * MAX_HANDOFF_SOCKET_COUNT)]{};
+        msghdr message{};
+        message.msg_iov = &data_iovec;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+        cmsghdr *header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        std::memcpy(CMSG_DATA(header), socket_list.data(), sizeof(int) * count);
+        if (sendmsg(connection.get_raw_file_descriptor(), &message, MSG_NOSIGNAL) != sizeof(data)) {
+            return false;
+        }
+
+        // 新进程可能在开始接收连接之前就失败了，只有收到确认之后旧进程才能停止接收连接
+        return recv(connection.get_raw_file_descriptor(), &data, sizeof(data), 0) == sizeof(data);
+    }
+}
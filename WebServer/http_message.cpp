@@ -1,24 +1,283 @@
-#include <sstream>
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <ctime>
+#include <limits>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "http_message.h"
 
 namespace WebServer {
-    std::string http_response::serialize() const {
-        std::stringstream raw_http_response;
-        raw_http_response << version << ' ' << status << ' ' << status_text << "\r\n";
+    bool equal_ignore_case(const std::string_view a, const std::string_view b) {
+        return std::ranges::equal(a, b, [](const unsigned char x, const unsigned char y) {
+            return std::tolower(x) == std::tolower(y);
+        });
+    }
+
+    std::optional<std::string_view> http_request::find_header(const std::string_view name) const {
+        for (size_t header_index = 0; header_index < header_count; ++header_index) {
+            const auto &[header_name, header_value] = header_list[header_index];
+            if (equal_ignore_case(header_name, name)) {
+                return header_value;
+            }
+        }
+        return {};
+    }
+
+    std::optional<std::string_view> http_request::find_header(
+            const std::string_view name, bool &duplicated, const bool equal_value_allowed
+    ) const {
+        std::optional<std::string_view> value;
+        duplicated = false;
+        for (size_t header_index = 0; header_index < header_count; ++header_index) {
+            const auto &[header_name, header_value] = header_list[header_index];
+            if (!equal_ignore_case(header_name, name)) {
+                continue;
+            }
+            if (!value.has_value()) {
+                value = header_value;
+            } else if (!equal_value_allowed || header_value != value.value()) {
+                duplicated = true;
+                break;
+            }
+        }
+        return value;
+    }
 
-        // 遍历 header_list，每个元素是一个键值对，表示一个 HTTP 头部字段
-        // 键和值之间用 ":" 分隔，每个头部字段以 "\r\n" 结束
-        for (const auto &[k, v]: header_list) {
-            raw_http_response << k << ':' << v << "\r\n";
+    std::optional<std::vector<byte_range>> parse_range(const std::string_view value, const uint64_t size) {
+        const size_t equal = value.find('=');
+        if (equal == std::string_view::npos || !equal_ignore_case(value.substr(0, equal), "bytes")) {
+            return {};
         }
 
-        // 在头部的最后添加一个额外的 "\r\n"，表示头部的结束
-        // 根据 HTTP 协议，这个额外的 "\r\n" 后面会接着是 HTTP 响应的主体（body）
-        raw_http_response << "\r\n";
+        // 整个字符串都是十进制数字时返回它的值
+        const auto parse_number = [](const std::string_view text) -> std::optional<uint64_t> {
+            uint64_t number = 0;
+            if (const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), number);
+                    text.empty() || error != std::errc{} || end != text.data() + text.size()) {
+                return {};
+            }
+            return number;
+        };
+
+        std::vector<byte_range> range_list;
+        size_t range_count = 0;
+        std::string_view rest = value.substr(equal + 1);
+        while (!rest.empty()) {
+            const size_t comma = rest.find(',');
+            std::string_view range = rest.substr(0, comma);
+            rest = comma == std::string_view::npos ? std::string_view{} : rest.substr(comma + 1);
+
+            // 去掉逗号两边的空白，列表中允许出现空的元素
+            const size_t begin = range.find_first_not_of(" \t");
+            if (begin == std::string_view::npos) {
+                continue;
+            }
+            range = range.substr(begin, range.find_last_not_of(" \t") - begin + 1);
+            if (++range_count > MAX_RANGE_COUNT) {
+                return {};
+            }
+
+            const size_t dash = range.find('-');
+            if (dash == std::string_view::npos) {
+                return {};
+            }
+            if (dash == 0) {
+                // "-N" 表示最后 N 个字节
+                const auto suffix_length = parse_number(range.substr(1));
+                if (!suffix_length.has_value()) {
+                    return {};
+                }
+                if (suffix_length.value() > 0 && size > 0) {
+                    range_list.emplace_back(size - std::min(suffix_length.value(), size), size - 1);
+                }
+                continue;
+            }
+
+            // "N-" 表示从 N 开始到文件末尾，"N-M" 的 M 超过文件末尾时截断到文件末尾
+            const auto first = parse_number(range.substr(0, dash));
+            const std::string_view last_text = range.substr(dash + 1);
+            const auto last = last_text.empty() ? std::optional<uint64_t>(UINT64_MAX) : parse_number(last_text);
+            if (!first.has_value() || !last.has_value() || last.value() < first.value()) {
+                return {};
+            }
+            if (first.value() < size) {
+                range_list.emplace_back(first.value(), std::min(last.value(), size - 1));
+            }
+        }
+        if (range_count == 0) {
+            return {};
+        }
 
-        // 换为字符串并返回
-        return raw_http_response.str();
+        // 合并之后，客户端不能用大量重叠的范围让服务器重复发送同一段数据
+        std::ranges::sort(range_list, {}, &byte_range::first);
+        std::vector<byte_range> merged_range_list;
+        for (const byte_range &range: range_list) {
+            if (!merged_range_list.empty() && range.first <= merged_range_list.back().last + 1) {
+                merged_range_list.back().last = std::max(merged_range_list.back().last, range.last);
+            } else {
+                merged_range_list.emplace_back(range);
+            }
+        }
+        return merged_range_list;
+    }
+
+    content_range::content_range(const byte_range &range, const uint64_t size) noexcept {
+        size_ = std::string_view("bytes ").copy(buffer_.data(), 6);
+        append(range.first, '-');
+        append(range.last, '/');
+        append(size, '\0');
+    }
+
+    content_range::content_range(const uint64_t size) noexcept {
+        size_ = std::string_view("bytes */").copy(buffer_.data(), 8);
+        append(size, '\0');
+    }
+
+    std::string_view content_range::value() const noexcept { return {buffer_.data(), size_}; }
+
+    void content_range::append(const uint64_t number, const char suffix) noexcept {
+        const auto [end, _] = std::to_chars(buffer_.data() + size_, buffer_.data() + buffer_.size(), number);
+        size_ = end - buffer_.data();
+        if (suffix != '\0') {
+            buffer_[size_++] = suffix;
+        }
     }
-}
\ No newline at end of file
+
+    std::array<char, HTTP_DATE_SIZE> format_http_date(const time_t time) {
+        constexpr std::string_view DAY_NAME_LIST = "SunMonTueWedThuFriSat";
+        constexpr std::string_view MONTH_NAME_LIST = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+        tm utc_time{};
+        gmtime_r(&time, &utc_time);
+
+        // 不使用 strftime ，它的输出依赖于当前的 locale
+        std::array<char, HTTP_DATE_SIZE> date{};
+        const auto write_two_digit = [&date](const size_t offset, const int value) {
+            date[offset] = static_cast<char>('0' + value / 10);
+            date[offset + 1] = static_cast<char>('0' + value % 10);
+        };
+        DAY_NAME_LIST.copy(date.data(), 3, utc_time.tm_wday * 3);
+        date[3] = ',';
+        date[4] = ' ';
+        write_two_digit(5, utc_time.tm_mday);
+        date[7] = ' ';
+        MONTH_NAME_LIST.copy(date.data() + 8, 3, utc_time.tm_mon * 3);
+        date[11] = ' ';
+        const int year = utc_time.tm_year + 1900;
+        write_two_digit(12, year / 100 % 100);
+        write_two_digit(14, year % 100);
+        date[16] = ' ';
+        write_two_digit(17, utc_time.tm_hour);
+        date[19] = ':';
+        write_two_digit(20, utc_time.tm_min);
+        date[22] = ':';
+        write_two_digit(23, utc_time.tm_sec);
+        std::string_view(" GMT").copy(date.data() + 25, 4);
+        return date;
+    }
+
+    std::optional<time_t> parse_http_date(const std::string_view date) {
+        constexpr std::string_view DAY_NAME_LIST = "SunMonTueWedThuFriSat";
+        constexpr std::string_view MONTH_NAME_LIST = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+        // 格式固定为 "Sun, 06 Nov 1994 08:49:37 GMT"
+        if (date.size() != HTTP_DATE_SIZE || date.substr(3, 2) != ", " || date[7] != ' ' || date[11] != ' ' ||
+            date[16] != ' ' || date[19] != ':' || date[22] != ':' || date.substr(25) != " GMT") {
+            return {};
+        }
+        if (const size_t day = DAY_NAME_LIST.find(date.substr(0, 3)); day == std::string_view::npos || day % 3 != 0) {
+            return {};
+        }
+        const size_t month = MONTH_NAME_LIST.find(date.substr(8, 3));
+        if (month == std::string_view::npos || month % 3 != 0) {
+            return {};
+        }
+        const auto read_number = [date](const size_t offset, const size_t length) -> std::optional<int> {
+            int number = 0;
+            if (const auto [end, error] = std::from_chars(date.data() + offset, date.data() + offset + length, number);
+                    error != std::errc{} || end != date.data() + offset + length) {
+                return {};
+            }
+            return number;
+        };
+        const auto day = read_number(5, 2);
+        const auto year = read_number(12, 4);
+        const auto hour = read_number(17, 2);
+        const auto minute = read_number(20, 2);
+        const auto second = read_number(23, 2);
+        if (!day.has_value() || !year.has_value() || !hour.has_value() || !minute.has_value() || !second.has_value()) {
+            return {};
+        }
+
+        tm utc_time{};
+        utc_time.tm_mday = day.value();
+        utc_time.tm_mon = static_cast<int>(month / 3);
+        utc_time.tm_year = year.value() - 1900;
+        utc_time.tm_hour = hour.value();
+        utc_time.tm_min = minute.value();
+        utc_time.tm_sec = second.value();
+        return timegm(&utc_time);
+    }
+
+    bool match_entity_tag(const std::string_view value, const std::string_view entity_tag) {
+        // 去掉 "W/" 前缀之后的部分
+        const auto opaque_tag = [](const std::string_view tag) {
+            return tag.starts_with("W/") ? tag.substr(2) : tag;
+        };
+        std::string_view rest = value;
+        while (!rest.empty()) {
+            const size_t comma = rest.find(',');
+            std::string_view tag = rest.substr(0, comma);
+            rest = comma == std::string_view::npos ? std::string_view{} : rest.substr(comma + 1);
+
+            const size_t begin = tag.find_first_not_of(" \t");
+            if (begin == std::string_view::npos) {
+                continue;
+            }
+            tag = tag.substr(begin, tag.find_last_not_of(" \t") - begin + 1);
+            if (tag == "*" || opaque_tag(tag) == opaque_tag(entity_tag)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string_view current_http_date() {
+        thread_local std::array<char, HTTP_DATE_SIZE> date{};
+        thread_local time_t date_time = -1;
+
+        // CLOCK_REALTIME_COARSE 通过 vDSO 读取，不需要陷入内核
+        timespec now{};
+        clock_gettime(CLOCK_REALTIME_COARSE, &now);
+        if (now.tv_sec != date_time) {
+            date = format_http_date(now.tv_sec);
+            date_time = now.tv_sec;
+        }
+        return {date.data(), date.size()};
+    }
+
+    http_response::http_response(std::string &buffer, const http_status status) : buffer_{buffer} {
+        buffer_.append(status_line(status));
+        add_header(DATE_HEADER, current_http_date());
+    }
+
+    void http_response::add_header(const std::string_view name, const std::string_view value) {
+        buffer_.append(name);
+        buffer_.append(value);
+        buffer_.append("\r\n");
+    }
+
+    void http_response::add_header(const std::string_view name, const uint64_t value) {
+        std::array<char, std::numeric_limits<uint64_t>::digits10 + 1> digit_list;
+        const auto [end, _] = std::to_chars(digit_list.data(), digit_list.data() + digit_list.size(), value);
+        add_header(name, std::string_view(digit_list.data(), end));
+    }
+
+    void http_response::end() { buffer_.append("\r\n"); }
+}
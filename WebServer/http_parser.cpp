@@ -1,93 +1,245 @@
 #include <algorithm>
-#include <cctype>
+#include <bit>
 #include <cstddef>
-#include <iterator>
 #include <optional>
+#include <span>
 #include <string_view>
 #include <tuple>
-#include <vector>
+#include "constant.h"
 #include "http_parser.h"
 #include "http_message.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#endif
+
 namespace WebServer {
 
-    // 输入一个 string_view，返回一个去除前后空白字符的 string_view
-    std::string_view trim_whitespace(std::string_view string) {
-        const auto first = std::find_if_not(string.cbegin(), string.cend(),
-                                            [](unsigned char c) {
-                                                return std::isspace(c);
-                                            });
-        const auto last = std::find_if_not(string.crbegin(), string.crend(), [](unsigned char c) {
-            return std::isspace(c);
-        }).base();
-        return (last <= first) ? std::string_view()
-                               : std::string_view(&*first, static_cast<std::size_t>(last - first));
+    // 在 [first, last) 中查找字符 byte ，返回第一次出现的位置，没有找到时返回 last
+    const char *find_byte_scalar(const char *const first, const char *const last, const char byte) {
+        return std::find(first, last, byte);
     }
 
-    // 将一个 string_view 按照给定的分隔符切分成多个 string_view
-    std::vector<std::string_view> split(std::string_view string, const char delimiter) {
-        std::vector<std::string_view> result;
-        size_t segment_start = 0;
-        size_t segment_end = 0;
+#if defined(__x86_64__) || defined(__i386__)
 
-        while ((segment_end = string.find(delimiter, segment_start)) != std::string::npos) {
-            std::string_view token = string.substr(segment_start, segment_end - segment_start);
-            result.emplace_back(token);
-            segment_start = segment_end + 1;
+    // 每次比较 16 个字节，剩下不足 16 个字节的部分逐个比较
+    const char *find_byte_sse2(const char *first, const char *const last, const char byte) {
+        const __m128i pattern = _mm_set1_epi8(byte);
+        for (; last - first >= 16; first += 16) {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(first));
+            if (const auto mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, pattern)));
+                    mask != 0) {
+                return first + std::countr_zero(mask);
+            }
         }
+        return find_byte_scalar(first, last, byte);
+    }
 
-        result.emplace_back(string.substr(segment_start));
-        return result;
+    // 每次比较 32 个字节，只在运行时检测到 CPU 支持 AVX2 时使用
+    __attribute__((target("avx2")))
+    const char *find_byte_avx2(const char *first, const char *const last, const char byte) {
+        const __m256i pattern = _mm256_set1_epi8(byte);
+        for (; last - first >= 32; first += 32) {
+            const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first));
+            if (const auto mask = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, pattern)));
+                    mask != 0) {
+                return first + std::countr_zero(mask);
+            }
+        }
+        // find_byte_sse2 使用不带 VEX 前缀的 SSE 指令，编译器对尾调用不会插入 vzeroupper ，
+        // ymm 寄存器的高半部分没有清零时，之后的 SSE 指令会变得非常慢
+        _mm256_zeroupper();
+        return find_byte_sse2(first, last, byte);
     }
 
-    std::vector<std::string_view> split(std::string_view string, std::string_view delimiter) {
-        std::vector<std::string_view> result;
-        size_t segment_start = 0;
-        size_t segment_end = 0;
-        const size_t delimiter_length = delimiter.length();
+    const auto find_byte_simd = []() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") ? find_byte_avx2 : find_byte_sse2;
+    }();
+
+#else
+
+    const auto find_byte_simd = find_byte_scalar;
+
+#endif
 
-        while ((segment_end = string.find(delimiter, segment_start)) != std::string::npos) {
-            std::string_view token = string.substr(segment_start, segment_end - segment_start);
-            result.emplace_back(token);
-            segment_start = segment_end + delimiter_length;
+    // 解析时使用的实现，只在解析之前由 enable_simd() 修改
+    const char *(*find_byte)(const char *, const char *, char) = find_byte_simd;
+
+    void http_parser::enable_simd(const bool enabled) { find_byte = enabled ? find_byte_simd : find_byte_scalar; }
+
+    void http_parser::feed(const std::span<const char> packet) {
+        if (state_ == parse_state::error) {
+            return;
         }
 
-        result.emplace_back(string.substr(segment_start));
-        return result;
+        if (!buffered_) {
+            // 常见的情况：之前的数据都已经解析完了，直接在 packet 上解析
+            input_ = packet;
+            request_offset_ = 0;
+            return;
+        }
+
+        // 丢弃已经解析完的请求，把未完成的部分移到缓冲区的开头，再追加新的数据
+        buffer_.erase(buffer_.begin(), buffer_.begin() + static_cast<ptrdiff_t>(request_offset_));
+        request_offset_ = 0;
+        if (buffer_.empty()) {
+            buffered_ = false;
+            input_ = packet;
+            return;
+        }
+        buffer_.insert(buffer_.end(), packet.begin(), packet.end());
+        input_ = buffer_;
     }
 
-    std::optional<http_request> http_parser::parse_packet(std::span<char> packet) {
-        raw_http_request_.reserve(raw_http_request_.size() + packet.size());
-        raw_http_request_.insert(raw_http_request_.end(), packet.begin(), packet.end());
+    std::optional<http_request> http_parser::next() {
+        while (state_ != parse_state::error) {
+            const char *const request = request_data();
+            const size_t request_size = input_.size() - request_offset_;
+
+            const char *const line_end = find_byte(request + search_offset_, request + request_size, '\n');
+            if (line_end == request + request_size) {
+                // 数据不完整，下一次从这里继续查找换行符
+                search_offset_ = request_size;
+                if (request_size > MAX_REQUEST_HEADER_SIZE) {
+                    state_ = parse_state::error;
+                    return {};
+                }
+                // 请求的剩余部分在之后的缓冲区中，先把已经收到的部分拷贝出来，这样 packet 就可以被归还了
+                if (!buffered_ && request_size > 0) {
+                    buffer_.reserve(MAX_REQUEST_HEADER_SIZE + BUFFER_SIZE_LIST.front());
+                    buffer_.assign(request, request + request_size);
+                    buffered_ = true;
+                    input_ = buffer_;
+                    request_offset_ = 0;
+                }
+                return {};
+            }
 
-        std::string_view raw_http_request(raw_http_request_.data());
+            // 行尾是 "\r\n" ，也兼容只有 "\n" 的情况
+            token line{line_offset_, static_cast<size_t>(line_end - request) - line_offset_};
+            if (line.length > 0 && request[line.offset + line.length - 1] == '\r') {
+                --line.length;
+            }
+            line_offset_ = line_end - request + 1;
+            search_offset_ = line_offset_;
+            if (line_offset_ > MAX_REQUEST_HEADER_SIZE) {
+                state_ = parse_state::error;
+                return {};
+            }
+
+            if (state_ == parse_state::request_line) {
+                // 请求行之前的空行应该被忽略
+                if (line.length == 0) {
+                    request_offset_ += line_offset_;
+                    line_offset_ = 0;
+                    search_offset_ = 0;
+                    continue;
+                }
+                if (!parse_request_line(line)) {
+                    state_ = parse_state::error;
+                    return {};
+                }
+                state_ = parse_state::header_line;
+                continue;
+            }
 
-        // 然后检查这个字符串是否以"\r\n\r\n"结束，这是一个 HTTP 请求的标准结束标志
-        if (!raw_http_request.ends_with("\r\n\r\n")) {
-            return {};
+            if (line.length > 0) {
+                if (!parse_header_line(line)) {
+                    state_ = parse_state::error;
+                    return {};
+                }
+                continue;
+            }
+
+            // 空行表示头部的结束，得到一个完整的请求
+            const auto to_string_view = [request](const token token) {
+                return std::string_view(request + token.offset, token.length);
+            };
+            http_request http_request;
+            http_request.method = to_string_view(method_);
+            http_request.url = to_string_view(url_);
+            http_request.version = to_string_view(version_);
+            for (size_t header_index = 0; header_index < header_count_; ++header_index) {
+                const auto &[name, value] = header_list_[header_index];
+                http_request.header_list[header_index] = {to_string_view(name), to_string_view(value)};
+            }
+            http_request.header_count = header_count_;
+
+            request_offset_ += line_offset_;
+            line_offset_ = 0;
+            search_offset_ = 0;
+            header_count_ = 0;
+            state_ = parse_state::request_line;
+            return http_request;
         }
+        return {};
+    }
 
-        http_request http_request;
+    std::span<const char> http_parser::unparsed() const noexcept { return input_.subspan(request_offset_); }
 
-        // 将请求按照"\r\n"切分成多行
-        const std::vector<std::string_view> request_line_list = split(raw_http_request, "\r\n");
+    void http_parser::skip(const size_t length) noexcept { request_offset_ += length; }
 
-        // 将第一行（请求行）按照空格切分，得到 HTTP 方法、URL 和版本
-        const std::vector<std::string_view> status_line_list = split(request_line_list[0], ' ');
-        http_request.method = status_line_list[0];
-        http_request.url = status_line_list[1];
-        http_request.version = status_line_list[2];
+    bool http_parser::has_partial_request() const noexcept { return request_offset_ < input_.size(); }
 
-        // 遍历剩下的行（头部行），每行按照":"切分成键和值，构成一个头部字段
-        for (size_t line_index = 1; line_index < request_line_list.size(); ++line_index) {
-            const std::string_view header_line = request_line_list[line_index];
-            const std::vector<std::string_view> header = split(header_line, ':');
-            if (header.size() == 2) {
-                http_request.header_list.emplace_back(header[0], trim_whitespace(header[1]));
-            }
+    bool http_parser::has_error() const noexcept { return state_ == parse_state::error; }
+
+    bool http_parser::parse_request_line(const token line) {
+        // 请求行的格式是 "method SP request-target SP HTTP-version"
+        const char *const first = request_data() + line.offset;
+        const char *const last = first + line.length;
+
+        const char *const method_end = find_byte(first, last, ' ');
+        if (method_end == first || method_end == last) {
+            return false;
+        }
+        const char *const url_end = find_byte(method_end + 1, last, ' ');
+        if (url_end == method_end + 1 || url_end == last) {
+            return false;
+        }
+        const std::string_view version(url_end + 1, last - url_end - 1);
+        if (!version.starts_with("HTTP/") || version.find(' ') != std::string_view::npos) {
+            return false;
         }
 
-        raw_http_request_.clear();
-        return http_request;
+        method_ = {line.offset, static_cast<size_t>(method_end - first)};
+        url_ = {line.offset + (method_end + 1 - first), static_cast<size_t>(url_end - method_end - 1)};
+        version_ = {line.offset + (url_end + 1 - first), version.size()};
+        return true;
     }
-}
\ No newline at end of file
+
+    bool http_parser::parse_header_line(const token line) {
+        const char *const first = request_data() + line.offset;
+        const char *const last = first + line.length;
+        const auto is_whitespace = [](const char c) { return c == ' ' || c == '\t'; };
+
+        // 不支持已经废弃的多行头部，字段名和冒号之间也不允许有空白字符
+        if (header_count_ == MAX_HEADER_COUNT || is_whitespace(*first)) {
+            return false;
+        }
+        const char *const colon = find_byte(first, last, ':');
+        if (colon == first || colon == last || is_whitespace(*(colon - 1))) {
+            return false;
+        }
+
+        // 去除字段值前后的空白字符
+        const char *value_first = colon + 1;
+        const char *value_last = last;
+        while (value_first != value_last && is_whitespace(*value_first)) {
+            ++value_first;
+        }
+        while (value_last != value_first && is_whitespace(*(value_last - 1))) {
+            --value_last;
+        }
+
+        header_list_[header_count_++] = {
+                token{line.offset, static_cast<size_t>(colon - first)},
+                token{line.offset + (value_first - first), static_cast<size_t>(value_last - value_first)}
+        };
+        return true;
+    }
+
+    const char *http_parser::request_data() const noexcept { return input_.data() + request_offset_; }
+}
@@ -1,34 +1,79 @@
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <csignal>
 #include <coroutine>
 #include <cstddef>
 #include <cstdint>
 #include <filesystem>
+#include <iostream>
+#include <iterator>
+#include <memory>
 #include <optional>
 #include <span>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <system_error>
 #include <tuple>
 #include <utility>
 #include <vector>
 #include <liburing.h>
 #include <liburing/io_uring.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
 #include "buffer_ring.h"
+#include "completion_batcher.h"
 #include "constant.h"
+#include "file_cache.h"
 #include "file_descriptor.h"
+#include "frame_allocator.h"
+#include "handoff.h"
 #include "http_message.h"
 #include "http_parser.h"
 #include "io_uring.h"
+#include "metrics.h"
+#include "request_body.h"
+#include "response_batch.h"
+#include "response_cache.h"
 #include "socket.h"
 #include "sync_wait.h"
+#include "timer_wheel.h"
+#include "tracer.h"
 #include "http_server.h"
 
 namespace WebServer {
-    thread_worker::thread_worker(const char *port) {
+    // STATS_URL 和 TRACE_URL 是否可以访问，只在启动线程池之前修改
+    bool stats_url_enabled = false;
+
+    thread_worker::thread_worker(
+            server_socket &server_socket, const timeout_config &timeout_config, const file_descriptor &drain_event
+    )
+            : server_socket_{server_socket}, timeout_config_{timeout_config},
+              drain_timer_{[this]() {
+                  for (connection &connection: connection_list_) {
+                      connection.aborted = true;
+                      connection.socket.cancel();
+                  }
+              }} {
         // 获取 buffer_ring 的实例并注册缓冲区
-        buffer_ring::get_instance().register_buffer_ring(BUFFER_RING_SIZE, BUFFER_SIZE);
+        buffer_ring::get_instance().register_buffer_ring();
+
+        // 启动 file_cache 的 inotify 监听协程，文件发生变化时让对应的缓存条目失效
+        task<> watch_task = file_cache::get_instance().watch();
+        watch_task.resume();
+        watch_task.detach();
 
-        // 绑定服务器套接字，开始监听绑定的端口
-        server_socket_.bind(port);
-        server_socket_.listen();
+        // 启动时间轮，没有定时器时它不会提交任何请求
+        task<> timer_wheel_task = timer_wheel::get_instance().run();
+        timer_wheel_task.resume();
+        timer_wheel_task.detach();
 
         // 创建 accept_client() 任务并启动这个任务
         // accept_client() 是一个无限循环的协程，它不断地接收新的客户端连接，并为每个连接创建一个处理客户端任务
@@ -37,68 +82,525 @@ namespace WebServer {
         task<> accept_client_task = accept_client();
         accept_client_task.resume();
         accept_client_task.detach();
+
+        task<> wait_drain_task = wait_drain(drain_event);
+        wait_drain_task.resume();
+        wait_drain_task.detach();
     }
 
     task<> thread_worker::accept_client() {
-        while (true) {
+        // 排空时 multishot accept 请求被取消，它的最后一个 CQE 到达之后，这个协程才能结束
+        while (!server_socket_.is_accept_stopped()) {
             // server_socket_.accept() 这个函数的作用是异步地接收新的客户端连接
             // 它会返回一个文件描述符（ file descriptor ）表示新的客户端套接字
-            const int raw_file_descriptor = co_await server_socket_.accept();
-            if (raw_file_descriptor == -1) {
+            // 新的连接直接放在 io_uring 的固定文件表中，返回的是它在表中的下标
+            const int file_index = co_await server_socket_.accept();
+            if (file_index < 0) {
                 continue;
             }
+            metrics::get_instance().add(metrics::counter::accepted_connection);
 
             // 创建一个新的handle_client任务，用于处理新的客户端连接
-            task<> handle_client_task = handle_client(client_socket(raw_file_descriptor));
+            // 取消之前已经接收的连接仍然需要处理，排空时它们在第一个请求之后关闭
+            task<> handle_client_task = handle_client(client_socket(file_index, true));
             handle_client_task.resume();
             handle_client_task.detach();
         }
     }
 
     task<> thread_worker::handle_client(client_socket client_socket) {
+        metrics &metrics = metrics::get_instance();
+        // 接收连接的时间，到收到第一段数据为止记为 accept 阶段
+        const auto accept_time = std::chrono::steady_clock::now();
         http_parser http_parser;
+        response_batch response_batch;
+        // 正在接收的请求体，它之后的数据才属于下一个请求
+        std::optional<request_body> body;
         buffer_ring &buffer_ring = buffer_ring::get_instance();
-        while (true) {
-            const auto [recv_buffer_id, recv_buffer_size] = co_await client_socket.recv(BUFFER_SIZE);
-            if (recv_buffer_size == 0) {
+        std::vector<buffer_ring::borrowed_buffer> recv_buffer_list;
+        // connected 为 false 表示连接已经不能再使用；closing 为 true 表示不再处理新的数据，发送完已有的响应之后关闭连接
+        bool connected = true;
+        bool closing = false;
+        // 是否已经处理过至少一个请求，排空时只关闭处理过请求的空闲连接，刚接收的连接仍然处理一个请求
+        bool served = false;
+
+        // 加入连接列表，排空时用来找到这个连接
+        connection &connection = connection_list_.emplace_back(client_socket);
+        const auto connection_iterator = std::prev(connection_list_.end());
+        metrics.set(metrics::gauge::connection, static_cast<int64_t>(connection_list_.size()));
+
+        // 最近一次收到数据的时间，以及当前请求的第一段数据到达的时间，用于统计 parse 阶段
+        auto recv_time = accept_time;
+        auto request_start = accept_time;
+
+        // 被采样的请求的 ID ，没有被采样时为 0 。trace_request 是正在接收的请求，
+        // response_trace_request 是最近一个解析完的请求，它的请求体和响应都记在它的名下
+        tracer &tracer = tracer::get_instance();
+        const uint64_t connection_id = tracer.next_connection_id();
+        uint64_t trace_request = 0;
+        uint64_t response_trace_request = 0;
+
+        // 连接的超时定时器，同一时间只有一种超时在计时。到期时取消套接字上所有的请求，等待中的操作会返回错误
+        timer_wheel::timer timer([&client_socket, &metrics]() {
+            metrics.add(metrics::counter::timeout);
+            client_socket.cancel();
+        });
+        // 当前请求的请求头超时是否已经开始计时，它从收到请求的第一个字节开始，不会因为收到更多的数据而重新计时
+        bool header_timer_started = false;
+
+        // 发送所有已经准备好的响应，发送超时时套接字上的请求被取消，返回 -1
+        const auto flush = [&]() -> task<ssize_t> {
+            timer.start(timeout_config_.send_timeout);
+            const auto start = std::chrono::steady_clock::now();
+            const ssize_t bytes_sent = co_await response_batch.flush(client_socket);
+            metrics.record(metrics::phase::send_header, start);
+            tracer.record("send_header", connection_id, response_trace_request, start);
+            if (bytes_sent > 0) {
+                metrics.add(metrics::counter::sent_byte, static_cast<uint64_t>(bytes_sent));
+            }
+            co_return bytes_sent;
+        };
+
+        // 结束一个响应的头部，close 为 true 时之后会关闭连接
+        // 排空时，请求体已经接收完的响应也会关闭连接，还在接收请求体时要等到请求体接收完才能关闭
+        const auto end_response = [&](http_response &http_response, const bool close) {
+            if (close || (draining_ && !(body.has_value() && !body->done()))) {
+                http_response.add_header(CONNECTION_HEADER, "close");
+                closing = true;
+            }
+            http_response.end();
+        };
+
+        // 追加一个没有响应体的响应，close 为 true 时之后会关闭连接
+        const auto append_response = [&](const http_status status, const bool close) {
+            http_response http_response = response_batch.add_response(status);
+            // 405 响应必须列出允许的方法
+            if (status == http_status::method_not_allowed) {
+                http_response.add_header(ALLOW_HEADER, "GET");
+            }
+            // 204 响应不能带有 content-length
+            if (status != http_status::no_content) {
+                http_response.add_header(CONTENT_LENGTH_HEADER, 0);
+            }
+            if (status >= http_status::bad_request) {
+                metrics.add(metrics::counter::error_response);
+            }
+            end_response(http_response, close);
+        };
+
+        // 请求体接收完成或者出错，上传文件时回复上传的结果
+        const auto finish_body = [&]() -> task<> {
+            if (body->has_error()) {
+                append_response(http_status::bad_request, true);
+            } else if (body->is_open()) {
+                if (co_await body->commit()) {
+                    file_cache::get_instance().erase(body->path());
+                    append_response(body->replaced() ? http_status::no_content : http_status::created, false);
+                } else {
+                    append_response(http_status::internal_server_error, false);
+                }
+            }
+            body.reset();
+            // 下一个请求最早从这段数据中开始
+            request_start = recv_time;
+        };
+
+        while (connected && !closing && !timer.is_expired() && !connection.aborted) {
+            // 上传文件时，请求体剩下的部分直接从套接字 splice 到文件，不再经过 recv 的缓冲区
+            if (body.has_value() && body->should_splice() && !client_socket.has_received_data()) {
+                co_await client_socket.stop_recv();
+                // 停止之前已经收到的数据，需要先通过 recv() 按顺序取出
+                if (!client_socket.has_received_data()) {
+                    timer.start(timeout_config_.idle_timeout);
+                    const auto body_start = tracer::now_if(response_trace_request);
+                    co_await body->splice_from(client_socket, &timer);
+                    tracer.record("body_splice", connection_id, response_trace_request, body_start);
+                    co_await finish_body();
+                    connected = co_await flush() != -1;
+                    continue;
+                }
+            }
+
+            // 收到了请求的一部分时等待请求头的剩余部分，否则等待下一个请求，或者请求体的下一段数据
+            if (http_parser.has_partial_request() && !body.has_value()) {
+                if (!header_timer_started) {
+                    timer.start(timeout_config_.header_timeout);
+                    header_timer_started = true;
+                }
+            } else {
+                timer.start(timeout_config_.idle_timeout);
+                header_timer_started = false;
+            }
+
+            // 排空时在请求之间关闭连接，这时客户端没有正在发送的请求，不会因为连接关闭而丢失请求
+            const bool request_boundary = !http_parser.has_partial_request() && !body.has_value();
+            if (draining_ && request_boundary && served) {
                 break;
             }
+            connection.idle = request_boundary && served;
+            // 请求之间的等待不属于任何请求，只追踪请求接收到一半时的等待
+            const uint64_t recv_trace_request =
+                    request_boundary ? 0 : body.has_value() ? response_trace_request : trace_request;
+            const auto recv_start = tracer::now_if(recv_trace_request);
+            const auto [recv_buffer_group, recv_buffer_id, recv_buffer_size] = co_await client_socket.recv();
+            connection.idle = false;
+            if (recv_buffer_size <= 0) {
+                break;
+            }
+            recv_time = std::chrono::steady_clock::now();
+            tracer.record("recv", connection_id, recv_trace_request, recv_start, recv_time);
+            if (!served && request_boundary) {
+                metrics.record(metrics::phase::accept, accept_time);
+            }
+            if (request_boundary) {
+                request_start = recv_time;
+                trace_request = tracer.sample();
+            }
+
+            // 使用 bundle 接收时，一次可能收到多个缓冲区，按顺序逐个解析
+            buffer_ring.borrow_buffer_list(recv_buffer_group, recv_buffer_id, recv_buffer_size, recv_buffer_list);
+            for (const auto &[buffer_group, buffer_id, recv_buffer]: recv_buffer_list) {
+                std::span<const char> data = recv_buffer;
+                // 缓冲区开头的数据属于之前的请求的请求体
+                if (connected && !closing && body.has_value()) {
+                    const auto body_start = tracer::now_if(response_trace_request);
+                    data = data.subspan(co_await body->consume(data));
+                    tracer.record("body", connection_id, response_trace_request, body_start);
+                    if (body->done() || body->has_error()) {
+                        co_await finish_body();
+                    }
+                }
+                // 连接已经出错时，剩下的缓冲区只需要归还
+                if (connected && !closing && !data.empty()) {
+                    http_parser.feed(data);
+                }
 
-            const std::span<char> recv_buffer = buffer_ring.borrow_buffer(recv_buffer_id, recv_buffer_size);
-            if (const auto parse_result = http_parser.parse_packet(recv_buffer); parse_result.has_value()) {
-                const http_request &http_request = parse_result.value();
-                const std::filesystem::path file_path = std::filesystem::relative(http_request.url, "/");
+                // 一个缓冲区中可能有多个流水线请求，请求的剩余部分会被解析器保存下来，和下一个缓冲区一起解析
+                // 所有请求的响应按顺序放入 response_batch ，接收到的数据都处理完之后再一起发送
+                while (connected && !closing && !body.has_value()) {
+                    const auto parse_result = http_parser.next();
+                    if (!parse_result.has_value()) {
+                        break;
+                    }
+                    const http_request &http_request = parse_result.value();
+                    header_timer_started = false;
+                    served = true;
+                    metrics.record(metrics::phase::parse, request_start);
+                    metrics.add(metrics::counter::request);
+                    response_trace_request = std::exchange(trace_request, tracer.sample());
+                    tracer.record("parse", connection_id, response_trace_request, request_start);
+                    // 流水线中的下一个请求最早从这段数据中开始
+                    request_start = recv_time;
+                    // 只做词法上的规范化，不访问文件系统。规范化会去掉开头的 "/.."，所以不会访问到文档根目录之外
+                    // 读取文件时，内核还会通过 RESOLVE_BENEATH 和 RESOLVE_NO_SYMLINKS 再检查一次
+                    const std::filesystem::path file_path =
+                            std::filesystem::path(http_request.url).lexically_normal().lexically_relative("/");
 
-                http_response http_response;
-                http_response.version = http_request.version;
-                if (std::filesystem::exists(file_path) && std::filesystem::is_regular_file(file_path)) {
-                    http_response.status = "200";
-                    http_response.status_text = "OK";
-                    const uintmax_t file_size = std::filesystem::file_size(file_path);
-                    http_response.header_list.emplace_back("content-length", std::to_string(file_size));
+                    // 请求体的长度由 Content-Length 决定，或者使用 chunked 编码
+                    // 同时带有两者的请求可能被用于请求走私，直接拒绝
+                    // 值不同的多个 Content-Length 或者多个 Transfer-Encoding 也一样，不同的实现可能使用不同的那一个
+                    bool content_length_duplicated = false;
+                    bool transfer_encoding_duplicated = false;
+                    const auto content_length = http_request.find_header(
+                            "content-length", content_length_duplicated, true
+                    );
+                    const auto transfer_encoding = http_request.find_header(
+                            "transfer-encoding", transfer_encoding_duplicated
+                    );
+                    if (content_length_duplicated || transfer_encoding_duplicated) {
+                        append_response(http_status::bad_request, true);
+                        break;
+                    }
+                    if (transfer_encoding.has_value()) {
+                        if (content_length.has_value() || !equal_ignore_case(transfer_encoding.value(), "chunked")) {
+                            append_response(http_status::bad_request, true);
+                            break;
+                        }
+                        body.emplace(std::nullopt);
+                    } else if (content_length.has_value()) {
+                        uint64_t length = 0;
+                        const std::string_view value = content_length.value();
+                        if (const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), length);
+                                error != std::errc{} || end != value.data() + value.size()) {
+                            append_response(http_status::bad_request, true);
+                            break;
+                        }
+                        body.emplace(length);
+                    } else if (http_request.method == "PUT") {
+                        body.emplace(0);
+                    }
 
-                    std::string send_buffer = http_response.serialize();
-                    if (co_await client_socket.send(send_buffer, send_buffer.size()) == -1) {
-                        throw std::runtime_error("failed to invoke 'send'");
+                    // 上传的文件保存到上传目录下 URL 对应的路径。在发送 100 Continue 之前打开文件，
+                    // 上传不会成功时直接回复错误，还没有收到的请求体不再接收，而是关闭连接
+                    if (http_request.method == "PUT") {
+                        std::optional<http_status> error_status;
+                        if (!request_body::is_upload_enabled()) {
+                            error_status = http_status::method_not_allowed;
+                        } else if (!file_path.has_filename() || file_path.filename() == "." ||
+                                   file_path.filename() == "..") {
+                            error_status = http_status::bad_request;
+                        } else if (const int result = co_await body->open(file_path); result < 0) {
+                            // 路径经过符号链接或者离开上传目录时，openat2 分别返回 -ELOOP 和 -EXDEV
+                            if (result == -ENOENT || result == -ENOTDIR || result == -ELOOP || result == -EXDEV) {
+                                error_status = http_status::not_found;
+                            } else if (result == -EISDIR) {
+                                error_status = http_status::bad_request;
+                            } else {
+                                error_status = http_status::internal_server_error;
+                            }
+                        }
+                        if (error_status.has_value()) {
+                            append_response(error_status.value(), !body->done());
+                            body.reset();
+                        }
                     }
 
-                    const file_descriptor file_descriptor = open(file_path);
-                    if (co_await splice(file_descriptor, client_socket, file_size) == -1) {
-                        throw std::runtime_error("failed to invoke 'splice'");
+                    // 客户端在收到这个中间响应之后才会发送请求体
+                    if (const auto expect = http_request.find_header("expect");
+                            body.has_value() && !body->done() && expect.has_value() &&
+                            equal_ignore_case(expect.value(), "100-continue")) {
+                        response_batch.add_response(http_status::continue_).end();
+                        connected = co_await flush() != -1;
                     }
-                } else {
-                    http_response.status = "404";
-                    http_response.status_text = "Not Found";
-                    http_response.header_list.emplace_back("content-length", "0");
 
-                    std::string send_buffer = http_response.serialize();
-                    if (co_await client_socket.send(send_buffer, send_buffer.size()) == -1) {
-                        throw std::runtime_error("failed to invoke 'send'");
+                    if (http_request.method == "PUT") {
+                        // 上传的结果已经在上面回复，或者在请求体接收完成之后回复
+                    } else if (stats_url_enabled && http_request.url == STATS_URL) {
+                        // 保留的 URL ，返回整个进程的统计数据，不会被同名的文件覆盖
+                        auto stats = std::make_shared<const WebServer::cached_response>(metrics.format());
+                        http_response http_response = response_batch.add_response(http_status::ok);
+                        http_response.add_header(CONTENT_LENGTH_HEADER, stats->data().size());
+                        end_response(http_response, false);
+                        response_batch.append(std::move(stats));
+                    } else if (stats_url_enabled && http_request.url == TRACE_URL) {
+                        // 保留的 URL ，返回所有线程最近被采样的请求的 Chrome trace JSON
+                        auto trace = std::make_shared<const WebServer::cached_response>(tracer.format());
+                        http_response http_response = response_batch.add_response(http_status::ok);
+                        http_response.add_header(CONTENT_LENGTH_HEADER, trace->data().size());
+                        end_response(http_response, false);
+                        response_batch.append(std::move(trace));
+                    } else {
+                        const auto lookup_start = std::chrono::steady_clock::now();
+                        const auto file = co_await file_cache::get_instance().lookup(file_path);
+                        tracer.record("file_lookup", connection_id, response_trace_request, lookup_start);
+
+                        // 条件请求只需要 file_cache 中的验证器，客户端的副本没有过期时回复 304 ，不读取也不发送文件
+                        // If-None-Match 存在时忽略 If-Modified-Since
+                        bool not_modified = false;
+                        if (file->exists() && http_request.method == "GET") {
+                            if (const auto if_none_match = http_request.find_header("if-none-match");
+                                    if_none_match.has_value()) {
+                                not_modified = match_entity_tag(if_none_match.value(), file->entity_tag);
+                            } else if (const auto if_modified_since = http_request.find_header("if-modified-since");
+                                    if_modified_since.has_value()) {
+                                const auto date = parse_http_date(if_modified_since.value());
+                                not_modified = date.has_value() && file->modify_time.tv_sec <= date.value();
+                            }
+                        }
+
+                        // 小文件使用缓存的文件内容，读取失败时 cached_response 为 nullptr ，退回到 splice 的方式
+                        std::shared_ptr<const WebServer::cached_response> cached_response;
+                        if (!not_modified && file->exists() && file->size <= RESPONSE_CACHE_FILE_SIZE) {
+                            const auto cache_start = tracer::now_if(response_trace_request);
+                            cached_response = co_await response_cache::get_instance().get(file_path, *file);
+                            tracer.record("cache_read", connection_id, response_trace_request, cache_start);
+                        }
+                        metrics.record(metrics::phase::lookup, lookup_start);
+
+                        // 只有 GET 请求使用 Range 。带有 If-Range 时，只有文件没有变化才发送部分内容，否则发送完整的文件
+                        // If-Range 的值可以是 ETag 或者 Last-Modified 的时间，都要求和当前的值完全相同
+                        const std::string_view last_modified(file->last_modified.data(), file->last_modified.size());
+                        std::optional<std::vector<byte_range>> range_list;
+                        if (const auto range = http_request.find_header("range");
+                                !not_modified && file->exists() && range.has_value() && http_request.method == "GET") {
+                            const auto if_range = http_request.find_header("if-range");
+                            if (!if_range.has_value() || if_range.value() == file->entity_tag ||
+                                if_range.value() == last_modified) {
+                                range_list = parse_range(range.value(), file->size);
+                            }
+                        }
+
+                        // 200 、206 和 304 响应都带有验证器，客户端之后可以用它们发送条件请求
+                        const auto add_validator_header = [&](http_response &http_response) {
+                            http_response.add_header(ETAG_HEADER, file->entity_tag);
+                            http_response.add_header(LAST_MODIFIED_HEADER, last_modified);
+                        };
+
+                        // 发送文件中从 offset 开始的 length 个字节，小文件使用缓存的内容
+                        // 否则文件内容不经过用户态，splice 之前先把之前的响应和这个响应的头部发送出去
+                        // 使用显式的偏移量 splice ，从大文件的中间开始发送时不需要先读取前面的部分
+                        const auto send_file = [&](const uint64_t offset, const uint64_t length) -> task<> {
+                            if (cached_response != nullptr) {
+                                response_batch.append(cached_response, offset, length);
+                                co_return;
+                            }
+                            connected = co_await flush() != -1;
+                            if (connected) {
+                                const auto splice_start = std::chrono::steady_clock::now();
+                                connected = co_await splice(
+                                        *file->file, static_cast<int64_t>(offset), client_socket, length, &timer
+                                ) != -1;
+                                metrics.record(metrics::phase::splice, splice_start);
+                                tracer.record("splice", connection_id, response_trace_request, splice_start);
+                                if (connected) {
+                                    metrics.add(metrics::counter::sent_byte, length);
+                                }
+                            }
+                        };
+
+                        if (file->failed()) {
+                            append_response(http_status::internal_server_error, false);
+                        } else if (!file->exists()) {
+                            append_response(http_status::not_found, false);
+                        } else if (not_modified) {
+                            // 304 响应没有响应体，也不带 content-length
+                            http_response http_response = response_batch.add_response(http_status::not_modified);
+                            add_validator_header(http_response);
+                            end_response(http_response, false);
+                        } else if (!range_list.has_value()) {
+                            http_response http_response = response_batch.add_response(http_status::ok);
+                            http_response.add_header(CONTENT_LENGTH_HEADER, file->size);
+                            http_response.add_header(ACCEPT_RANGES_HEADER, "bytes");
+                            add_validator_header(http_response);
+                            end_response(http_response, false);
+                            co_await send_file(0, file->size);
+                        } else if (range_list->empty()) {
+                            http_response http_response = response_batch.add_response(
+                                    http_status::range_not_satisfiable
+                            );
+                            http_response.add_header(CONTENT_RANGE_HEADER, content_range(file->size).value());
+                            http_response.add_header(CONTENT_LENGTH_HEADER, 0);
+                            metrics.add(metrics::counter::error_response);
+                            end_response(http_response, false);
+                        } else if (range_list->size() == 1) {
+                            const byte_range &range = range_list->front();
+                            http_response http_response = response_batch.add_response(http_status::partial_content);
+                            http_response.add_header(CONTENT_RANGE_HEADER, content_range(range, file->size).value());
+                            http_response.add_header(CONTENT_LENGTH_HEADER, range.length());
+                            add_validator_header(http_response);
+                            end_response(http_response, false);
+                            co_await send_file(range.first, range.length());
+                        } else {
+                            // 多个范围使用 multipart/byteranges ，每个部分之前是分隔行和它自己的 Content-Range
+                            // 分隔行和 Content-Range 直接写入 response_batch 的 arena ，不为每个部分分配字符串
+                            constexpr std::string_view delimiter_prefix = "\r\n--";
+                            constexpr size_t part_header_size = delimiter_prefix.size() + BYTERANGES_BOUNDARY.size() +
+                                                                std::string_view("\r\n").size() +
+                                                                CONTENT_RANGE_HEADER.size() +
+                                                                std::string_view("\r\n\r\n").size();
+                            uint64_t content_length = delimiter_prefix.size() + BYTERANGES_BOUNDARY.size() +
+                                                      std::string_view("--\r\n").size();
+                            for (const byte_range &range: *range_list) {
+                                content_length += part_header_size + content_range(range, file->size).value().size() +
+                                                  range.length();
+                            }
+
+                            http_response http_response = response_batch.add_response(http_status::partial_content);
+                            http_response.add_header(CONTENT_TYPE_HEADER, BYTERANGES_CONTENT_TYPE);
+                            http_response.add_header(CONTENT_LENGTH_HEADER, content_length);
+                            add_validator_header(http_response);
+                            end_response(http_response, false);
+                            for (size_t range_index = 0; connected && range_index < range_list->size(); ++range_index) {
+                                const byte_range &range = (*range_list)[range_index];
+                                response_batch.append(delimiter_prefix);
+                                response_batch.append(BYTERANGES_BOUNDARY);
+                                response_batch.append("\r\n");
+                                response_batch.append(CONTENT_RANGE_HEADER);
+                                response_batch.append(content_range(range, file->size).value());
+                                response_batch.append("\r\n\r\n");
+                                co_await send_file(range.first, range.length());
+                            }
+                            response_batch.append(delimiter_prefix);
+                            response_batch.append(BYTERANGES_BOUNDARY);
+                            response_batch.append("--\r\n");
+                        }
+                    }
+
+                    // 请求体的开头可能已经和请求头一起收到了，其余的部分由之后的缓冲区或者 splice 处理
+                    if (body.has_value()) {
+                        const auto body_start = tracer::now_if(response_trace_request);
+                        http_parser.skip(co_await body->consume(http_parser.unparsed()));
+                        tracer.record("body", connection_id, response_trace_request, body_start);
+                        if (body->done() || body->has_error()) {
+                            co_await finish_body();
+                        }
+                    }
+
+                    if (connected && response_batch.full()) {
+                        connected = co_await flush() != -1;
                     }
                 }
+
+                buffer_ring.return_buffer(buffer_group, buffer_id);
+            }
+
+            // 请求的格式错误，回复 400 之后关闭连接
+            if (connected && !closing && http_parser.has_error()) {
+                append_response(http_status::bad_request, true);
+            }
+
+            // 发送失败说明客户端已经断开了连接，直接关闭连接
+            if (connected) {
+                connected = co_await flush() != -1;
             }
+        }
 
-            buffer_ring.return_buffer(recv_buffer_id);
+        connection_list_.erase(connection_iterator);
+        metrics.set(metrics::gauge::connection, static_cast<int64_t>(connection_list_.size()));
+    }
+
+    task<> thread_worker::wait_drain(const file_descriptor &drain_event) {
+        // eventfd 使用了 EFD_SEMAPHORE ，每次读取只让计数减一，所以每个线程恰好读到一次
+        alignas(uint64_t) std::array<char, sizeof(uint64_t)> buffer;
+        if (co_await read_awaiter(drain_event.get_raw_file_descriptor(), buffer, -1) > 0) {
+            drain();
+        }
+    }
+
+    void thread_worker::drain() {
+        draining_ = true;
+        server_socket_.stop_accept();
+        for (connection &connection: connection_list_) {
+            if (connection.idle) {
+                connection.socket.cancel();
+            }
+        }
+        drain_timer_.start(timeout_config_.drain_timeout);
+    }
+
+    void thread_worker::publish_statistics() {
+        metrics &metrics = metrics::get_instance();
+
+        const response_cache &response_cache = response_cache::get_instance();
+        metrics.set(metrics::counter::response_cache_hit, response_cache.hit_count());
+        metrics.set(metrics::counter::response_cache_miss, response_cache.miss_count());
+
+        const frame_allocator::statistics &frame_statistics = frame_allocator::get_instance().get_statistics();
+        for (size_t size_class = 0; size_class < FRAME_SIZE_CLASS_COUNT; ++size_class) {
+            metrics.set(metrics::frame_counter::allocation, size_class, frame_statistics.allocation_count[size_class]);
+        }
+        metrics.set(metrics::counter::frame_large_allocation, frame_statistics.large_allocation_count);
+        metrics.set(metrics::counter::frame_reuse, frame_statistics.reuse_count);
+        metrics.set(metrics::counter::frame_remote_free, frame_statistics.remote_free_count);
+
+        const buffer_ring::statistics buffer_statistics = buffer_ring::get_instance().get_statistics();
+        for (unsigned int size_class = 0; size_class < BUFFER_SIZE_CLASS_COUNT; ++size_class) {
+            metrics.set(
+                    metrics::buffer_gauge::group, size_class,
+                    static_cast<int64_t>(buffer_statistics.group_count[size_class])
+            );
+            metrics.set(
+                    metrics::buffer_gauge::low_watermark, size_class,
+                    static_cast<int64_t>(buffer_statistics.low_watermark[size_class])
+            );
+            metrics.set(
+                    metrics::buffer_gauge::exhaustion, size_class,
+                    static_cast<int64_t>(buffer_statistics.exhaustion_count[size_class])
+            );
+            metrics.set(
+                    metrics::buffer_gauge::waiting, size_class,
+                    static_cast<int64_t>(buffer_statistics.waiting_count[size_class])
+            );
         }
     }
 
@@ -106,21 +608,45 @@ namespace WebServer {
         // 首先获取io_uring实例的引用
         io_uring &io_uring = io_uring::get_instance();
 
-        while (true) {
-            // 提交所有挂起的请求，并等待至少一个事件完成。这个函数会阻塞，直到有至少一个事件完成
-            io_uring.submit_and_wait(1);
+        buffer_ring &buffer_ring = buffer_ring::get_instance();
+
+        metrics &metrics = metrics::get_instance();
+
+        completion_batcher completion_batcher;
+
+        while (!draining_ || !server_socket_.is_accept_stopped() || !connection_list_.empty()) {
+            // 让上一轮归还的缓冲区对内核可见，并提交等待缓冲区的 recv 请求
+            buffer_ring.flush();
+            publish_statistics();
+
+            // 提交所有挂起的请求，并等待事件完成。低负载时至少一个事件完成就返回，高负载时等待一批事件
+            metrics.set(metrics::gauge::pending_sqe, io_uring.sq_ready());
+            completion_batcher.submit_and_wait(io_uring);
+            metrics.add(metrics::gauge::inflight_sqe, io_uring.take_prepared_sqe_count());
+            metrics.set(metrics::gauge::ready_cqe, io_uring.cq_ready());
 
             // 遍历 io_uring 中的所有完成队列项
             for (io_uring_cqe *const cqe: io_uring) {
+                // multishot 请求和 send_zc 在最后一个 CQE 之前都会带有 IORING_CQE_F_MORE
+                if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                    metrics.add(metrics::gauge::inflight_sqe, -1);
+                }
                 // 获取关联的数据，将这些数据转换为 sqe_data 结构
                 auto *sqe_data = reinterpret_cast<struct sqe_data *>(io_uring_cqe_get_data(cqe));
                 // bug 2023-7-24
                 // 没有在提交 SQE 时设置 user_data ，或者错误地设置为了 NULL ，io_uring_cqe_get_data 会返回 NULL
                 // sqe_data 就也是 nullptr
-
+                // cancel 和 close 这类不需要结果的请求，user_data 被显式地设置为 NULL ，直接跳过
+                if (sqe_data == nullptr) {
+                    io_uring.cqe_seen(cqe);
+                    continue;
+                }
 
                 sqe_data->cqe_res = cqe->res;
                 sqe_data->cqe_flags = cqe->flags;
+                if (sqe_data->cqe_queue != nullptr) {
+                    sqe_data->cqe_queue->emplace(cqe->res, cqe->flags);
+                }
                 void *const coroutine_address = sqe_data->coroutine;
 
                 // 告诉io_uring这个完成队列项已经被处理
@@ -137,14 +663,112 @@ namespace WebServer {
                 // 这使得异步 IO 操作看起来像同步操作一样直观
             };
         }
+
+        // 提交最后一批连接关闭时的 close 请求
+        io_uring.submit_and_wait(0);
+        co_return;
+    }
+
+    void http_server::enable_stats_url() noexcept { stats_url_enabled = true; }
+
+    // 屏蔽 SIGINT 和 SIGTERM ，并返回一个接收它们的 signalfd
+    file_descriptor create_signal_file_descriptor() {
+        sigset_t signal_set;
+        sigemptyset(&signal_set);
+        sigaddset(&signal_set, SIGINT);
+        sigaddset(&signal_set, SIGTERM);
+        sigaddset(&signal_set, SIGUSR1);
+        if (pthread_sigmask(SIG_BLOCK, &signal_set, nullptr) != 0) {
+            throw std::runtime_error("failed to invoke 'pthread_sigmask'");
+        }
+        const int raw_file_descriptor = signalfd(-1, &signal_set, SFD_CLOEXEC);
+        if (raw_file_descriptor == -1) {
+            throw std::runtime_error("failed to invoke 'signalfd'");
+        }
+        return file_descriptor{raw_file_descriptor};
+    }
+
+    file_descriptor create_drain_event() {
+        const int raw_file_descriptor = eventfd(0, EFD_SEMAPHORE | EFD_CLOEXEC);
+        if (raw_file_descriptor == -1) {
+            throw std::runtime_error("failed to invoke 'eventfd'");
+        }
+        return file_descriptor{raw_file_descriptor};
+    }
+
+    // 每个线程的文件缓存最多持有 FILE_CACHE_SIZE 个打开的 fd ，所有线程加起来很容易超过默认 1024 的软限制
+    // 先把 RLIMIT_NOFILE 的软限制提高到硬限制，仍然不够时缩小每个线程的文件缓存
+    // 文件缓存一共只使用一半的 fd ，另一半留给连接、管道、io_uring 和监听套接字
+    void fit_file_cache_to_file_limit(const size_t thread_count) {
+        rlimit limit{};
+        if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+            return;
+        }
+        if (limit.rlim_cur < limit.rlim_max) {
+            // 硬限制可能超过 fs.nr_open ，这时提高失败，继续使用原来的软限制
+            if (const rlimit raised_limit{limit.rlim_max, limit.rlim_max};
+                    setrlimit(RLIMIT_NOFILE, &raised_limit) == 0) {
+                limit = raised_limit;
+            }
+        }
+        if (limit.rlim_cur == RLIM_INFINITY) {
+            return;
+        }
+        if (const size_t capacity = static_cast<size_t>(limit.rlim_cur) / 2 / std::max<size_t>(thread_count, 1);
+                capacity < FILE_CACHE_SIZE) {
+            file_cache::set_capacity(capacity);
+        }
+    }
+
+    http_server::http_server(const size_t thread_count, const timeout_config timeout_config)
+            : signal_file_descriptor_{create_signal_file_descriptor()}, drain_event_{create_drain_event()},
+              metrics_segment_{thread_count}, trace_buffer_{thread_count}, thread_pool_{thread_count},
+              timeout_config_{timeout_config} {
+        fit_file_cache_to_file_limit(thread_count);
     }
 
-    http_server::http_server(const size_t thread_count) : thread_pool_{thread_count} {}
+    void http_server::listen(const char *port, const char *handoff_path) {
+        // 从旧进程接收监听套接字，它们的顺序就是旧进程中线程的顺序，也就是它们在 SO_REUSEPORT 组中的顺序
+        file_descriptor handoff_connection;
+        std::vector<int> inherited_socket_list;
+        if (handoff_path != nullptr) {
+            inherited_socket_list = receive_listening_sockets(handoff_path, handoff_connection);
+        }
+
+        // 按照线程的下标依次创建监听套接字，SO_REUSEPORT 组中套接字的顺序就是 listen 的顺序
+        // 这样 CBPF 程序返回的下标正好对应绑定在处理这个数据包的 CPU 上的线程
+        // 交接过来的套接字已经在组中，数量不够时新创建的套接字加入同一个组
+        server_socket_list_.clear();
+        server_socket_list_.reserve(thread_pool_.size());
+        std::vector<int> cpu_list;
+        for (size_t worker_index = 0; worker_index < thread_pool_.size(); ++worker_index) {
+            if (worker_index < inherited_socket_list.size()) {
+                server_socket_list_.emplace_back(inherited_socket_list[worker_index]);
+            } else {
+                server_socket &server_socket = server_socket_list_.emplace_back();
+                server_socket.bind(port);
+                server_socket.listen();
+            }
+            cpu_list.emplace_back(thread_pool_.get_cpu(worker_index));
+        }
+        // 线程比旧进程少时，多出来的套接字从组的末尾开始关闭，组中其他套接字的顺序不变
+        // 它们的监听队列中还没有被接收的连接，只有在开启了 net.ipv4.tcp_migrate_req 时才会被转移到其他套接字
+        for (size_t index = inherited_socket_list.size(); index > thread_pool_.size(); --index) {
+            close(inherited_socket_list[index - 1]);
+        }
+        if (!server_socket_list_.empty()) {
+            server_socket_list_.front().attach_reuseport_cpu_program(cpu_list);
+        }
 
-    void http_server::listen(const char *port) {
+        // 每个线程都在运行 event_loop ，直到排空完成，所以每个线程恰好会取到一个 construct_task
+        // thread_worker 在它所在的线程上创建，io_uring 和缓冲区环的内存都分配在这个线程的 NUMA 节点上
         const auto construct_task = [&]() -> task<> {
             co_await thread_pool_.schedule();
-            co_await thread_worker(port).event_loop();
+            metrics::get_instance().attach(metrics_segment_, thread_pool::get_current_worker_index());
+            tracer::get_instance().attach(trace_buffer_, thread_pool::get_current_worker_index());
+            co_await thread_worker(
+                    server_socket_list_[thread_pool::get_current_worker_index()], timeout_config_, drain_event_
+            ).event_loop();
         };
 
         std::vector<task<>> thread_worker_list;
@@ -153,6 +777,68 @@ namespace WebServer {
             thread_worker.resume();
             thread_worker_list.emplace_back(std::move(thread_worker));
         }
+
+        // 旧进程收到确认之后才会停止接收连接，在这之前两个进程同时从这些套接字接收连接
+        // 之后在同一个路径上等待下一次升级
+        std::optional<file_descriptor> handoff_listener;
+        if (handoff_path != nullptr) {
+            if (!inherited_socket_list.empty()) {
+                acknowledge_handoff(handoff_connection);
+            }
+            handoff_listener.emplace(listen_handoff(handoff_path));
+        }
+
+        wait_for_shutdown(handoff_listener.has_value() ? &handoff_listener.value() : nullptr);
+
+        // 通知每个线程开始排空，计数为线程的数量，每个线程读到其中的一次
+        const uint64_t count = thread_pool_.size();
+        if (write(drain_event_.get_raw_file_descriptor(), &count, sizeof(count)) != sizeof(count)) {
+            throw std::runtime_error("failed to invoke 'write'");
+        }
         sync_wait_all(thread_worker_list);
     }
-}
\ No newline at end of file
+
+    void http_server::wait_for_shutdown(const file_descriptor *handoff_listener) {
+        std::array<pollfd, 2> poll_list{
+                pollfd{.fd = signal_file_descriptor_.get_raw_file_descriptor(), .events = POLLIN, .revents = 0},
+                pollfd{
+                        .fd = handoff_listener != nullptr ? handoff_listener->get_raw_file_descriptor() : -1,
+                        .events = POLLIN, .revents = 0
+                },
+        };
+
+        std::vector<int> socket_list;
+        for (const server_socket &server_socket: server_socket_list_) {
+            socket_list.emplace_back(server_socket.get_raw_file_descriptor());
+        }
+
+        while (true) {
+            if (poll(poll_list.data(), poll_list.size(), -1) == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("failed to invoke 'poll'");
+            }
+            if (poll_list[0].revents & POLLIN) {
+                signalfd_siginfo signal_info{};
+                if (read(signal_file_descriptor_.get_raw_file_descriptor(), &signal_info, sizeof(signal_info)) ==
+                    sizeof(signal_info)) {
+                    if (signal_info.ssi_signo != SIGUSR1) {
+                        return;
+                    }
+                    // SIGUSR1 只导出 trace ，服务器继续运行
+                    const std::string path = std::string(TRACE_FILE_PREFIX) + std::to_string(getpid()) + ".json";
+                    if (trace_buffer_.dump(path)) {
+                        std::cout << "trace: " << path << std::endl;
+                    } else {
+                        std::cerr << "failed to write the trace to " << path << std::endl;
+                    }
+                }
+            }
+            // 交接失败时，旧进程继续正常运行，等待下一次交接
+            if ((poll_list[1].revents & POLLIN) && send_listening_sockets(*handoff_listener, socket_list)) {
+                return;
+            }
+        }
+    }
+}
@@ -1,46 +1,172 @@
 #ifndef BUFFER_RING_H
 #define BUFFER_RING_H
 
-#include <bitset>
+#include <array>
 #include <cstddef>
-#include <memory>
+#include <list>
 #include <span>
 #include <vector>
 #include <liburing/io_uring.h>
 #include "constant.h"
 
 namespace WebServer {
+    struct sqe_data;
 
     // 类buffer_ring是一个使用了 thread_local 单例模式的环形缓冲区管理器
     // 因为是 thread_local ，每个线程都会有一个独立的 buffer_ring 实例
     // 这样可以避免在不同线程之间共享数据时需要使用锁，从而提高性能
+    // 缓冲区按照 BUFFER_SIZE_LIST 分成几个大小类，每个大小类有一个或多个缓冲区组，每个组都是一个独立的 io_uring_buf_ring
+    // 启动时每个大小类有一个组，它们都来自一整块大页内存。某个大小类的缓冲区持续不够用时，再为它增加新的组
     class buffer_ring {
     public:
+        // 一个被借用的缓冲区以及它所在的组和 ID
+        class borrowed_buffer {
+        public:
+            unsigned int buffer_group;
+            unsigned int buffer_id;
+            std::span<char> buffer;
+        };
+
+        // 一个从缓冲区组中选择缓冲区的 multishot recv 请求，由 submit_recv 提交
+        // 没有空闲的缓冲区时，请求会先放入等待队列，有缓冲区被归还之后由 flush 提交
+        class recv_request {
+        public:
+            sqe_data *recv_sqe_data = nullptr;
+            int raw_file_descriptor = -1;
+            bool fixed_file = false;
+            // 提交请求时选择的缓冲区组
+            unsigned int buffer_group = 0;
+
+            // 是否在等待队列中，以及在队列中的位置
+            bool waiting = false;
+            std::list<recv_request *>::iterator position;
+        };
+
+        // 每个大小类的统计数据
+        class statistics {
+        public:
+            std::array<size_t, BUFFER_SIZE_CLASS_COUNT> group_count{};
+            // 曾经出现过的最少的空闲缓冲区数量，为 0 说明这个大小类曾经被耗尽过
+            std::array<size_t, BUFFER_SIZE_CLASS_COUNT> low_watermark{};
+            // recv 因为没有缓冲区而以 -ENOBUFS 结束的次数
+            std::array<size_t, BUFFER_SIZE_CLASS_COUNT> exhaustion_count{};
+            // 正在等待缓冲区的请求数量
+            std::array<size_t, BUFFER_SIZE_CLASS_COUNT> waiting_count{};
+        };
+
         // 返回当前线程的 buffer_ring 单例实例
         static buffer_ring &get_instance() noexcept;
 
-        // 初始化环形缓冲区
-        void register_buffer_ring(const unsigned int buffer_ring_size, const size_t buffer_size);
+        buffer_ring() = default;
+
+        ~buffer_ring();
+
+        buffer_ring(const buffer_ring &other) = delete;
+
+        buffer_ring &operator=(const buffer_ring &other) = delete;
+
+        // 分配内存，并把每个大小类的第一个缓冲区组注册到当前线程的 io_uring
+        void register_buffer_ring();
+
+        // 返回缓冲区不小于 size 的最小的大小类，size 超过最大的缓冲区时返回最大的大小类
+        [[nodiscard]] static unsigned int select_size_class(size_t size) noexcept;
+
+        // 缓冲区组 buffer_group 所属的大小类
+        [[nodiscard]] unsigned int get_size_class(unsigned int buffer_group) const noexcept;
+
+        // 从大小类 size_class 中选择空闲缓冲区最多的组，提交 request
+        // 整个大小类都没有空闲的缓冲区时，request 放入等待队列
+        void submit_recv(recv_request &request, unsigned int size_class);
+
+        // 把还在等待队列中的 request 移出队列
+        void cancel_recv(recv_request &request);
+
+        // recv 以 -ENOBUFS 结束，说明内核已经取完了 buffer_group 中的缓冲区
+        void report_exhausted(unsigned int buffer_group);
 
         // 允许 io_uring 借用一个指定 ID 的缓冲区
-        std::span<char> borrow_buffer(const unsigned int buffer_id, const size_t size);
+        std::span<char> borrow_buffer(unsigned int buffer_group, unsigned int buffer_id, size_t size);
+
+        // 借用一个 CQE 对应的所有缓冲区，buffer_id 是 CQE 中的第一个缓冲区的 ID ，size 是接收到的总字节数
+        // 使用 bundle 接收时，内核按照缓冲区在环中的顺序依次填满多个缓冲区，结果保存在 buffer_list 中
+        void borrow_buffer_list(
+                unsigned int buffer_group, unsigned int buffer_id, size_t size,
+                std::vector<borrowed_buffer> &buffer_list
+        );
 
-        // 允许 io_uring 归还一个指定 ID 的缓冲区
-        void return_buffer(const unsigned int buffer_id);
+        // 归还一个指定 ID 的缓冲区，它在下一次 flush 时才对内核可见
+        void return_buffer(unsigned int buffer_group, unsigned int buffer_id);
+
+        // 由事件循环在每次提交之前调用：每个组只推进一次环的 tail ，然后提交等待缓冲区的请求
+        // 某个大小类持续有请求在等待时，为它增加一个新的缓冲区组
+        void flush();
+
+        [[nodiscard]] statistics get_statistics() const noexcept;
 
     private:
-        // 它是一个 io_uring_buf_ring 类型的智能指针
-        // 用于管理 io_uring 中的环形缓冲区，每次分配一个新的缓冲区时，它都会更新
-        std::unique_ptr<io_uring_buf_ring> buffer_ring_;
+        // 一个缓冲区组，组 ID 就是它在 group_list_ 中的下标
+        class group_state {
+        public:
+            io_uring_buf_ring *ring = nullptr;
+            // 第 buffer_id 个缓冲区从 buffer_area + buffer_id * buffer_size 开始
+            char *buffer_area = nullptr;
+            size_t buffer_size = 0;
+            unsigned int ring_size = 0;
+            unsigned int size_class = 0;
+
+            // 环中每个位置上的缓冲区 ID ，以及每个缓冲区最后一次被放入环中的位置
+            // bundle 接收时，CQE 只给出第一个缓冲区的 ID ，其余的缓冲区需要通过它们在环中的位置找到
+            std::vector<unsigned int> ring_buffer_id_list;
+            std::vector<unsigned int> buffer_position_list;
+
+            // 下一个放入环中的缓冲区的位置，包括还没有 flush 的缓冲区
+            unsigned int ring_tail = 0;
+            // 已经放入环中、但还没有推进内核可见的 tail 的缓冲区数量
+            unsigned int pending_count = 0;
+            // 已经借出、还没有通过 flush 重新对内核可见的缓冲区数量，每个缓冲区只会被计算一次
+            unsigned int borrowed_count = 0;
+            // 收到 -ENOBUFS 之后，内核已经取走的缓冲区的 CQE 可能还在 CQ 中没有处理，借出的数量暂时偏少
+            // 所以在下一次有缓冲区被归还之前，认为这个组没有空闲的缓冲区
+            bool exhausted = false;
+
+            [[nodiscard]] std::span<char> get_buffer(unsigned int buffer_id) const noexcept;
+
+            // 环中空闲的缓冲区数量，由实际借出的缓冲区计算，而不是估计值，所以不会因为耗尽而累积误差
+            [[nodiscard]] size_t get_free_count() const noexcept;
+        };
+
+        class size_class_state {
+        public:
+            std::vector<unsigned int> buffer_group_list;
+            std::list<recv_request *> waiting_list;
+            // 连续有请求在等待缓冲区的 flush 次数
+            size_t starving_count = 0;
+
+            size_t low_watermark = 0;
+            size_t exhaustion_count = 0;
+        };
+
+        // 分配一块 size 字节的内存，大小是大页的整数倍
+        char *allocate_slab(size_t size);
+
+        // 用 ring_memory 处的环和 buffer_area 处的缓冲区创建一个 size_class 大小类的缓冲区组，并注册到 io_uring
+        void add_buffer_group(unsigned int size_class, char *ring_memory, char *buffer_area);
+
+        // 为 size_class 增加一个新的缓冲区组，内存来自一块新的大页内存
+        void grow(unsigned int size_class);
+
+        // 大小类 size_class 中所有组的空闲缓冲区数量
+        [[nodiscard]] size_t get_free_count(unsigned int size_class) const noexcept;
+
+        // 使用缓冲区组 buffer_group 提交 request
+        void submit_recv_to_group(recv_request &request, unsigned int buffer_group);
 
-        // 二维的 std::vector，包含了所有的缓冲区
-        // 每个缓冲区是一个 std::vector<char>，代表一块内存区域
-        std::vector<std::vector<char>> buffer_list_;
+        std::vector<group_state> group_list_;
+        std::array<size_class_state, BUFFER_SIZE_CLASS_COUNT> size_class_list_;
 
-        // 它是一个 bitset，用于跟踪哪些缓冲区正在被借用
-        // 当一个缓冲区被借用时，相应的位会被设置为true
-        std::bitset<MAX_BUFFER_RING_SIZE> borrowed_buffer_set_;
+        // 所有的环和缓冲区所在的内存
+        std::vector<std::span<char>> slab_list_;
     };
 }
 
-#endif
\ No newline at end of file
+#endif
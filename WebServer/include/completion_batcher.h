@@ -0,0 +1,43 @@
+#ifndef COMPLETION_BATCHER_H
+#define COMPLETION_BATCHER_H
+
+#include <chrono>
+#include "io_uring.h"
+
+namespace WebServer {
+
+    // 类 completion_batcher 决定事件循环每一轮怎样提交请求和等待完成事件
+    // 它记录每一轮得到的完成事件数量和完成事件之间的平均间隔，按照负载选择等待的方式：
+    // 高负载时等待多个完成事件再一起处理，用一次 io_uring_enter 处理更多的请求，等待的时间不超过 COMPLETION_WAIT_BUDGET
+    // 低负载时和之前一样，只要有一个完成事件就返回，不会增加延迟
+    // 启用了忙轮询时，低负载下会先忙轮询一小段时间再阻塞，省去线程睡眠和唤醒的开销
+    class completion_batcher {
+    public:
+        // 让之后创建的 completion_batcher 在阻塞之前最多忙轮询 busy_poll_time ，为 0 表示不忙轮询
+        // 必须在启动线程池之前调用
+        static void enable_busy_poll(std::chrono::microseconds busy_poll_time) noexcept;
+
+        completion_batcher();
+
+        // 提交所有挂起的请求，并等待完成事件
+        void submit_and_wait(io_uring &io_uring);
+
+    private:
+        // 在 busy_poll_time_ 之内不断检查 CQ ，有完成事件时返回 true
+        [[nodiscard]] bool busy_poll(io_uring &io_uring) const;
+
+        // 用这一轮得到的完成事件数量和花费的时间更新平均值
+        void update(unsigned int completion_count, std::chrono::nanoseconds elapsed) noexcept;
+
+        const std::chrono::nanoseconds busy_poll_time_;
+
+        // 每一轮得到的完成事件数量，以及两个完成事件之间的间隔（纳秒）的指数移动平均
+        double average_completion_count_ = 0;
+        double average_completion_interval_ = 0;
+
+        // 上一次等待结束的时间
+        std::chrono::steady_clock::time_point last_wait_end_;
+    };
+}
+
+#endif
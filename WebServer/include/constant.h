@@ -1,20 +1,172 @@
 #ifndef CONSTANT_H
 #define CONSTANT_H
+#include <array>
+#include <chrono>
 #include <cstddef>
+#include <string_view>
 
 namespace WebServer {
 
     constexpr unsigned int SOCKET_LISTEN_QUEUE_SIZE = 512;
 
-    constexpr unsigned int MAX_BUFFER_RING_SIZE = 65536;
-
     constexpr size_t IO_URING_QUEUE_SIZE = 2048;
 
-    constexpr unsigned int BUFFER_GROUP_ID = 0;
+    // SQPOLL 模式下，内核轮询线程空闲多少毫秒之后进入睡眠，之后的提交需要再通过系统调用唤醒它
+    constexpr unsigned int SQPOLL_IDLE_TIME = 1000;
+
+    // 线程池中每个线程的工作窃取队列的初始容量，必须是 2 的幂
+    constexpr size_t WORK_STEALING_DEQUE_SIZE = 256;
+
+    // 每个 io_uring 的固定文件表的大小，也就是每个线程最多同时保持的连接数
+    constexpr unsigned int FIXED_FILE_TABLE_SIZE = 65536;
+
+    // 接收缓冲区的大小类，每个大小类至少有一个缓冲区组
+    // 小的请求使用小的缓冲区，上传文件之类的大请求使用大的缓冲区，不会被拆分到很多个小缓冲区中
+    constexpr size_t BUFFER_SIZE_CLASS_COUNT = 3;
+
+    constexpr std::array<size_t, BUFFER_SIZE_CLASS_COUNT> BUFFER_SIZE_LIST{1024, 16 * 1024, 64 * 1024};
+
+    // 每个缓冲区组中缓冲区的数量，必须是 2 的幂
+    constexpr std::array<unsigned int, BUFFER_SIZE_CLASS_COUNT> BUFFER_RING_SIZE_LIST{4096, 128, 32};
+
+    // 每个大小类最多的缓冲区组数量，缓冲区持续不够用时才会增加新的组
+    constexpr size_t MAX_BUFFER_GROUP_PER_SIZE_CLASS = 8;
+
+    // 一个大小类连续这么多次事件循环都有请求在等待缓冲区，就为它增加一个缓冲区组
+    constexpr size_t BUFFER_RING_GROW_THRESHOLD = 64;
+
+    // 缓冲区所在的内存按照这个大小对齐，这样可以使用 2 MiB 的大页
+    constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    // 一个请求的请求行和所有头部的总长度上限，超过时认为是错误的请求
+    constexpr size_t MAX_REQUEST_HEADER_SIZE = 8 * 1024;
+
+    // 一个请求最多包含的头部数量
+    constexpr size_t MAX_HEADER_COUNT = 64;
+
+    // 一个 Range 头部最多包含的范围数量，超过时忽略这个头部，发送完整的文件
+    constexpr size_t MAX_RANGE_COUNT = 16;
+
+    // multipart/byteranges 响应中分隔各个部分的边界
+    constexpr std::string_view BYTERANGES_BOUNDARY = "WebServer-byteranges-7f3a9c2e5b8d1046";
+
+    // multipart/byteranges 响应的 Content-Type ，在编译期就包含了边界，发送时不需要拼接
+    constexpr std::string_view BYTERANGES_CONTENT_TYPE =
+            "multipart/byteranges; boundary=WebServer-byteranges-7f3a9c2e5b8d1046";
+
+    static_assert(BYTERANGES_CONTENT_TYPE.ends_with(BYTERANGES_BOUNDARY));
+
+    // splice 使用的管道的容量，超过 /proc/sys/fs/pipe-max-size 时使用系统默认的容量
+    constexpr size_t PIPE_SIZE = 1024 * 1024;
+
+    // 整个进程中扩大到 PIPE_SIZE 的管道最多占用的字节数，超出之后新的管道使用系统默认的容量
+    // 同一个用户的所有管道一共只能使用 /proc/sys/fs/pipe-user-pages-soft 个页（默认 16384 页，也就是 64 MiB ）
+    // 超出之后内核不再允许扩大管道，新创建的管道也只有很小的容量，所以这里只使用其中的一半
+    constexpr size_t PIPE_TOTAL_SIZE = 32 * 1024 * 1024;
+
+    // 每个线程最多缓存的空闲管道数量，多出来的管道直接关闭，把占用的容量还给 PIPE_TOTAL_SIZE
+    constexpr size_t PIPE_POOL_SIZE = 4;
+
+    // 协程帧内存池最小的大小类
+    constexpr size_t MIN_FRAME_SIZE = 64;
+
+    // 协程帧内存池的大小类的数量，从 MIN_FRAME_SIZE 开始，每个大小类是上一个的两倍，最大为 16 KiB
+    constexpr size_t FRAME_SIZE_CLASS_COUNT = 9;
+
+    // 每个线程的协程帧内存池中，每个大小类最多缓存的空闲内存的字节数
+    constexpr size_t FRAME_POOL_SIZE = 1024 * 1024;
+
+    // 每个线程的文件缓存最多保存的条目数（包括 404 的负缓存条目）
+    // 每个条目持有一个打开的 fd ，所有线程加起来超过 RLIMIT_NOFILE 时，http_server 会缩小每个线程的缓存
+    constexpr size_t FILE_CACHE_SIZE = 1024;
+
+    // 一次从 inotify 读取事件的缓冲区大小
+    constexpr size_t INOTIFY_BUFFER_SIZE = 4096;
+
+    // 不超过这个大小的文件，会把整个响应缓存在内存中，用一次 send 发出
+    constexpr size_t RESPONSE_CACHE_FILE_SIZE = 16 * 1024;
+
+    // 每个线程的响应缓存最多占用的字节数
+    constexpr size_t RESPONSE_CACHE_SIZE = 32 * 1024 * 1024;
+
+    // 每个响应缓存条目除了文件内容之外额外计入字节预算的大小，近似路径、验证器和链表、哈希表节点的开销
+    // 这样空文件也会占用预算，大量的空文件不会让条目的数量无限增长
+    constexpr size_t RESPONSE_CACHE_NODE_SIZE = 256;
+
+    // 默认不小于这个长度的数据使用零拷贝的 send ，更短的数据拷贝的开销比锁定内存页和额外的通知 CQE 更小
+    // 可以通过 --zero-copy-threshold= 或者 client_socket::set_zero_copy_threshold() 修改
+    // 交叉点取决于内核、CPU 和网卡，在部署的机器上运行 zero_copy_bench ，把阈值设置为输出中的
+    // zero_copy_registered_crossover_byte （响应缓存中的条目都注册为固定缓冲区）。8 KiB 还没有经过这样的测量
+    constexpr size_t ZERO_COPY_SEND_THRESHOLD = 8 * 1024;
+
+    // 上传文件时，请求体剩下的部分不小于这个长度，就停止 multishot recv ，直接从套接字 splice 到文件
+    constexpr size_t SPLICE_REQUEST_BODY_SIZE = 64 * 1024;
+
+    // 流水线请求的响应合并发送时，一次 sendmsg 最多包含的缓冲区数量
+    constexpr size_t SEND_BATCH_SIZE = 64;
+
+    // 每个 io_uring 的固定缓冲区表的大小
+    constexpr unsigned int REGISTERED_BUFFER_COUNT = 1024;
+
+    // 事件循环平均每轮得到的完成事件不少于这个数量时，认为负载较高，开始批量等待完成事件
+    constexpr double COMPLETION_BATCH_THRESHOLD = 2;
+
+    // 批量等待时一次最多等待的完成事件数量
+    constexpr unsigned int COMPLETION_BATCH_SIZE = 32;
+
+    // 批量等待时最多等待的时间，超过之后即使完成事件不够也开始处理，这是批量等待给请求增加的延迟的上限
+    constexpr std::chrono::microseconds COMPLETION_WAIT_BUDGET{50};
+
+    // 时间轮的精度，定时器最多比设定的时间晚一个 tick 到期
+    constexpr std::chrono::milliseconds TIMER_WHEEL_TICK{100};
+
+    // 时间轮的槽的数量，超过一圈的定时器会在同一个槽中等待下一圈
+    constexpr size_t TIMER_WHEEL_SIZE = 1024;
+
+    // 保持连接的客户端多久没有发送新的请求就关闭连接，也是接收请求体时两次收到数据之间的最长间隔
+    constexpr std::chrono::seconds IDLE_TIMEOUT{60};
+
+    // 从收到一个请求的第一个字节开始，多久没有收到完整的请求行和头部就关闭连接
+    constexpr std::chrono::seconds HEADER_TIMEOUT{10};
+
+    // 一次发送多久没有完成就关闭连接，splice 发送文件时每发送一段数据都会重新计时
+    constexpr std::chrono::seconds SEND_TIMEOUT{30};
+
+    // 排空时等待已有的连接完成的最长时间，超过之后直接关闭剩下的连接
+    constexpr std::chrono::seconds DRAIN_TIMEOUT{30};
+
+    // 交接监听套接字时等待对端的最长时间
+    constexpr std::chrono::seconds HANDOFF_TIMEOUT{10};
+
+    // 一次交接最多传递的监听套接字数量，也就是内核对一条消息中 SCM_RIGHTS 的限制（ SCM_MAX_FD ）
+    constexpr size_t MAX_HANDOFF_SOCKET_COUNT = 253;
+
+    // 缓存行的大小，每个线程的统计数据按照它对齐，避免不同线程之间的伪共享
+    constexpr size_t CACHE_LINE_SIZE = 64;
+
+    // 延迟直方图的精度：每个 2 的幂的区间分成 2^HISTOGRAM_SUB_BUCKET_BITS 个桶，误差不超过 1/8
+    constexpr size_t HISTOGRAM_SUB_BUCKET_BITS = 3;
+
+    // 延迟直方图能记录的最大值（纳秒）的位数，更大的值记录在最后一个桶中，2^40 纳秒大约是 18 分钟
+    constexpr size_t HISTOGRAM_VALUE_BITS = 40;
+
+    constexpr size_t HISTOGRAM_BUCKET_COUNT = (HISTOGRAM_VALUE_BITS - HISTOGRAM_SUB_BUCKET_BITS + 1)
+            << HISTOGRAM_SUB_BUCKET_BITS;
+
+    // 返回统计数据的保留 URL ，通过 http_server::enable_stats_url() 启用之后，同名的文件不会被访问到
+    constexpr std::string_view STATS_URL = "/__stats";
+
+    // 统计数据所在的共享内存的名字的前缀，之后是进程的 PID ，比如 /dev/shm/webserver-1234
+    constexpr std::string_view STATS_SHARED_MEMORY_PREFIX = "/webserver-";
+
+    // 每个线程的 trace 环形缓冲区能保存的事件数量，必须是 2 的幂，写满之后覆盖最旧的事件
+    constexpr size_t TRACE_RING_SIZE = 16384;
 
-    constexpr unsigned int BUFFER_RING_SIZE = 4096;
+    // 返回 Chrome trace JSON 的保留 URL ，和 STATS_URL 一起启用
+    constexpr std::string_view TRACE_URL = "/__trace";
 
-    constexpr size_t BUFFER_SIZE = 1024;
+    // 收到 SIGUSR1 时写入的 trace 文件的路径前缀，之后是进程的 PID ，比如 /tmp/webserver-trace-1234.json
+    constexpr std::string_view TRACE_FILE_PREFIX = "/tmp/webserver-trace-";
 
 }
 
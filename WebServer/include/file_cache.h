@@ -0,0 +1,107 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "file_descriptor.h"
+#include "http_message.h"
+#include "task.h"
+
+namespace WebServer {
+
+    // 类 file_cache 是一个使用了 thread_local 单例模式的静态文件缓存
+    // 它缓存已经打开的文件 fd 和文件的元数据，以及不存在的文件（ 404 的负缓存）
+    // 这样重复请求同一个文件时，在 splice 之前不需要任何文件系统的系统调用
+    // 没有命中时通过 io_uring 的 openat2 和 statx 打开文件，慢速的磁盘不会阻塞事件循环
+    // 路径相对于文档根目录的 fd 解析，RESOLVE_BENEATH 和 RESOLVE_NO_SYMLINKS 由内核保证不会访问到文档根目录之外
+    // 缓存条目通过 inotify 监听所在目录以及祖先目录的变化来失效，并且用 LRU 限制条目的数量
+    class file_cache {
+    public:
+        // 一个缓存条目，file 为 nullptr 表示文件不存在、不是普通文件或者打开失败
+        // 条件请求需要的验证器在打开文件时就生成好，命中缓存时回复 304 不需要任何系统调用
+        class entry {
+        public:
+            std::shared_ptr<const file_descriptor> file;
+            // 打开文件或者读取元数据失败时的 errno ，为 0 表示没有出错
+            int error = 0;
+            uintmax_t size = 0;
+            timespec modify_time{};
+            // 由 inode 、大小和修改时间生成的强 ETag ，包括两边的引号
+            std::string entity_tag;
+            // Last-Modified 头部的值，也就是 modify_time 的 HTTP 格式
+            std::array<char, HTTP_DATE_SIZE> last_modified{};
+
+            [[nodiscard]] bool exists() const noexcept { return file != nullptr; }
+
+            // 失败的原因不是文件不存在，比如 fd 耗尽、内存不足或者没有权限，应该回复 5xx 而不是 404
+            // ELOOP 表示路径中有符号链接，它和文件不存在一样对待
+            [[nodiscard]] bool failed() const noexcept {
+                return error != 0 && error != ENOENT && error != ENOTDIR && error != ELOOP;
+            }
+        };
+
+        // 返回当前线程的 file_cache 单例实例
+        static file_cache &get_instance() noexcept;
+
+        // 设置每个线程的文件缓存最多保存的条目数，默认为 FILE_CACHE_SIZE ，必须在创建任何实例之前调用
+        static void set_capacity(size_t capacity) noexcept;
+
+        file_cache();
+
+        // 查找 path 对应的文件，path 是相对于文档根目录的路径，没有命中时异步地打开文件并加入缓存
+        // 返回的 shared_ptr 保证在使用期间，fd 不会因为缓存失效或淘汰而被关闭
+        task<std::shared_ptr<const entry>> lookup(const std::filesystem::path &path);
+
+        // 让 path 对应的缓存条目立即失效，用于当前线程自己修改了文件的情况，不需要等待 inotify 事件
+        void erase(const std::filesystem::path &path);
+
+        // 在一个循环中读取 inotify 事件，并让对应的缓存条目失效
+        task<> watch();
+
+    private:
+        class cache_node {
+        public:
+            std::shared_ptr<const entry> cache_entry;
+            std::list<std::string>::iterator lru_iterator;
+        };
+
+        // 为目录 directory 以及它的所有祖先目录添加 inotify 监听，成功返回 true
+        bool watch_directory(const std::filesystem::path &directory);
+
+        // 删除 directory 以及它下面的所有目录的监听，之后再次查找时会按照新的路径重新监听
+        void unwatch(const std::string &directory);
+
+        // 让 path 以及 path 下的所有缓存条目失效
+        void invalidate(const std::string &path, bool recursive);
+
+        void insert(const std::string &path, std::shared_ptr<const entry> entry);
+
+        // 文档根目录，也就是启动时的当前目录，只用于解析路径
+        file_descriptor root_directory_;
+
+        // 每次有条目失效时增加，打开文件期间发生了失效时，打开的结果可能已经过期，不加入缓存
+        uint64_t invalidation_count_ = 0;
+
+        // inotify 的 fd ，打开失败或者读取出错时，缓存会被禁用
+        file_descriptor inotify_file_descriptor_;
+        bool enabled_ = false;
+
+        // 被监听目录的 watch descriptor 和目录路径之间的映射
+        std::unordered_map<int, std::string> watch_directory_map_;
+        std::unordered_map<std::string, int> watch_descriptor_map_;
+
+        // 最近使用的条目在链表的头部，缓存满时淘汰链表尾部的条目
+        std::list<std::string> lru_list_;
+        std::unordered_map<std::string, cache_node> cache_map_;
+    };
+}
+
+#endif
@@ -2,13 +2,18 @@
 #define FILE_DESCRIPTOR_H
 
 #include <compare>
+#include <cstdint>
 #include <coroutine>
 #include <filesystem>
 #include <optional>
+#include <span>
 #include <tuple>
 #include <unistd.h>
+#include <linux/openat2.h>
+#include <sys/stat.h>
 #include "io_uring.h"
 #include "task.h"
+#include "timer_wheel.h"
 
 // 封装了一些 fd 相关的系统调用
 // open(), pipe(), splice()
@@ -36,14 +41,174 @@ namespace WebServer {
 
         [[nodiscard]] int get_raw_file_descriptor() const;
 
+        // raw_file_descriptor 是否是 io_uring 固定文件表中的下标，而不是普通的 fd
+        [[nodiscard]] bool is_fixed_file() const;
+
     protected:
         std::optional<int> raw_file_descriptor_;
+
+        // 固定文件只能通过 io_uring 使用，关闭时也需要提交一个 close 请求
+        bool fixed_file_ = false;
+    };
+
+    // 从 fd 中读取数据到 buffer
+    class read_awaiter {
+    public:
+        read_awaiter(int raw_file_descriptor, std::span<char> buffer, int64_t offset);
+
+        [[nodiscard]] bool await_ready() const;
+
+        // co_await 时，向 io_uring 提交一个 read 请求
+        void await_suspend(std::coroutine_handle<> coroutine);
+
+        [[nodiscard]] ssize_t await_resume() const;
+
+    private:
+        const int raw_file_descriptor_;
+        const std::span<char> buffer_;
+        const int64_t offset_;
+        sqe_data sqe_data_;
+    };
+
+    // 把 buffer 中的数据写入 fd
+    class write_awaiter {
+    public:
+        write_awaiter(int raw_file_descriptor, std::span<const char> buffer, int64_t offset);
+
+        [[nodiscard]] bool await_ready() const;
+
+        // co_await 时，向 io_uring 提交一个 write 请求
+        void await_suspend(std::coroutine_handle<> coroutine);
+
+        [[nodiscard]] ssize_t await_resume() const;
+
+    private:
+        const int raw_file_descriptor_;
+        const std::span<const char> buffer_;
+        const int64_t offset_;
+        sqe_data sqe_data_;
+    };
+
+    // 在目录 directory_file_descriptor 下打开 path ，返回打开的 fd ，失败时返回 -errno
+    // how.resolve 可以让内核限制路径的解析，比如 RESOLVE_BENEATH 不允许解析到目录之外
+    class openat2_awaiter {
+    public:
+        openat2_awaiter(int raw_directory_file_descriptor, const std::filesystem::path &path, open_how how);
+
+        [[nodiscard]] bool await_ready() const;
+
+        // co_await 时，向 io_uring 提交一个 openat2 请求
+        void await_suspend(std::coroutine_handle<> coroutine);
+
+        [[nodiscard]] int await_resume() const;
+
+    private:
+        const int raw_directory_file_descriptor_;
+        const std::filesystem::path &path_;
+        open_how how_;
+        sqe_data sqe_data_;
+    };
+
+    // 获取已经打开的 fd 的元数据，或者目录 raw_directory_file_descriptor 下 path 的元数据
+    // 成功返回 0 ，失败时返回 -errno 。请求完成时 mask 中的字段被写入 statx
+    class statx_awaiter {
+    public:
+        statx_awaiter(int raw_file_descriptor, unsigned int mask, struct statx &statx);
+
+        statx_awaiter(
+                int raw_directory_file_descriptor, const char *path, int flags, unsigned int mask, struct statx &statx
+        );
+
+        [[nodiscard]] bool await_ready() const;
+
+        // co_await 时，向 io_uring 提交一个 statx 请求
+        void await_suspend(std::coroutine_handle<> coroutine);
+
+        [[nodiscard]] int await_resume() const;
+
+    private:
+        const int raw_file_descriptor_;
+        const char *const path_;
+        const int flags_;
+        const unsigned int mask_;
+        struct statx &statx_;
+        sqe_data sqe_data_;
+    };
+
+    // 在目录 raw_new_directory_file_descriptor 下给文件增加一个名字 new_path ，成功返回 0 ，失败时返回 -errno
+    // new_path 已经存在时返回 -EEXIST
+    class linkat_awaiter {
+    public:
+        linkat_awaiter(
+                int raw_old_directory_file_descriptor, const char *old_path, int raw_new_directory_file_descriptor,
+                const char *new_path, int flags
+        );
+
+        [[nodiscard]] bool await_ready() const;
+
+        // co_await 时，向 io_uring 提交一个 linkat 请求
+        void await_suspend(std::coroutine_handle<> coroutine);
+
+        [[nodiscard]] int await_resume() const;
+
+    private:
+        const int raw_old_directory_file_descriptor_;
+        const char *const old_path_;
+        const int raw_new_directory_file_descriptor_;
+        const char *const new_path_;
+        const int flags_;
+        sqe_data sqe_data_;
+    };
+
+    // 重命名文件，new_path 已经存在时被原子地替换，成功返回 0 ，失败时返回 -errno
+    class renameat_awaiter {
+    public:
+        renameat_awaiter(
+                int raw_old_directory_file_descriptor, const char *old_path, int raw_new_directory_file_descriptor,
+                const char *new_path
+        );
+
+        [[nodiscard]] bool await_ready() const;
+
+        // co_await 时，向 io_uring 提交一个 renameat 请求
+        void await_suspend(std::coroutine_handle<> coroutine);
+
+        [[nodiscard]] int await_resume() const;
+
+    private:
+        const int raw_old_directory_file_descriptor_;
+        const char *const old_path_;
+        const int raw_new_directory_file_descriptor_;
+        const char *const new_path_;
+        sqe_data sqe_data_;
+    };
+
+    // 删除目录 raw_directory_file_descriptor 下的文件 path ，成功返回 0 ，失败时返回 -errno
+    class unlinkat_awaiter {
+    public:
+        unlinkat_awaiter(int raw_directory_file_descriptor, const char *path);
+
+        [[nodiscard]] bool await_ready() const;
+
+        // co_await 时，向 io_uring 提交一个 unlinkat 请求
+        void await_suspend(std::coroutine_handle<> coroutine);
+
+        [[nodiscard]] int await_resume() const;
+
+    private:
+        const int raw_directory_file_descriptor_;
+        const char *const path_;
+        sqe_data sqe_data_;
     };
 
     // 在 fd 之间移动数据
+    // offset 为 -1 时使用并推进 fd 的当前位置，否则从指定的偏移量开始，不修改 fd 的当前位置
     class splice_awaiter {
     public:
-        splice_awaiter(int raw_file_descriptor_in, int raw_file_descriptor_out, size_t length);
+        splice_awaiter(
+                int raw_file_descriptor_in, bool fixed_file_in, int64_t offset_in,
+                int raw_file_descriptor_out, bool fixed_file_out, int64_t offset_out, size_t length
+        );
 
         [[nodiscard]] bool await_ready() const;
 
@@ -54,15 +219,52 @@ namespace WebServer {
 
     private:
         const int raw_file_descriptor_in_;
+        const bool fixed_file_in_;
+        const int64_t offset_in_;
         const int raw_file_descriptor_out_;
+        const bool fixed_file_out_;
+        const int64_t offset_out_;
         const size_t length_;
         sqe_data sqe_data_;
     };
 
-    // 在 fd 之间移动长度为 length 的数据
+    // 通过管道，把文件中的数据移动到 fd ，两次 splice 使用链接在一起的请求一次提交
+    class linked_splice_awaiter {
+    public:
+        linked_splice_awaiter(
+                int raw_file_descriptor_in, bool fixed_file_in, int64_t offset_in,
+                int raw_pipe_write_file_descriptor, int raw_pipe_read_file_descriptor,
+                int raw_file_descriptor_out, bool fixed_file_out, size_t length
+        );
+
+        [[nodiscard]] bool await_ready() const;
+
+        // co_await 时，向 io_uring 提交两个链接在一起的 splice 请求
+        void await_suspend(std::coroutine_handle<> coroutine);
+
+        // 返回两次 splice 的结果：文件到管道移动的字节数，管道到 fd 移动的字节数
+        [[nodiscard]] std::tuple<ssize_t, ssize_t> await_resume() const;
+
+    private:
+        const int raw_file_descriptor_in_;
+        const bool fixed_file_in_;
+        const int64_t offset_in_;
+        const int raw_pipe_write_file_descriptor_;
+        const int raw_pipe_read_file_descriptor_;
+        const int raw_file_descriptor_out_;
+        const bool fixed_file_out_;
+        const size_t length_;
+        sqe_data read_sqe_data_;
+        sqe_data write_sqe_data_;
+    };
+
+    // 从文件 file_descriptor_in 的 offset 处开始，向 file_descriptor_out 移动长度为 length 的数据
+    // 使用显式的偏移量读取文件，所以多个请求可以同时共享同一个文件的 fd
+    // 读取套接字这类不能指定偏移量的 fd 时，offset 为 -1 ，这时不使用链接的请求，读取和发送分别提交
+    // timer 不为 nullptr 时，每移动一段数据就重新开始计时，timer 到期之后返回 -1
     task<ssize_t> splice(
-            const file_descriptor &file_descriptor_in, const file_descriptor &file_descriptor_out,
-            const size_t length
+            const file_descriptor &file_descriptor_in, int64_t offset,
+            const file_descriptor &file_descriptor_out, size_t length, timer_wheel::timer *timer = nullptr
     );
 
     // 创建一个管道，并返回两个文件描述符，一个用于读取，一个用于写入
@@ -0,0 +1,68 @@
+#ifndef FRAME_ALLOCATOR_H
+#define FRAME_ALLOCATOR_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include "constant.h"
+
+namespace WebServer {
+
+    // 类 frame_allocator 是一个使用了 thread_local 单例模式的协程帧内存池
+    // 每个连接的 handle_client 以及每次 send 、splice 都会创建一个新的协程帧
+    // 内存池按照大小类缓存释放的帧，创建协程时直接复用，不需要每次都调用全局的 operator new
+    // 一个帧可能在另一个线程中被释放（比如通过 thread_pool::schedule() 切换了线程的协程）
+    // 这时它被放回所属线程的一个无锁的链表中，所属线程下一次分配时再把它们取回来
+    class frame_allocator {
+    public:
+        // 每个线程的计数器，只由所属的线程修改，由 thread_worker 写入 metrics
+        class statistics {
+        public:
+            // 每个大小类分配的次数
+            std::array<size_t, FRAME_SIZE_CLASS_COUNT> allocation_count{};
+            // 超过最大的大小类、直接使用全局的 operator new 的分配次数
+            size_t large_allocation_count = 0;
+            // 从空闲链表中复用帧的次数
+            size_t reuse_count = 0;
+            // 释放其他线程分配的帧的次数
+            size_t remote_free_count = 0;
+        };
+
+        // 返回当前线程的 frame_allocator 单例实例
+        static frame_allocator &get_instance() noexcept;
+
+        void *allocate(size_t size);
+
+        void deallocate(void *frame) noexcept;
+
+        [[nodiscard]] const statistics &get_statistics() const noexcept;
+
+    private:
+        // 每个帧之前的头部，记录所属的线程和大小类，大小保证帧的对齐和 operator new 相同
+        class alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) frame_header {
+        public:
+            // 为 nullptr 表示帧超过了最大的大小类
+            frame_allocator *owner;
+            size_t size_class;
+        };
+
+        // 空闲的帧复用帧本身的内存保存链表的指针
+        class free_frame {
+        public:
+            free_frame *next;
+        };
+
+        frame_allocator() = default;
+
+        // 把其他线程释放的帧放回对应的空闲链表
+        void collect_remote_free_list() noexcept;
+
+        std::array<free_frame *, FRAME_SIZE_CLASS_COUNT> free_list_{};
+        std::array<size_t, FRAME_SIZE_CLASS_COUNT> free_count_{};
+        // 其他线程释放的帧，多个线程并发地压入，只有所属线程一次性取出全部，所以不存在 ABA 问题
+        std::atomic<frame_header *> remote_free_list_ = nullptr;
+        statistics statistics_;
+    };
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <span>
+#include <vector>
+#include "file_descriptor.h"
+
+// 零停机升级时，新旧两个进程通过一个 Unix 套接字交接监听套接字
+// 1. 旧进程在 path 上等待新进程连接（ listen_handoff 、send_listening_sockets ）
+// 2. 新进程连接 path ，通过 SCM_RIGHTS 收到旧进程所有的监听套接字（ receive_listening_sockets ）
+// 3. 新进程开始接收连接之后发送确认（ acknowledge_handoff ），旧进程收到确认之后才停止接收连接并开始排空
+// 两个进程共享同一组监听套接字，交接期间已经在监听队列中的连接不会被重置
+namespace WebServer {
+    // 连接 path 上的旧进程并接收它的监听套接字，按照旧进程中线程的顺序排列
+    // connection 保存这个连接，之后用它发送确认。没有正在运行的旧进程时返回空的列表
+    std::vector<int> receive_listening_sockets(const char *path, file_descriptor &connection);
+
+    // 告诉旧进程新进程已经开始接收连接，旧进程可以开始排空了
+    void acknowledge_handoff(const file_descriptor &connection);
+
+    // 在 path 上创建等待新进程连接的 Unix 套接字，path 上已有的文件（上一个进程留下的套接字）会被删除
+    file_descriptor listen_handoff(const char *path);
+
+    // 接受一个新进程的连接，把 socket_list 发送给它，并等待它的确认
+    // 只接受同一个用户的进程，收到确认时返回 true ，否则旧进程应该继续正常运行
+    bool send_listening_sockets(const file_descriptor &listener, std::span<const int> socket_list);
+}
+
+#endif
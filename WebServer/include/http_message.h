@@ -1,29 +1,164 @@
 #ifndef HTTP_MESSAGE_H
 #define HTTP_MESSAGE_H
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <tuple>
 #include <vector>
+#include "constant.h"
 
 // HTTP 请求和响应
 namespace WebServer {
 
+    // 不区分大小写地比较两个字符串，用于比较头部的名字和值
+    bool equal_ignore_case(std::string_view a, std::string_view b);
+
+    // 所有的 string_view 都直接指向 http_parser 的输入数据，只在下一次调用 http_parser::feed 之前有效
     class http_request {
     public:
-        std::string method; // HTTP请 求的方法，比如"GET"、"POST"等
-        std::string url; // 请求的 URL
-        std::string version; // HTTP 的版本，比如"HTTP/1.1"
-        std::vector<std::tuple<std::string, std::string>> header_list; // HTTP 请求头的键值对
+        std::string_view method; // HTTP请 求的方法，比如"GET"、"POST"等
+        std::string_view url; // 请求的 URL
+        std::string_view version; // HTTP 的版本，比如"HTTP/1.1"
+        // HTTP 请求头的键值对，只有前 header_count 个是有效的
+        std::array<std::tuple<std::string_view, std::string_view>, MAX_HEADER_COUNT> header_list;
+        size_t header_count = 0;
+
+        // 查找名字为 name 的头部，名字不区分大小写，没有找到时返回一个空的 optional
+        [[nodiscard]] std::optional<std::string_view> find_header(std::string_view name) const;
+
+        // 和上面的 find_header 相同，同名的头部出现了不止一次时 duplicated 为 true ，返回第一个头部的值
+        // equal_value_allowed 为 true 时，值和第一个头部相同的重复头部不算重复
+        [[nodiscard]] std::optional<std::string_view> find_header(
+                std::string_view name, bool &duplicated, bool equal_value_allowed = false
+        ) const;
     };
 
+    // HTTP 响应的状态码
+    enum class http_status : unsigned int {
+        continue_ = 100,
+        ok = 200,
+        created = 201,
+        no_content = 204,
+        partial_content = 206,
+        not_modified = 304,
+        bad_request = 400,
+        not_found = 404,
+        method_not_allowed = 405,
+        range_not_satisfiable = 416,
+        internal_server_error = 500
+    };
+
+    // 状态行在编译期就拼接好了，包括行尾的 "\r\n"
+    constexpr std::string_view status_line(const http_status status) {
+        switch (status) {
+            case http_status::continue_:
+                return "HTTP/1.1 100 Continue\r\n";
+            case http_status::ok:
+                return "HTTP/1.1 200 OK\r\n";
+            case http_status::created:
+                return "HTTP/1.1 201 Created\r\n";
+            case http_status::no_content:
+                return "HTTP/1.1 204 No Content\r\n";
+            case http_status::partial_content:
+                return "HTTP/1.1 206 Partial Content\r\n";
+            case http_status::not_modified:
+                return "HTTP/1.1 304 Not Modified\r\n";
+            case http_status::bad_request:
+                return "HTTP/1.1 400 Bad Request\r\n";
+            case http_status::not_found:
+                return "HTTP/1.1 404 Not Found\r\n";
+            case http_status::method_not_allowed:
+                return "HTTP/1.1 405 Method Not Allowed\r\n";
+            case http_status::range_not_satisfiable:
+                return "HTTP/1.1 416 Range Not Satisfiable\r\n";
+            case http_status::internal_server_error:
+                return "HTTP/1.1 500 Internal Server Error\r\n";
+        }
+        return "HTTP/1.1 500 Internal Server Error\r\n";
+    }
+
+    // 常用的响应头的名字，已经包含了名字后面的 ": "
+    constexpr std::string_view ACCEPT_RANGES_HEADER = "accept-ranges: ";
+    constexpr std::string_view ALLOW_HEADER = "allow: ";
+    constexpr std::string_view CONNECTION_HEADER = "connection: ";
+    constexpr std::string_view CONTENT_LENGTH_HEADER = "content-length: ";
+    constexpr std::string_view CONTENT_RANGE_HEADER = "content-range: ";
+    constexpr std::string_view CONTENT_TYPE_HEADER = "content-type: ";
+    constexpr std::string_view DATE_HEADER = "date: ";
+    constexpr std::string_view ETAG_HEADER = "etag: ";
+    constexpr std::string_view LAST_MODIFIED_HEADER = "last-modified: ";
+
+    // IMF-fixdate 格式的时间，比如 "Sun, 06 Nov 1994 08:49:37 GMT"
+    constexpr size_t HTTP_DATE_SIZE = 29;
+
+    std::array<char, HTTP_DATE_SIZE> format_http_date(time_t time);
+
+    // 解析 IMF-fixdate 格式的时间，格式错误时返回空的 optional
+    // RFC 9110 中过时的 rfc850-date 和 asctime-date 格式也会被当作格式错误，这时条件请求被忽略，发送完整的响应
+    std::optional<time_t> parse_http_date(std::string_view date);
+
+    // If-None-Match 的值中是否有和 entity_tag 匹配的 ETag ，使用弱比较，也就是忽略 "W/" 前缀，"*" 匹配任何 ETag
+    bool match_entity_tag(std::string_view value, std::string_view entity_tag);
+
+    // 当前时间的 HTTP 格式，每个线程缓存一份，每秒最多格式化一次
+    std::string_view current_http_date();
+
+    // Range 头部中的一个字节范围，first 和 last 都包含在内
+    class byte_range {
+    public:
+        uint64_t first = 0;
+        uint64_t last = 0;
+
+        [[nodiscard]] uint64_t length() const noexcept { return last - first + 1; }
+    };
+
+    // 解析 Range 头部的值，size 是文件的大小
+    // 返回空的 optional 表示应该忽略这个头部，发送完整的文件：单位不是 bytes 、格式错误或者范围超过 MAX_RANGE_COUNT 个
+    // 否则返回可以满足的范围，按照位置排序，并且合并了重叠和相邻的范围，为空时应该回复 416
+    std::optional<std::vector<byte_range>> parse_range(std::string_view value, uint64_t size);
+
+    // Content-Range 头部的值，使用 std::to_chars 格式化在对象内部的数组中，不分配内存
+    class content_range {
+    public:
+        // 部分响应的 "bytes <first>-<last>/<size>" ，比如 "bytes 0-99/1000"
+        content_range(const byte_range &range, uint64_t size) noexcept;
+
+        // 416 响应的 "bytes */<size>"
+        explicit content_range(uint64_t size) noexcept;
+
+        [[nodiscard]] std::string_view value() const noexcept;
+
+    private:
+        // 把 number 和之后的 suffix 写入 buffer_ 的末尾
+        void append(uint64_t number, char suffix) noexcept;
+
+        // "bytes " 、三个最多 20 位的十进制数以及它们之间的 '-' 和 '/'
+        std::array<char, 6 + 20 * 3 + 2> buffer_;
+        size_t size_ = 0;
+    };
+
+    // 把响应头直接写入 buffer 的末尾，不经过 stringstream ，也不为每个响应分配内存
+    // buffer 通常是 response_batch 中复用的 arena ，容量足够时追加数据不会分配内存
     class http_response {
     public:
-        std::string version;
-        std::string status; // HTTP 响应的状态码，比如"200"
-        std::string status_text; // HTTP 状态码对应的文本，比如"OK"
-        std::vector<std::tuple<std::string, std::string>> header_list; // HTTP 响应头的键值对
+        // 写入状态行和 Date 头部
+        http_response(std::string &buffer, http_status status);
+
+        void add_header(std::string_view name, std::string_view value);
+
+        // 使用 std::to_chars 格式化整数
+        void add_header(std::string_view name, uint64_t value);
+
+        // 写入头部结束的空行，根据 HTTP 协议，这之后是响应的主体（body）
+        void end();
 
-        [[nodiscard]] std::string serialize() const; // 将 http_response 对象序列化成一个字符串
+    private:
+        std::string &buffer_;
     };
 
 }
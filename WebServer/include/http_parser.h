@@ -1,23 +1,89 @@
 #ifndef HTTP_PARSER_H
 #define HTTP_PARSER_H
 
+#include <array>
+#include <cstddef>
 #include <optional>
 #include <span>
-#include <string>
+#include <tuple>
+#include <vector>
+#include "constant.h"
 
 namespace WebServer {
     class http_request;
 
+    // 可以恢复的 HTTP/1.1 请求解析器，直接在接收到的缓冲区上解析，解析出的请求不拷贝任何数据
+    // 一个请求跨越多个缓冲区时，只把未完成的部分拷贝到内部的缓冲区中，之后的数据追加到它的后面继续解析
     class http_parser {
     public:
+        // 查找换行符和分隔符时是否使用 SIMD 指令，默认在支持的 CPU 上使用
+        // 只用于在微基准中和逐字节查找比较，必须在任何线程开始解析之前调用
+        static void enable_simd(bool enabled);
+
         // 输入一个字符的 span 对象，表示从网络接收到的 HTTP 请求的原始数据
-        // 如果能成功解析出一个 HTTP 请求，返回包含这个请求的 optional ；如果解析失败，返回一个空的 optional
-        std::optional<http_request> parse_packet(std::span<char> packet);
+        // packet 必须保持有效，直到下一次调用 feed ，之前解析出的请求也会在那时失效
+        void feed(std::span<const char> packet);
+
+        // 从已经输入的数据中解析出下一个完整的请求
+        // 数据不完整或者请求格式错误时返回一个空的 optional ，可以用 has_error() 区分这两种情况
+        std::optional<http_request> next();
+
+        // 上一个请求之后还没有解析的数据，也就是上一个请求的请求体的开头（如果有请求体的话）
+        // 只能在 next() 返回一个请求之后、下一次调用 next() 之前使用
+        [[nodiscard]] std::span<const char> unparsed() const noexcept;
+
+        // 跳过 unparsed() 开头长度为 length 的数据，它们已经作为请求体被处理了
+        void skip(size_t length) noexcept;
+
+        // 请求格式错误或者请求头过大，之后的数据都不会再被解析，应该关闭连接
+        [[nodiscard]] bool has_error() const noexcept;
+
+        // 是否已经收到了一个请求的一部分，还在等待它的请求行和头部的其余部分
+        [[nodiscard]] bool has_partial_request() const noexcept;
 
     private:
-        // 储存从网络接收到的原始 HTTP 请求数据
-        std::string raw_http_request_;
+        enum class parse_state {
+            request_line,
+            header_line,
+            error
+        };
+
+        // 一段文本在当前请求中的位置，请求被拷贝到内部的缓冲区后仍然有效
+        class token {
+        public:
+            size_t offset = 0;
+            size_t length = 0;
+        };
+
+        // 解析一行，成功时返回 true 。line 是这一行在当前请求中的位置，不包括行尾的 "\r\n"
+        bool parse_request_line(token line);
+
+        bool parse_header_line(token line);
+
+        // 当前请求的起始位置
+        [[nodiscard]] const char *request_data() const noexcept;
+
+        parse_state state_ = parse_state::request_line;
+
+        // 正在解析的数据，指向最近一次输入的 packet ，或者指向 buffer_
+        std::span<const char> input_;
+        // 当前请求在 input_ 中的起始位置，之前的数据都已经解析完了
+        size_t request_offset_ = 0;
+        // 当前正在解析的行的起始位置，以及下一次查找换行符的位置，都是相对于当前请求的起始位置
+        size_t line_offset_ = 0;
+        size_t search_offset_ = 0;
+
+        // 当前请求已经解析出的部分
+        token method_;
+        token url_;
+        token version_;
+        std::array<std::tuple<token, token>, MAX_HEADER_COUNT> header_list_;
+        size_t header_count_ = 0;
+
+        // 保存跨越多个缓冲区的请求，只有请求没有在一个缓冲区中结束时才会使用
+        std::vector<char> buffer_;
+        bool buffered_ = false;
     };
 }
 
-#endif
\ No newline at end of file
+#endif
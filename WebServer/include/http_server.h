@@ -1,17 +1,42 @@
 #ifndef HTTP_SERVER_H
 #define HTTP_SERVER_H
 
+#include <chrono>
 #include <cstddef>
+#include <list>
 #include <thread>
+#include <vector>
+#include "file_descriptor.h"
+#include "metrics.h"
 #include "socket.h"
 #include "task.h"
 #include "thread_pool.h"
+#include "timer_wheel.h"
+#include "tracer.h"
 
 namespace WebServer {
+    // 连接的超时时间，为 0 表示不限制
+    class timeout_config {
+    public:
+        // 保持连接时等待下一个请求，以及接收请求体时等待下一段数据的时间
+        std::chrono::milliseconds idle_timeout = IDLE_TIMEOUT;
+        // 从收到一个请求的第一个字节开始，接收完请求行和头部的时间
+        std::chrono::milliseconds header_timeout = HEADER_TIMEOUT;
+        // 一次发送没有任何进展的时间
+        std::chrono::milliseconds send_timeout = SEND_TIMEOUT;
+        // 开始排空之后等待已有的连接完成的时间，超过之后关闭剩下的连接
+        std::chrono::milliseconds drain_timeout = DRAIN_TIMEOUT;
+    };
+
     // 这个类负责处理与客户端的交互。它的构造函数会启动两个协程：accept_client 和 event_loop
     class thread_worker {
     public:
-        explicit thread_worker(const char *port);
+        // server_socket 是分配给当前线程的监听套接字，已经完成了 bind 和 listen
+        // drain_event 是所有线程共享的 eventfd ，每个线程从中读到一次之后开始排空
+        thread_worker(
+                server_socket &server_socket, const timeout_config &timeout_config,
+                const file_descriptor &drain_event
+        );
 
         // 在一个循环中通过调用 server_socket::accept() 来提交一个 multishot accept 请求到 io_uring.
         // 由于 multishot accept 请求的持久性, server_socket::accept() 只有当之前的请求失效时才会提交新的请求到 io_uring.
@@ -19,26 +44,84 @@ namespace WebServer {
         task<> accept_client();
 
         // 调用 client_socket::recv() 来接收 HTTP 请求, 并且用 http_parser (http_parser.hpp) 解析 HTTP 请求
-        // 等请求解析完毕后, 它会构造一个 http_response 并调用 client_socket::send() 将响应发给客户端
+        // 等请求解析完毕后, 它会把响应头写入 response_batch, 接收到的请求都处理完之后再一起发给客户端
+        // 空闲、接收请求头或者发送超时时，取消套接字上的请求并关闭连接
         task<> handle_client(client_socket client_socket);
 
-        // 在一个无限循环中处理来自 io_uring 的完成队列中的事件，并继续运行等待该事件的协程
+        // 在一个循环中处理来自 io_uring 的完成队列中的事件，并继续运行等待该事件的协程
         // 这样做的目的是让服务器能够异步地处理各种 I/O 操作，包括读写套接字、文件操作等
+        // 排空完成之后，也就是不再接收连接，并且所有的连接都已经关闭时返回
         task<> event_loop();
 
     private:
-        server_socket server_socket_;
+        // 把只在当前线程中维护的统计数据写入 metrics ，其他进程和 STATS_URL 才能读到它们
+        // 每轮事件循环调用一次，只是几次 relaxed 的写入
+        static void publish_statistics();
+
+        // 一个正在处理的连接，排空时用来找到需要关闭的连接
+        class connection {
+        public:
+            client_socket &socket;
+            // 正在等待下一个请求，没有处理到一半的请求，排空时可以立即关闭
+            bool idle = false;
+            // 排空超时，连接需要立即关闭
+            bool aborted = false;
+        };
+
+        // 等待 drain_event ，然后开始排空
+        task<> wait_drain(const file_descriptor &drain_event);
+
+        // 停止接收新的连接，关闭空闲的连接，其他连接在当前的请求完成之后关闭
+        // drain_timeout 之后还没有关闭的连接会被直接关闭
+        void drain();
+
+        server_socket &server_socket_;
+        const timeout_config timeout_config_;
+
+        bool draining_ = false;
+        std::list<connection> connection_list_;
+        timer_wheel::timer drain_timer_;
     };
 
     // 初始化一个线程池，然后为线程池中的每个线程创建一个无限循环的 thread_worker 任务
+    // 统计数据总是可以从共享内存 /dev/shm/webserver-<PID> 读取，启用了追踪时发送 SIGUSR1 可以导出
+    // 最近被采样的请求的 Chrome trace JSON 。通过 enable_stats_url() 启用之后，请求 STATS_URL 和 TRACE_URL
+    // 也可以得到同样的数据
     class http_server {
     public:
-        explicit http_server(size_t thread_count = std::thread::hardware_concurrency());
+        explicit http_server(
+                size_t thread_count = std::thread::hardware_concurrency(), timeout_config timeout_config = {}
+        );
+
+        // 在 port 上接收连接，直到收到 SIGINT 或者 SIGTERM ，或者监听套接字被交接给了新进程
+        // 之后停止接收连接，等待已有的连接完成之后返回
+        // handoff_path 不为 nullptr 时，先尝试从 handoff_path 上的旧进程接收监听套接字，并在开始接收连接之后
+        // 在 handoff_path 上等待下一个新进程
+        void listen(const char *port, const char *handoff_path = nullptr);
 
-        void listen(const char *port);
+        // 允许任何客户端通过 STATS_URL 和 TRACE_URL 读取统计数据和 trace ，它们会暴露请求的路径和服务器的负载
+        // 没有调用时这两个 URL 和其他的 URL 一样，访问文档根目录下的文件。必须在创建 http_server 之前调用
+        static void enable_stats_url() noexcept;
 
     private:
+        // 等待 SIGINT 、SIGTERM 或者一次成功的交接，handoff_listener 为 nullptr 时只等待信号
+        void wait_for_shutdown(const file_descriptor *handoff_listener);
+
+        // 屏蔽 SIGINT 、SIGTERM 和 SIGUSR1 的信号，由 signal_file_descriptor_ 接收
+        // 必须在 thread_pool_ 之前创建，之后创建的线程都会继承屏蔽的信号，不会被这些信号直接终止
+        file_descriptor signal_file_descriptor_;
+        // 通知每个线程开始排空的 eventfd
+        file_descriptor drain_event_;
+        // 所有线程的统计数据，线程在启动时 attach 到其中属于自己的 worker_slot
+        metrics::segment metrics_segment_;
+        // 所有线程的 trace 环形缓冲区，收到 SIGUSR1 时导出到 TRACE_FILE_PREFIX<PID>.json
+        tracer::trace_buffer trace_buffer_;
+
+        // 每个线程一个监听套接字，下标和线程在线程池中的下标相同
+        // 必须在 thread_pool_ 之前声明，保证析构时线程都已经结束
+        std::vector<server_socket> server_socket_list_;
         thread_pool thread_pool_;
+        const timeout_config timeout_config_;
     };
 }
 
@@ -3,11 +3,17 @@
 
 #include <liburing.h>
 #include <sys/socket.h>
+#include <chrono>
+#include <cstdint>
+#include <queue>
 #include <span>
+#include <tuple>
 #include <vector>
 
 struct io_uring_buf_ring;
 struct io_uring_cqe;
+struct open_how;
+struct statx;
 
 // io_uring 的简单封装
 namespace WebServer {
@@ -16,12 +22,21 @@ namespace WebServer {
         void *coroutine = nullptr;
         int cqe_res = 0;
         unsigned int cqe_flags = 0;
+
+        // 对于 multishot 请求，CQE 可能在协程没有等待它的时候到达
+        // 不为 nullptr 时，事件循环会把每个 CQE 的结果都放入这个队列，而不只是覆盖 cqe_res 和 cqe_flags
+        std::queue<std::tuple<int, unsigned int>> *cqe_queue = nullptr;
     };
 
     class io_uring {
     public:
         static io_uring &get_instance() noexcept;
 
+        // 让之后创建的 io_uring 优先使用 SQPOLL 模式，必须在启动线程池之前调用
+        // 内核不支持或者没有权限时，仍然退回到普通模式
+        static void enable_sqpoll() noexcept;
+
+        // 按照内核支持的程度，选择 SQPOLL、SINGLE_ISSUER、DEFER_TASKRUN、COOP_TASKRUN 中最好的组合
         io_uring();
 
         ~io_uring();
@@ -66,43 +81,175 @@ namespace WebServer {
         // 不到这个数量会一直阻塞，达到才返回
         int submit_and_wait(int wait_nr);
 
+        // 提交所有挂起的请求，等到至少 wait_nr 个完成事件，或者 timeout 之后返回
+        // 超时不是错误，这时 CQ 中的完成事件可能少于 wait_nr ，甚至没有
+        // 内核不支持 IORING_FEAT_EXT_ARG 时 liburing 需要占用一个 SQE 来实现超时，这时退回到 submit_and_wait(1)
+        void submit_and_wait_timeout(unsigned int wait_nr, std::chrono::nanoseconds timeout);
+
+        // 不阻塞地让内核把已经完成的事件放入 CQ
+        // DEFER_TASKRUN 和 COOP_TASKRUN 模式下，完成事件要等到线程进入内核时才会出现在 CQ 中，忙轮询时需要调用这个函数
+        // SQPOLL 模式下完成事件直接进入 CQ ，不需要系统调用
+        void get_events();
+
+        // 返回上次调用之后准备的 SQE 数量并清零。每个 SQE 最终都会产生一个不带 IORING_CQE_F_MORE 的 CQE
+        // 所以用它和完成事件可以准确地计算在途的请求数量，不受 SQPOLL 模式下内核线程何时取走请求的影响
+        unsigned int take_prepared_sqe_count() noexcept;
+
+        // SQ 中还没有提交给内核的请求数量
+        [[nodiscard]] unsigned int sq_ready() const noexcept;
+
+        // CQ 中还没有处理的完成事件数量
+        [[nodiscard]] unsigned int cq_ready() const noexcept;
+
         // 创建并提交一个可以接受多个连接的 accept 请求到 io_uring 的 sq
+        // 新的连接直接放入固定文件表，CQE 的结果是它在固定文件表中的下标，而不是普通的 fd
         void submit_multishot_accept_request(
                 sqe_data *sqe_data, int raw_file_descriptor, sockaddr *client_addr, socklen_t *client_len
         );
 
-        // 创建并提交一个接收数据的 recv 请求到 io_uring 的 sq
-        void submit_recv_request(sqe_data *sqe_data, int raw_file_descriptor, size_t length);
+        // 下面的请求中，fixed_file 为 true 表示 raw_file_descriptor 是固定文件表中的下标
+
+        // 创建并提交一个 multishot recv 请求到 io_uring 的 sq ，数据会被放入 buffer_ring 提供的缓冲区
+        // 内核支持时使用 bundle ，一个 CQE 可以包含多个连续的缓冲区
+        void submit_multishot_recv_request(
+                sqe_data *sqe_data, int raw_file_descriptor, bool fixed_file, unsigned int buffer_group
+        );
+
+        // 提交一个 connect 请求，请求完成之前 address 必须保持有效
+        void submit_connect_request(
+                sqe_data *sqe_data, int raw_file_descriptor, const sockaddr *address, socklen_t address_size
+        );
 
         void submit_send_request(
-                sqe_data *sqe_data, int raw_file_descriptor, const std::span<char> &buffer, size_t length
+                sqe_data *sqe_data, int raw_file_descriptor, bool fixed_file, std::span<const char> buffer,
+                size_t length
+        );
+
+        // 提交一个 sendmsg 请求，一次发送 message 中的所有缓冲区，请求完成之前 message 必须保持有效
+        void submit_sendmsg_request(
+                sqe_data *sqe_data, int raw_file_descriptor, bool fixed_file, const msghdr *message
+        );
+
+        // 提交一个零拷贝的 send 请求，buffer_index 不为 -1 时，buffer 必须位于这个下标的固定缓冲区中
+        // 请求完成时会产生两个 CQE ，第一个带有 IORING_CQE_F_MORE 标志，表示发送的结果
+        // 第二个带有 IORING_CQE_F_NOTIF 标志，表示内核已经不再使用 buffer
+        void submit_send_zc_request(
+                sqe_data *sqe_data, int raw_file_descriptor, bool fixed_file, std::span<const char> buffer,
+                size_t length, int buffer_index
+        );
+
+        // 提交一个 read 请求，offset 为 -1 时从文件当前位置读取
+        void submit_read_request(
+                sqe_data *sqe_data, int raw_file_descriptor, const std::span<char> &buffer, int64_t offset
+        );
+
+        // 提交一个 write 请求，offset 为 -1 时写入文件当前位置，并推进当前位置
+        void submit_write_request(
+                sqe_data *sqe_data, int raw_file_descriptor, std::span<const char> buffer, int64_t offset
+        );
+
+        // 提交一个 openat2 请求，path 相对于目录 raw_directory_file_descriptor 解析，CQE 的结果是打开的 fd
+        // 请求完成之前 path 和 how 必须保持有效
+        void submit_openat2_request(
+                sqe_data *sqe_data, int raw_directory_file_descriptor, const char *path, open_how *how
         );
 
+        // 提交一个 statx 请求，path 为空字符串并且 flags 包含 AT_EMPTY_PATH 时，获取 fd 自身的元数据
+        // 请求完成之前 path 和 statx 必须保持有效
+        void submit_statx_request(
+                sqe_data *sqe_data, int raw_file_descriptor, const char *path, int flags, unsigned int mask,
+                struct statx *statx
+        );
+
+        // 提交一个 linkat 请求，给 old_path 指向的文件增加一个名字 new_path ，new_path 已经存在时失败
+        // 请求完成之前 old_path 和 new_path 必须保持有效
+        void submit_linkat_request(
+                sqe_data *sqe_data, int raw_old_directory_file_descriptor, const char *old_path,
+                int raw_new_directory_file_descriptor, const char *new_path, int flags
+        );
+
+        // 提交一个 renameat 请求，new_path 已经存在时被原子地替换
+        // 请求完成之前 old_path 和 new_path 必须保持有效
+        void submit_renameat_request(
+                sqe_data *sqe_data, int raw_old_directory_file_descriptor, const char *old_path,
+                int raw_new_directory_file_descriptor, const char *new_path
+        );
+
+        // 提交一个 unlinkat 请求，请求完成之前 path 必须保持有效
+        void submit_unlinkat_request(sqe_data *sqe_data, int raw_directory_file_descriptor, const char *path);
+
         // splice 是零拷贝的移动数据
-        // 提交一个 splice 请求
+        // 提交一个 splice 请求，offset 为 -1 时使用文件当前位置（管道和套接字必须为 -1）
         void submit_splice_request(
-                sqe_data *sqe_data, int raw_file_descriptor_in, int raw_file_descriptor_out, size_t length
+                sqe_data *sqe_data, int raw_file_descriptor_in, bool fixed_file_in, int64_t offset_in,
+                int raw_file_descriptor_out, bool fixed_file_out, int64_t offset_out, size_t length
+        );
+
+        // 提交两个链接在一起的 splice 请求：文件到管道，管道到 raw_file_descriptor_out
+        // 第一个请求完成后内核才会开始第二个请求，第一个请求移动的数据少于 length 时，第二个请求会以 -ECANCELED 结束
+        // 两个请求只需要一次提交，并且只有第二个请求完成时才需要唤醒协程
+        void submit_linked_splice_request(
+                sqe_data *read_sqe_data, sqe_data *write_sqe_data,
+                int raw_file_descriptor_in, bool fixed_file_in, int64_t offset_in,
+                int raw_pipe_write_file_descriptor, int raw_pipe_read_file_descriptor,
+                int raw_file_descriptor_out, bool fixed_file_out, size_t length
         );
 
         // 提交一个 cancel 请求
         // 取消已经提交到 io_uring 的操作请求
         void submit_cancel_request(sqe_data *sqe_data);
 
-        // 初始化和设置 io_uring 的缓冲区环，用于存储和传输数据
+        // 提交一个取消 raw_file_descriptor 上所有请求的 cancel 请求，不需要等待它完成
+        void submit_cancel_file_descriptor_request(int raw_file_descriptor, bool fixed_file);
+
+        // 提交一个 timeout 请求，timeout 之后以 -ETIME 完成，请求完成之前 timeout 必须保持有效
+        void submit_timeout_request(sqe_data *sqe_data, __kernel_timespec *timeout);
+
+        // 提交一个 nop 请求，它会立即以 0 完成，用来在事件循环中唤醒等待 sqe_data 的协程
+        void submit_nop_request(sqe_data *sqe_data);
+
+        // 提交一个关闭固定文件表中下标为 file_index 的文件的请求，不需要等待它完成
+        void submit_close_direct_request(int file_index);
+
+        // 内核是否支持 bundle 的 recv ，也就是一个 CQE 可以包含多个缓冲区
+        [[nodiscard]] bool is_recv_bundle_supported() const noexcept;
+
+        // 把 buffer_ring 注册为缓冲区组 buffer_group ，并放入 buffer_ring_size 个连续的缓冲区
+        // 第 i 个缓冲区的 ID 是 i ，从 buffer_area + i * buffer_size 开始
         void setup_buffer_ring(
-                io_uring_buf_ring *buffer_ring, std::span<std::vector<char>> buffer_list,
+                io_uring_buf_ring *buffer_ring, unsigned int buffer_group, char *buffer_area, size_t buffer_size,
                 unsigned int buffer_ring_size
         );
 
-        // 向 io_uring 的缓冲区环添加一个新的缓冲区，动态地扩展缓冲区环
+        // 把一个缓冲区写入缓冲区环中 tail 之后的第 offset 个位置，调用 advance_buffer_ring 之后内核才能使用它
         void add_buffer(
                 io_uring_buf_ring *buffer_ring, std::span<char> buffer, unsigned int buffer_id,
-                unsigned int buffer_ring_size
+                unsigned int buffer_ring_size, unsigned int offset
         );
 
+        // 推进缓冲区环的 tail ，让之前通过 add_buffer 写入的 count 个缓冲区对内核可见
+        void advance_buffer_ring(io_uring_buf_ring *buffer_ring, unsigned int count);
+
+        // 把 buffer 注册为固定缓冲区，零拷贝发送时内核不需要每次都重新锁定内存页
+        // 返回固定缓冲区的下标，固定缓冲区表已满或者注册失败时返回 -1
+        int register_buffer(std::span<const char> buffer);
+
+        // 注销一个固定缓冲区，正在进行中的请求仍然可以安全地使用它
+        void unregister_buffer(int buffer_index);
+
     private:
+        // 取得一个空闲的 SQE ，并保证 SQ 中至少还有 count 个空闲的位置，用于需要一起提交的链接请求
+        // SQ 已满时先提交已经准备好的请求，所以返回值不会是 nullptr
+        io_uring_sqe *get_sqe(unsigned int count);
+
         // io_uring in liburing
         ::io_uring io_uring_;
+
+        // 上次调用 take_prepared_sqe_count 之后准备的 SQE 数量
+        unsigned int prepared_sqe_count_ = 0;
+
+        // 固定缓冲区表中空闲的下标
+        std::vector<int> free_buffer_index_list_;
     };
 }
 
@@ -0,0 +1,207 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "constant.h"
+
+namespace WebServer {
+
+    // 类 metrics 是一个使用了 thread_local 单例模式的统计数据
+    // 每个线程只写入共享内存中属于自己的 worker_slot ，它按照缓存行对齐，不同线程之间没有伪共享
+    // 因为只有一个线程写入，更新时只需要一次 relaxed 的读取和写入，不需要带 lock 前缀的原子指令
+    // 读取时把所有线程的 worker_slot 加在一起，不需要加锁，也不会阻塞正在写入的线程
+    class metrics {
+    public:
+        // 只增加的计数器
+        enum class counter : size_t {
+            accepted_connection,
+            request,
+            // 4xx 和 5xx 的响应
+            error_response,
+            // 因为超时而关闭的连接
+            timeout,
+            sent_byte,
+            // response_cache 命中和没有命中的次数，来自 response_cache::hit_count() 和 miss_count()
+            response_cache_hit,
+            response_cache_miss,
+            // 当前线程的 frame_allocator 超过最大的大小类、直接使用全局的 operator new 的分配次数
+            frame_large_allocation,
+            // 从空闲链表中复用帧的次数
+            frame_reuse,
+            // 释放其他线程分配的帧的次数
+            frame_remote_free
+        };
+
+        static constexpr size_t COUNTER_COUNT = 10;
+
+        // 表示当前状态的值
+        enum class gauge : size_t {
+            connection,
+            // 从缓冲区环中借出、还没有归还的缓冲区
+            borrowed_buffer,
+            // 已经提交给内核、还没有完成的请求
+            inflight_sqe,
+            // 最近一次提交时 SQ 中的请求数量
+            pending_sqe,
+            // 最近一次等待之后 CQ 中的完成事件数量
+            ready_cqe
+        };
+
+        static constexpr size_t GAUGE_COUNT = 5;
+
+        // 每个缓冲区大小类的状态，来自 buffer_ring::get_statistics() ，名字的后面加上这个大小类的缓冲区大小
+        enum class buffer_gauge : size_t {
+            group,
+            // 曾经出现过的最少的空闲缓冲区数量，汇总时取所有线程中的最小值
+            low_watermark,
+            // recv 因为没有缓冲区而以 -ENOBUFS 结束的次数
+            exhaustion,
+            // 正在等待缓冲区的 recv 请求
+            waiting
+        };
+
+        static constexpr size_t BUFFER_GAUGE_COUNT = 4;
+
+        // 每个协程帧大小类的计数器，来自 frame_allocator::get_statistics() ，名字的后面加上这个大小类的帧大小
+        enum class frame_counter : size_t {
+            allocation
+        };
+
+        static constexpr size_t FRAME_COUNTER_COUNT = 1;
+
+        // handle_client 中的各个阶段，每个阶段有一个延迟的直方图
+        enum class phase : size_t {
+            // 从接收连接到收到第一个请求的第一段数据
+            accept,
+            // 从收到请求的第一段数据到解析出完整的请求头
+            parse,
+            // 查找文件缓存和响应缓存
+            lookup,
+            // 发送 response_batch 中的响应头和缓存的响应
+            send_header,
+            // 用 splice 发送文件内容
+            splice
+        };
+
+        static constexpr size_t PHASE_COUNT = 5;
+
+        // 对数线性的延迟直方图，和 HdrHistogram 一样，每个 2 的幂的区间平均分成 2^HISTOGRAM_SUB_BUCKET_BITS 个桶
+        // 小于 2^HISTOGRAM_SUB_BUCKET_BITS 纳秒的值每个值一个桶，所以每个桶的相对误差都不超过 1/8
+        class histogram {
+        public:
+            std::array<std::atomic<uint64_t>, HISTOGRAM_BUCKET_COUNT> bucket_list{};
+            std::atomic<uint64_t> count = 0;
+            std::atomic<uint64_t> sum = 0;
+            std::atomic<uint64_t> max = 0;
+
+            // 纳秒数 value 所在的桶
+            [[nodiscard]] static size_t get_bucket_index(uint64_t value) noexcept;
+
+            // 桶 index 中最大的值
+            [[nodiscard]] static uint64_t get_bucket_upper_bound(size_t index) noexcept;
+        };
+
+        // 一个线程的所有统计数据
+        class alignas(CACHE_LINE_SIZE) worker_slot {
+        public:
+            std::array<std::atomic<uint64_t>, COUNTER_COUNT> counter_list{};
+            std::array<std::atomic<int64_t>, GAUGE_COUNT> gauge_list{};
+            std::array<std::array<std::atomic<int64_t>, BUFFER_SIZE_CLASS_COUNT>, BUFFER_GAUGE_COUNT>
+                    buffer_gauge_list{};
+            std::array<std::array<std::atomic<uint64_t>, FRAME_SIZE_CLASS_COUNT>, FRAME_COUNTER_COUNT>
+                    frame_counter_list{};
+            std::array<histogram, PHASE_COUNT> histogram_list{};
+        };
+
+        // 共享内存的开头，其他进程读取时用它检查布局，之后是 worker_count 个 worker_slot
+        class segment_header {
+        public:
+            static constexpr uint64_t MAGIC = 0x5354415453425357; // "WSBSTATS"
+            static constexpr uint32_t VERSION = 4;
+
+            uint64_t magic = MAGIC;
+            uint32_t version = VERSION;
+            uint32_t worker_count = 0;
+            uint32_t worker_slot_size = sizeof(worker_slot);
+            uint32_t counter_count = COUNTER_COUNT;
+            uint32_t gauge_count = GAUGE_COUNT;
+            uint32_t phase_count = PHASE_COUNT;
+            uint32_t bucket_count = HISTOGRAM_BUCKET_COUNT;
+            uint32_t sub_bucket_bits = HISTOGRAM_SUB_BUCKET_BITS;
+            uint32_t buffer_gauge_count = BUFFER_GAUGE_COUNT;
+            uint32_t buffer_size_class_count = BUFFER_SIZE_CLASS_COUNT;
+            uint32_t frame_counter_count = FRAME_COUNTER_COUNT;
+            uint32_t frame_size_class_count = FRAME_SIZE_CLASS_COUNT;
+        };
+
+        // 整个进程的统计数据，每个线程一个 worker_slot ，由 http_server 在启动线程之前创建
+        // 数据放在以 PID 命名的 POSIX 共享内存中，其他进程可以直接映射它读取统计数据，而不需要发送请求
+        // 无法创建共享内存时退回到匿名内存，这时只能通过 STATS_URL 读取
+        class segment {
+        public:
+            explicit segment(size_t worker_count);
+
+            ~segment();
+
+            segment(const segment &other) = delete;
+
+            segment &operator=(const segment &other) = delete;
+
+            [[nodiscard]] worker_slot &get_worker_slot(size_t worker_index) const noexcept;
+
+            // 汇总所有线程的统计数据，格式化为每行一个 "名字 值" 的文本
+            [[nodiscard]] std::string format() const;
+
+        private:
+            segment_header *header_ = nullptr;
+            worker_slot *worker_slot_list_ = nullptr;
+            size_t size_ = 0;
+            // 共享内存的名字，使用匿名内存时为空
+            std::string name_;
+        };
+
+        // 返回当前线程的 metrics 单例实例
+        static metrics &get_instance() noexcept;
+
+        metrics(const metrics &other) = delete;
+
+        metrics &operator=(const metrics &other) = delete;
+
+        // 让当前线程之后写入 segment 中的第 worker_index 个 worker_slot
+        void attach(const segment &segment, size_t worker_index) noexcept;
+
+        void add(counter counter, uint64_t value = 1) noexcept;
+
+        // 用其他模块自己维护的累计值覆盖计数器，value 不会减小
+        void set(counter counter, uint64_t value) noexcept;
+
+        void add(gauge gauge, int64_t value) noexcept;
+
+        void set(gauge gauge, int64_t value) noexcept;
+
+        void set(buffer_gauge buffer_gauge, unsigned int size_class, int64_t value) noexcept;
+
+        void set(frame_counter frame_counter, size_t size_class, uint64_t value) noexcept;
+
+        // 记录 phase 从 start 到现在的延迟
+        void record(phase phase, std::chrono::steady_clock::time_point start) noexcept;
+
+        // 汇总整个进程的统计数据，没有 attach 时只包括当前线程
+        [[nodiscard]] std::string format() const;
+
+    private:
+        metrics() = default;
+
+        const segment *segment_ = nullptr;
+        // 没有 attach 的线程（比如主线程）写入自己的 local_slot_
+        worker_slot local_slot_;
+        worker_slot *worker_slot_ = &local_slot_;
+    };
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef PIPE_POOL_H
+#define PIPE_POOL_H
+
+#include <cstddef>
+#include <vector>
+#include "file_descriptor.h"
+
+namespace WebServer {
+
+    // 类 pipe_pool 是一个使用了 thread_local 单例模式的管道池
+    // splice 每次都需要一个管道作为中转，复用管道可以省去每个响应创建和关闭管道的系统调用
+    class pipe_pool {
+    public:
+        // 扩大管道的容量时从 PIPE_TOTAL_SIZE 中预留的字节数，析构时归还
+        // 出错时管道会被直接关闭而不是归还给管道池，预留的容量也能通过析构函数归还
+        class reservation {
+        public:
+            reservation() = default;
+
+            // 从 PIPE_TOTAL_SIZE 中预留 size 字节，剩余的预算不够时 size() 为 0
+            explicit reservation(size_t size) noexcept;
+
+            ~reservation();
+
+            reservation(reservation &&other) noexcept;
+
+            reservation &operator=(reservation &&other) noexcept;
+
+            [[nodiscard]] size_t size() const noexcept;
+
+        private:
+            size_t size_ = 0;
+        };
+
+        class pipe_pair {
+        public:
+            file_descriptor read_end;
+            file_descriptor write_end;
+            size_t capacity = 0; // 管道的容量，也是一次 splice 最多移动的字节数
+            reservation reserved_size;
+        };
+
+        // 返回当前线程的 pipe_pool 单例实例
+        static pipe_pool &get_instance() noexcept;
+
+        // 取出一个空闲的管道，没有空闲的管道时创建一个新的管道，PIPE_TOTAL_SIZE 还有剩余时把容量扩大到 PIPE_SIZE
+        pipe_pair acquire();
+
+        // 归还一个管道，调用者必须保证管道中已经没有数据
+        // 出错时管道中可能残留着数据，这时不应该归还，而是直接关闭它
+        void release(pipe_pair &&pipe);
+
+    private:
+        std::vector<pipe_pair> pipe_list_;
+    };
+}
+
+#endif
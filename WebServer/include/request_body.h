@@ -0,0 +1,106 @@
+#ifndef REQUEST_BODY_H
+#define REQUEST_BODY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+#include "file_descriptor.h"
+#include "socket.h"
+#include "task.h"
+#include "timer_wheel.h"
+
+namespace WebServer {
+
+    // 一个正在接收的请求体，数据到达时立即写入文件或者丢弃，不会在内存中保存整个请求体
+    // 长度由 Content-Length 决定，或者使用 chunked 编码
+    class request_body {
+    public:
+        // content_length 为空表示请求体使用 chunked 编码
+        explicit request_body(std::optional<uint64_t> content_length);
+
+        request_body(const request_body &other) = delete;
+
+        request_body &operator=(const request_body &other) = delete;
+
+        // 允许 PUT 上传文件，上传的文件只能保存在 directory 之下。必须在启动线程池之前调用
+        // 没有调用时上传被禁用，PUT 请求得到 405
+        static void enable_upload(const std::filesystem::path &directory);
+
+        [[nodiscard]] static bool is_upload_enabled() noexcept;
+
+        // 把请求体保存到上传目录下的 path 。先写入同一个目录下的匿名临时文件（ O_TMPFILE ），
+        // 接收完成之后再由 commit() 放到 path ，这样其他请求不会读到不完整的文件，连接中断时也不会留下临时文件
+        // 目录相对于上传目录的 fd 解析，RESOLVE_BENEATH 和 RESOLVE_NO_SYMLINKS 由内核保证不会写到上传目录之外
+        // 打开和之后的 commit() 都通过 io_uring 完成，不会阻塞事件循环
+        // 没有调用 open() 时，请求体会被丢弃。成功返回 0 ，失败时返回 -errno
+        task<int> open(const std::filesystem::path &path);
+
+        // 处理一段收到的数据，返回属于请求体的字节数，剩下的数据属于下一个请求
+        task<size_t> consume(std::span<const char> data);
+
+        // 请求体剩下的部分是否足够长，值得停止 multishot recv ，直接从套接字 splice 到文件
+        [[nodiscard]] bool should_splice() const noexcept;
+
+        // 把请求体剩下的部分从套接字经过管道 splice 到文件，数据不经过用户态
+        // 调用之前必须先停止套接字的 multishot recv ，并取完已经收到的数据
+        // 每收到一段数据都会重新开始 timer 的计时，timer 到期时请求体出错
+        task<> splice_from(const client_socket &client_socket, timer_wheel::timer *timer = nullptr);
+
+        // 接收完成之后，把临时文件放到 open() 指定的路径，成功时返回 true
+        task<bool> commit();
+
+        [[nodiscard]] bool is_open() const noexcept;
+
+        // commit() 是否替换了已经存在的文件
+        [[nodiscard]] bool replaced() const noexcept;
+
+        // 上传的文件相对于当前目录（文档根目录）的路径，用于让 file_cache 中的条目失效
+        [[nodiscard]] const std::filesystem::path &path() const noexcept;
+
+        // 请求体已经完整地接收了
+        [[nodiscard]] bool done() const noexcept;
+
+        // chunked 编码的格式错误、写入文件失败或者连接中断
+        [[nodiscard]] bool has_error() const noexcept;
+
+    private:
+        // chunked 编码的解析状态，数据可以在任意位置被截断
+        enum class chunk_state {
+            size,          // 块大小的十六进制数字
+            extension,     // 块大小之后的扩展，直接跳过
+            data,          // 块的数据
+            data_end,      // 块的数据之后的 "\r\n"
+            trailer,       // 最后一个块之后的 trailer 行的开头
+            trailer_line,  // trailer 行的剩余部分，直接跳过
+            done,
+            error
+        };
+
+        // 解析 chunked 编码的数据，把块的数据写入文件
+        task<size_t> consume_chunked(std::span<const char> data);
+
+        // 把请求体的一段数据写入文件，没有打开文件时直接丢弃
+        task<bool> write(std::span<const char> data);
+
+        const bool chunked_;
+        // 使用 Content-Length 时是请求体剩下的字节数，使用 chunked 编码时是当前块剩下的字节数
+        uint64_t remaining_length_;
+        chunk_state chunk_state_ = chunk_state::size;
+        // 当前块大小的十六进制数字的个数，用来防止溢出
+        size_t chunk_size_digit_count_ = 0;
+        bool error_ = false;
+
+        std::optional<file_descriptor> file_;
+        // 目标文件所在的目录，以及目标文件在这个目录中的名字
+        std::optional<file_descriptor> directory_;
+        std::string name_;
+        std::filesystem::path path_;
+        bool committed_ = false;
+        bool replaced_ = false;
+    };
+}
+
+#endif
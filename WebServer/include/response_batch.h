@@ -0,0 +1,67 @@
+#ifndef RESPONSE_BATCH_H
+#define RESPONSE_BATCH_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/uio.h>
+#include "http_message.h"
+#include "response_cache.h"
+#include "socket.h"
+#include "task.h"
+
+namespace WebServer {
+
+    // 一批需要按顺序发送给同一个客户端的响应
+    // 客户端使用流水线时，一次接收到的所有请求的响应先放在这里，然后用一次 sendmsg 发出
+    // 而不是每个响应都单独等待一次 send
+    // 响应头写入一个复用的 arena ，发送之后只清空内容、保留容量，稳定之后不再分配内存
+    class response_batch {
+    public:
+        // 开始一个新的响应，返回的 http_response 直接把响应头写入 arena
+        http_response add_response(http_status status);
+
+        // 追加一个缓存的文件内容作为响应体，发送完成之前 shared_ptr 保证它不会被释放
+        void append(std::shared_ptr<const cached_response> response);
+
+        // 只追加缓存的文件内容中从 offset 开始的 length 个字节，用于 Range 请求
+        void append(std::shared_ptr<const cached_response> response, size_t offset, size_t length);
+
+        // 把 data 复制到 arena 中，用于响应体中需要生成的部分，比如 multipart/byteranges 的分隔行
+        void append(std::string_view data);
+
+        [[nodiscard]] bool empty() const noexcept;
+
+        // 已经达到 SEND_BATCH_SIZE ，应该先发送出去
+        [[nodiscard]] bool full() const noexcept;
+
+        // 按顺序发送所有的响应并清空，返回发送的字节数，失败时返回 -1
+        task<ssize_t> flush(client_socket &client_socket);
+
+    private:
+        // 一段连续的待发送数据
+        class segment {
+        public:
+            // 为 nullptr 时，数据位于 arena_ 中从 offset 开始的位置
+            const char *data = nullptr;
+            size_t offset = 0;
+            size_t length = 0;
+            // 数据所在的固定缓冲区的下标，-1 表示没有注册
+            int buffer_index = -1;
+        };
+
+        // 把 arena_ 中还没有记录的数据记录为一个 segment
+        void close_arena_segment();
+
+        std::string arena_;
+        // arena_ 中这个位置之后的数据还没有记录为 segment
+        size_t arena_offset_ = 0;
+        std::vector<segment> segment_list_;
+        std::vector<std::shared_ptr<const cached_response>> response_list_;
+        std::vector<iovec> iovec_list_;
+    };
+}
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <coroutine>
+#include <cstddef>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "file_cache.h"
+#include "task.h"
+
+namespace WebServer {
+
+    // 一个缓存的响应体，也就是文件的内容，足够大时会注册为 io_uring 的固定缓冲区，用于零拷贝发送
+    class cached_response {
+    public:
+        // registered 为 true 并且 data 足够长、会使用零拷贝的 send 时，把 data 注册为固定缓冲区
+        // 只有会被多次发送的缓存条目才值得注册，只发送一次的响应（比如统计数据）注册的开销比节省的更多
+        explicit cached_response(std::string data, bool registered = false);
+
+        // 注销固定缓冲区，所以最后一个持有者释放之前，固定缓冲区的下标不会被重用
+        ~cached_response();
+
+        cached_response(const cached_response &other) = delete;
+
+        cached_response &operator=(const cached_response &other) = delete;
+
+        [[nodiscard]] const std::string &data() const noexcept;
+
+        // 固定缓冲区的下标，没有注册时为 -1
+        [[nodiscard]] int buffer_index() const noexcept;
+
+    private:
+        const std::string data_;
+        int buffer_index_ = -1;
+    };
+
+    // 类 response_cache 是一个使用了 thread_local 单例模式的响应缓存
+    // 对于小于 RESPONSE_CACHE_FILE_SIZE 的文件，把文件内容预先读取到内存中
+    // 命中时响应头和缓存的内容可以合并成一次 sendmsg 发出，不需要再创建管道和 splice
+    class response_cache {
+    public:
+        // 返回当前线程的 response_cache 单例实例
+        static response_cache &get_instance() noexcept;
+
+        // 返回文件 file 的内容，file 必须来自 file_cache::lookup(path) ，并且在返回之前保持有效
+        // 同一个文件同时有多个请求没有命中时，只有第一个请求会读取文件，其余的请求等待它读取完成
+        // 读取失败时返回 nullptr ，调用者应该退回到 splice 的方式发送文件
+        task<std::shared_ptr<const cached_response>> get(
+                const std::filesystem::path &path, const file_cache::entry &file
+        );
+
+        [[nodiscard]] size_t hit_count() const noexcept;
+
+        [[nodiscard]] size_t miss_count() const noexcept;
+
+        // 当前缓存的所有响应的总字节数，每个响应额外计入 RESPONSE_CACHE_NODE_SIZE
+        [[nodiscard]] size_t size() const noexcept;
+
+    private:
+        class cache_node {
+        public:
+            // 构造这个响应时文件的 ETag ，由 inode 、大小和修改时间生成，文件被修改或替换之后会改变
+            // 只保存验证器而不是 file_cache 的条目，所以 file_cache 淘汰条目之后文件的 fd 会被关闭
+            std::string entity_tag;
+            std::shared_ptr<const cached_response> response;
+            std::list<std::string>::iterator lru_iterator;
+        };
+
+        // 一次正在进行中的文件读取，等待同一个文件的请求都挂在这里
+        class load_state {
+        public:
+            std::string entity_tag;
+            std::shared_ptr<const cached_response> response;
+            std::vector<std::coroutine_handle<>> waiting_coroutine_list;
+        };
+
+        // 等待另一个协程完成文件读取
+        class load_awaiter {
+        public:
+            explicit load_awaiter(load_state &load_state);
+
+            [[nodiscard]] bool await_ready() const noexcept;
+
+            void await_suspend(std::coroutine_handle<> coroutine) const;
+
+            void await_resume() const noexcept;
+
+        private:
+            load_state &load_state_;
+        };
+
+        // 读取文件的全部内容
+        static task<std::shared_ptr<const cached_response>> load(const file_cache::entry &file);
+
+        void insert(const std::string &path, cache_node cache_node);
+
+        void erase(std::unordered_map<std::string, cache_node>::iterator iterator);
+
+        size_t hit_count_ = 0;
+        size_t miss_count_ = 0;
+        size_t size_ = 0;
+
+        // 最近使用的响应在链表的头部，超出 RESPONSE_CACHE_SIZE 时从尾部开始淘汰
+        std::list<std::string> lru_list_;
+        std::unordered_map<std::string, cache_node> cache_map_;
+        std::unordered_map<std::string, std::shared_ptr<load_state>> load_state_map_;
+    };
+}
+
+#endif
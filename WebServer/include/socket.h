@@ -2,11 +2,15 @@
 #define SOCKET_H
 
 #include <coroutine>
+#include <memory>
 #include <optional>
+#include <queue>
 #include <span>
 #include <tuple>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
+#include "buffer_ring.h"
 #include "file_descriptor.h"
 #include "io_uring.h"
 #include "task.h"
@@ -21,10 +25,19 @@ namespace WebServer {
     public:
         server_socket();
 
+        // 使用一个已经完成了 bind 和 listen 的监听套接字，比如从旧进程交接过来的套接字
+        explicit server_socket(int raw_file_descriptor);
+
         void bind(const char *port);
 
         void listen() const;
 
+        // 给这个套接字所在的 SO_REUSEPORT 组附加一个 CBPF 程序，必须在组中所有的套接字都 listen 之后调用
+        // cpu_list[i] 是按照 listen 的顺序，组中第 i 个套接字所属的线程绑定的 CPU
+        // 新的连接交给处理这个数据包的 CPU 上的套接字，其他 CPU 收到的连接仍然由内核按照哈希选择
+        // 内核不支持时返回 false ，连接的分配方式不变
+        bool attach_reuseport_cpu_program(std::span<const int> cpu_list) const;
+
         // 用于管理多次接收的网络连接请求，它是一个协程对象
         class multishot_accept_guard {
         public:
@@ -41,8 +54,16 @@ namespace WebServer {
 
             int await_resume();
 
+            // 取消请求，之后请求结束时不再重新提交
+            void cancel();
+
+            // 请求已经被取消，并且它的最后一个 CQE 已经到达，之后不会再唤醒等待的协程
+            [[nodiscard]] bool is_stopped() const noexcept;
+
         private:
             bool initial_await_ = true;
+            bool cancelled_ = false;
+            bool stopped_ = false;
             const int raw_file_descriptor_;
             sockaddr_storage *client_address_;
             socklen_t *client_address_size_;
@@ -53,35 +74,168 @@ namespace WebServer {
         accept(sockaddr_storage *client_address = nullptr,
                socklen_t *client_address_size = nullptr);
 
+        // 停止接收新的连接，已经在监听队列中的连接留给共享这个套接字的其他进程，或者在套接字关闭时被重置
+        // 等待 accept() 的协程会被唤醒，之后 is_accept_stopped() 返回 true
+        void stop_accept();
+
+        [[nodiscard]] bool is_accept_stopped() const noexcept;
+
     private:
         std::optional<multishot_accept_guard> multishot_accept_guard_;
     };
 
+    // 客户端套接字，fixed_file 为 true 时 raw_file_descriptor 是 io_uring 固定文件表中的下标
     class client_socket : public file_descriptor {
     public:
-        explicit client_socket(int raw_file_descriptor);
+        explicit client_socket(int raw_file_descriptor, bool fixed_file = false);
+
+        // 用于管理连接期间持续有效的 multishot recv 请求，它是一个协程对象
+        // 只要请求没有结束，内核每收到一段数据就产生一个 CQE ，不需要每次读取都提交新的请求
+        // CQE 可能在协程没有等待 recv 时到达（比如正在 send ），这些结果会先保存在队列中
+        class multishot_recv_guard {
+        public:
+            multishot_recv_guard(int raw_file_descriptor, bool fixed_file);
+
+            // 请求还没有结束时，取消请求，并启动一个协程等待请求结束、归还已经收到的缓冲区
+            ~multishot_recv_guard();
+
+            multishot_recv_guard(multishot_recv_guard &&other) noexcept = default;
+
+            multishot_recv_guard &operator=(multishot_recv_guard &&other) noexcept = delete;
+
+            // 跳过为了更换缓冲区组而取消请求产生的 CQE ，以及缓冲区耗尽时产生的 -ENOBUFS
+            [[nodiscard]] bool await_ready();
+
+            // 请求已经结束时（比如缓冲区耗尽），按照这个连接最近接收的数据量选择大小类，重新提交一个 multishot recv 请求
+            // 这个大小类没有空闲的缓冲区时，请求在 buffer_ring 中等待，有缓冲区被归还之后才会提交
+            void await_suspend(std::coroutine_handle<> coroutine);
+
+            // 返回缓冲区组、第一个缓冲区的 ID 和接收到的字节数
+            // 使用 bundle 时一次可能收到多个缓冲区，需要用 buffer_ring::borrow_buffer_list 取出所有的缓冲区
+            // 接收到的数据需要更大的缓冲区组时，会取消当前的请求，之后用更大的缓冲区组重新提交
+            std::tuple<unsigned int, unsigned int, ssize_t> await_resume();
+
+            // 取消请求并等待它结束，已经收到的 CQE 仍然留在队列中
+            task<> stop();
+
+            // 队列中是否还有没有取出的 CQE
+            [[nodiscard]] bool has_pending_result() const;
+
+            // 取消请求，不等待它结束，等待中的 recv 会以 0 或者 -ECANCELED 返回
+            void cancel();
+
+        private:
+            // 在堆上分配，保证 multishot_recv_guard 移动或者析构之后，io_uring 仍然可以写入 sqe_data
+            class recv_state {
+            public:
+                sqe_data recv_sqe_data;
+                std::queue<std::tuple<int, unsigned int>> cqe_queue;
+                bool submitted = false;
 
+                // 交给 buffer_ring 提交的请求，包括它使用的缓冲区组，以及是否在等待空闲的缓冲区
+                // 缓冲区组只在重新提交请求时改变，这时队列一定是空的
+                buffer_ring::recv_request recv_request;
+                // 最近接收的数据量，每次接收之后衰减一半，用来选择下一次提交请求时的缓冲区组
+                size_t recv_size = 0;
+                // 已经为了更换缓冲区组而取消了请求，请求结束时的 -ECANCELED 不应该返回给调用者
+                bool regrouping = false;
+            };
+
+            // 等待队列中的 CQE 多于 queue_size 个
+            class cqe_awaiter {
+            public:
+                cqe_awaiter(recv_state &recv_state, size_t queue_size);
+
+                [[nodiscard]] bool await_ready() const;
+
+                void await_suspend(std::coroutine_handle<> coroutine);
+
+                void await_resume();
+
+            private:
+                recv_state &recv_state_;
+                const size_t queue_size_;
+            };
+
+            // 等待被取消的请求结束，并归还队列中的缓冲区
+            static task<> drain(std::unique_ptr<recv_state> recv_state);
+
+            int raw_file_descriptor_;
+            bool fixed_file_;
+            std::unique_ptr<recv_state> recv_state_;
+        };
+
+        // co_await client_socket.recv() 使用的等待体，只持有 multishot_recv_guard 的引用
+        // 编译器可能会复制左值形式的等待体，所以不能直接 co_await multishot_recv_guard
         class recv_awaiter {
         public:
-            recv_awaiter(int raw_file_descriptor, size_t length);
+            explicit recv_awaiter(multishot_recv_guard &multishot_recv_guard);
 
             [[nodiscard]] bool await_ready() const;
 
             void await_suspend(std::coroutine_handle<> coroutine);
 
-            std::tuple<unsigned int, ssize_t> await_resume();
+            std::tuple<unsigned int, unsigned int, ssize_t> await_resume();
+
+        private:
+            multishot_recv_guard &multishot_recv_guard_;
+        };
+
+        recv_awaiter recv();
+
+        // 取消 multishot recv 请求并等待它结束，之后套接字中的数据可以直接 splice 出去
+        // 已经收到的数据仍然可以通过 recv() 按顺序取出，取完之后再次调用 recv() 会重新提交请求
+        task<> stop_recv();
+
+        // 是否还有已经收到、但还没有通过 recv() 取出的数据
+        [[nodiscard]] bool has_received_data() const;
+
+        // 取消这个套接字上所有正在进行的请求，用于超时时让等待 recv 、send 或者 splice 的协程尽快返回错误
+        void cancel();
+
+        class connect_awaiter {
+        public:
+            connect_awaiter(int raw_file_descriptor, const sockaddr *address, socklen_t address_size);
+
+            [[nodiscard]] bool await_ready() const;
+
+            void await_suspend(std::coroutine_handle<> coroutine);
+
+            // 连接成功时返回 0 ，否则返回负的错误码
+            [[nodiscard]] int await_resume() const;
 
         private:
             const int raw_file_descriptor_;
-            const size_t length_;
+            const sockaddr *address_;
+            const socklen_t address_size_;
             sqe_data sqe_data_;
         };
 
-        recv_awaiter recv(size_t length);
+        // 连接到 address ，只能用于不在固定文件表中的套接字，比如客户端自己创建的套接字
+        connect_awaiter connect(const sockaddr *address, socklen_t address_size);
 
         class send_awaiter {
         public:
-            send_awaiter(int raw_file_descriptor, const std::span<char> &buffer, size_t length);
+            send_awaiter(int raw_file_descriptor, bool fixed_file, std::span<const char> buffer, size_t length);
+
+            [[nodiscard]] bool await_ready() const;
+
+            void await_suspend(std::coroutine_handle<> coroutine);
+
+            [[nodiscard]] ssize_t await_resume() const;
+
+        private:
+            const int raw_file_descriptor_;
+            const bool fixed_file_;
+            const size_t length_;
+            const std::span<const char> buffer_;
+            sqe_data sqe_data_;
+        };
+
+        // 一次发送多个缓冲区的 sendmsg
+        class sendmsg_awaiter {
+        public:
+            sendmsg_awaiter(int raw_file_descriptor, bool fixed_file, std::span<iovec> iovec_list);
 
             [[nodiscard]] bool await_ready() const;
 
@@ -91,12 +245,58 @@ namespace WebServer {
 
         private:
             const int raw_file_descriptor_;
+            const bool fixed_file_;
+            msghdr message_{};
+            sqe_data sqe_data_;
+        };
+
+        // 零拷贝的 send ，内核直接从 buffer 所在的内存页发送数据
+        class send_zc_awaiter {
+        public:
+            send_zc_awaiter(
+                    int raw_file_descriptor, bool fixed_file, std::span<const char> buffer, size_t length,
+                    int buffer_index
+            );
+
+            [[nodiscard]] bool await_ready() const;
+
+            // 第一次 co_await 时提交请求，之后的 co_await 等待内核释放 buffer 的通知
+            void await_suspend(std::coroutine_handle<> coroutine);
+
+            // 返回发送的结果
+            ssize_t await_resume();
+
+            // 内核是否还在使用 buffer ，如果是，需要再 co_await 一次，之后才能修改或释放 buffer
+            [[nodiscard]] bool has_pending_notification() const;
+
+        private:
+            const int raw_file_descriptor_;
+            const bool fixed_file_;
             const size_t length_;
-            const std::span<char> &buffer_;
+            const std::span<const char> buffer_;
+            const int buffer_index_;
+            bool submitted_ = false;
+            ssize_t result_ = 0;
             sqe_data sqe_data_;
         };
 
-        task<ssize_t> send(const std::span<char> &buffer, size_t length);
+        // 不小于 threshold 的数据使用零拷贝的 send ，为 0 时不使用零拷贝。必须在启动线程池之前调用
+        static void set_zero_copy_threshold(size_t threshold) noexcept;
+
+        // 当前的零拷贝阈值，为 0 表示不使用零拷贝
+        [[nodiscard]] static size_t get_zero_copy_threshold() noexcept;
+
+        // 发送 buffer 中长度为 length 的数据，返回时 buffer 可以被修改或释放
+        // 长度不小于 get_zero_copy_threshold() 时使用零拷贝的 send
+        // buffer_index 是 buffer 所在的固定缓冲区的下标（ io_uring::register_buffer ），-1 表示没有注册
+        task<ssize_t> send(std::span<const char> buffer, size_t length, int buffer_index = -1);
+
+        // 按顺序发送 iovec_list 中的所有缓冲区，返回时这些缓冲区可以被修改或释放
+        // iovec_list 中的元素会在只发送了一部分时被修改
+        task<ssize_t> send(std::span<iovec> iovec_list);
+
+    private:
+        std::optional<multishot_recv_guard> multishot_recv_guard_;
     };
 
 }
@@ -6,6 +6,7 @@
 #include <memory>
 #include <optional>
 #include <utility>
+#include "frame_allocator.h"
 
 // 协程返回值 task 的实现，包括自定义 promise_type 类型的 task_promise
 namespace WebServer {
@@ -108,6 +109,11 @@ namespace WebServer {
             }
         };
 
+        // 协程帧从当前线程的 frame_allocator 中分配，而不是直接使用全局的 operator new
+        static void *operator new(const size_t size) { return frame_allocator::get_instance().allocate(size); }
+
+        static void operator delete(void *const frame) noexcept { frame_allocator::get_instance().deallocate(frame); }
+
         [[nodiscard]] std::suspend_always initial_suspend() const noexcept { return {}; }
 
         [[nodiscard]] final_awaiter final_suspend() const noexcept { return final_awaiter{}; }
@@ -1,19 +1,29 @@
 #ifndef THREAD_POOL_H
 #define THREAD_POOL_H
 
-#include <condition_variable>
+#include <atomic>
 #include <coroutine>
 #include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <list>
+#include <memory>
 #include <mutex>
-#include <queue>
 #include <stop_token>
 #include <thread>
+#include <vector>
+#include "work_stealing_deque.h"
 
 namespace WebServer {
+    // 工作窃取的线程池
+    // 每个线程有一个自己的 work_stealing_deque ，以及一个只保存最近一次调度的协程的 LIFO 槽
+    // 刚被调度的协程很可能还在当前 CPU 的缓存中，所以优先运行它。自己的队列为空时，随机选择其他线程窃取
+    // 没有任何任务时，线程在自己的 futex 上休眠，而不是所有线程共享一个条件变量
+    // 每个线程被绑定到一个固定的 CPU 上，并且优先从这个 CPU 所在的 NUMA 节点分配内存
     class thread_pool {
     public:
         // 创建指定数量的线程，每个线程都在运行 thread_loop()
+        // 线程按顺序绑定到进程允许使用的 CPU 上，线程数量超过 CPU 数量时循环使用这些 CPU
         explicit thread_pool(std::size_t thread_count);
 
         ~thread_pool();
@@ -38,19 +48,58 @@ namespace WebServer {
 
         [[nodiscard]] size_t size() const noexcept;
 
+        // 下标为 worker_index 的线程绑定的 CPU
+        [[nodiscard]] int get_cpu(size_t worker_index) const noexcept;
+
+        // 当前线程在线程池中的下标，只能在线程池的线程中调用
+        [[nodiscard]] static size_t get_current_worker_index() noexcept;
+
     private:
-        std::stop_source stop_source_; // 停止信号源
-        std::list<std::jthread> thread_list_;
+        class worker {
+        public:
+            work_stealing_deque deque;
+            // 最近一次由这个线程调度的协程，其他线程也可以窃取它
+            std::atomic<void *> lifo_slot = nullptr;
+            // 为 1 时线程正在或者将要在 futex 上休眠，唤醒者把它改为 0 之后调用 futex_wake
+            std::atomic<uint32_t> parked = 0;
+        };
+
+        void thread_loop(size_t worker_index);
+
+        // 把当前线程绑定到 cpu 上，之后分配的内存优先使用当前线程所在的 NUMA 节点
+        static void pin_current_thread(int cpu);
 
-        std::mutex mutex_;
-        std::condition_variable condition_variable_;
-        std::queue<std::coroutine_handle<>> coroutine_queue_; // 存放协程句柄的队列
+        // 依次从 LIFO 槽、自己的队列、外部提交的队列和其他线程的队列中取出一个协程
+        std::coroutine_handle<> find_coroutine(size_t worker_index);
 
-        void thread_loop();
+        // 随机选择一个起点，依次尝试窃取其他线程的协程
+        std::coroutine_handle<> steal_coroutine(size_t worker_index);
 
-        // 将协程句柄加入到队列中，然后唤醒一个线程来执行协程
+        // 所有的队列是否都为空，用于休眠之前的最后一次检查
+        [[nodiscard]] bool has_coroutine() const;
+
+        void park(size_t worker_index);
+
+        // 唤醒一个正在休眠的线程，没有休眠的线程时只需要一次原子读取
+        void wake_one();
+
+        // 将协程加入到队列中，然后在有线程休眠时唤醒一个线程来执行协程
         void enqueue(std::coroutine_handle<> coroutine);
+
+        std::stop_source stop_source_; // 停止信号源
+        std::vector<std::unique_ptr<worker>> worker_list_;
+        // 每个线程绑定的 CPU
+        std::vector<int> cpu_list_;
+        std::atomic<size_t> parked_count_ = 0;
+
+        // 线程池之外的线程提交的协程，只在启动时使用，所以这里使用一个简单的互斥锁
+        std::mutex injection_mutex_;
+        std::deque<std::coroutine_handle<>> injection_queue_;
+        std::atomic<size_t> injection_count_ = 0;
+
+        // 必须在最后声明，保证析构时先等待所有的线程结束，再销毁它们使用的队列
+        std::list<std::jthread> thread_list_;
     };
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,130 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <array>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <functional>
+#include <linux/time_types.h>
+#include "constant.h"
+#include "io_uring.h"
+#include "task.h"
+
+namespace WebServer {
+
+    // 类 timer_wheel 是一个使用了 thread_local 单例模式的哈希时间轮
+    // 时间被分成 TIMER_WHEEL_TICK 长的 tick ，定时器按照到期的 tick 放入 TIMER_WHEEL_SIZE 个槽中的一个
+    // 无论有多少个定时器，每个 tick 只需要一个 io_uring 的 timeout 请求，启动、重启和停止定时器都是 O(1) 的链表操作
+    // 没有定时器时不提交 timeout 请求，空闲的线程不会被周期性地唤醒
+    class timer_wheel {
+    private:
+        // 侵入式双向循环链表的节点，每个槽有一个哨兵节点
+        class timer_node {
+        public:
+            timer_node *previous = this;
+            timer_node *next = this;
+        };
+
+    public:
+        // 一个定时器，到期时在事件循环中调用 callback ，它只能在创建它的线程上使用
+        class timer : private timer_node {
+        public:
+            explicit timer(std::function<void()> callback);
+
+            ~timer();
+
+            timer(const timer &other) = delete;
+
+            timer &operator=(const timer &other) = delete;
+
+            // 重新开始计时，timeout 之后调用 callback ，timeout 为 0 表示不限制时间
+            void start(std::chrono::milliseconds timeout);
+
+            // 使用上一次 start 的时间重新开始计时，用于只在没有进展时才超时的操作
+            void restart();
+
+            void stop();
+
+            // 是否曾经到期过，到期之后重新开始计时也不会清除这个状态
+            [[nodiscard]] bool is_expired() const noexcept;
+
+        private:
+            friend class timer_wheel;
+
+            std::function<void()> callback_;
+            std::chrono::milliseconds timeout_{0};
+            uint64_t expire_tick_ = 0;
+            bool linked_ = false;
+            bool expired_ = false;
+        };
+
+        // 返回当前线程的 timer_wheel 单例实例
+        static timer_wheel &get_instance() noexcept;
+
+        timer_wheel() = default;
+
+        timer_wheel(const timer_wheel &other) = delete;
+
+        timer_wheel &operator=(const timer_wheel &other) = delete;
+
+        // 在一个循环中每个 tick 提交一个 timeout 请求，并调用到期的定时器的 callback
+        task<> run();
+
+    private:
+        // 等待一个 tick
+        class tick_awaiter {
+        public:
+            tick_awaiter();
+
+            [[nodiscard]] bool await_ready() const noexcept;
+
+            void await_suspend(std::coroutine_handle<> coroutine);
+
+            void await_resume() const noexcept;
+
+        private:
+            __kernel_timespec timeout_{};
+            sqe_data sqe_data_;
+        };
+
+        // 没有定时器时挂起 run() ，直到有定时器开始计时
+        class idle_awaiter {
+        public:
+            explicit idle_awaiter(timer_wheel &timer_wheel);
+
+            [[nodiscard]] bool await_ready() const noexcept;
+
+            void await_suspend(std::coroutine_handle<> coroutine) const noexcept;
+
+            void await_resume() const noexcept;
+
+        private:
+            timer_wheel &timer_wheel_;
+        };
+
+        // 按照 steady_clock 计算的当前 tick
+        [[nodiscard]] static uint64_t get_current_tick() noexcept;
+
+        void insert(timer &timer);
+
+        void remove(timer &timer);
+
+        // 处理到 tick 为止所有到期的定时器
+        void expire(uint64_t tick);
+
+        std::array<timer_node, TIMER_WHEEL_SIZE> slot_list_;
+
+        // 处理到期的定时器时，一个槽中的定时器先移到这个链表中，callback 停止或者销毁其他定时器也是安全的
+        timer_node expiring_list_;
+
+        // 已经处理过的最后一个 tick
+        uint64_t current_tick_ = 0;
+        size_t timer_count_ = 0;
+
+        // 在 idle_awaiter 中挂起的 run()
+        std::coroutine_handle<> idle_coroutine_;
+    };
+}
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include "constant.h"
+
+namespace WebServer {
+
+    // 类 tracer 是一个使用了 thread_local 单例模式的请求追踪器
+    // 每 sample_interval 个请求采样一个，记录它在 handle_client 中每两个 co_await 之间花费的时间
+    // 事件写入当前线程自己的环形缓冲区，之后可以导出为 Chrome trace JSON ，用 Perfetto 或者 chrome://tracing 打开
+    // 每个线程是一个进程（ pid ），每个连接是其中的一个线程（ tid ），同一个连接上的事件按照时间顺序排列
+    class tracer {
+    public:
+        // 一个阶段，字段都是 relaxed 的原子变量，读取时可能正在被覆盖，由 trace_ring::write_index 判断是否有效
+        class trace_event {
+        public:
+            // 阶段的名字，必须是字符串字面量
+            std::atomic<const char *> name = nullptr;
+            // steady_clock 的纳秒数
+            std::atomic<uint64_t> start = 0;
+            std::atomic<uint64_t> end = 0;
+            std::atomic<uint64_t> connection_id = 0;
+            std::atomic<uint64_t> request_id = 0;
+        };
+
+        // 一个线程的环形缓冲区，只有这个线程写入，其他线程读取时不需要加锁
+        class alignas(CACHE_LINE_SIZE) trace_ring {
+        public:
+            // 下一个写入的位置，写完一个事件之后才会增加
+            std::atomic<uint64_t> write_index = 0;
+            std::unique_ptr<trace_event[]> event_list;
+        };
+
+        // 整个进程的 trace 缓冲区，每个线程一个 trace_ring ，由 http_server 在启动线程之前创建
+        // 没有启用追踪时不分配环形缓冲区
+        class trace_buffer {
+        public:
+            explicit trace_buffer(size_t worker_count);
+
+            [[nodiscard]] trace_ring *get_ring(size_t worker_index) const noexcept;
+
+            // 把所有线程的环形缓冲区中仍然有效的事件格式化为 Chrome trace JSON
+            [[nodiscard]] std::string format() const;
+
+            // 把 format() 的结果写入 path ，失败时返回 false
+            [[nodiscard]] bool dump(const std::filesystem::path &path) const;
+
+        private:
+            const size_t worker_count_;
+            std::unique_ptr<trace_ring[]> ring_list_;
+        };
+
+        // 每 sample_interval 个请求采样一个，为 0 表示不追踪。必须在创建 http_server 之前调用
+        static void enable(size_t sample_interval) noexcept;
+
+        // 返回当前线程的 tracer 单例实例
+        static tracer &get_instance() noexcept;
+
+        tracer(const tracer &other) = delete;
+
+        tracer &operator=(const tracer &other) = delete;
+
+        // 让当前线程之后写入 trace_buffer 中的第 worker_index 个 trace_ring
+        void attach(const trace_buffer &trace_buffer, size_t worker_index) noexcept;
+
+        // 为一个新的连接分配 tid
+        uint64_t next_connection_id() noexcept;
+
+        // 开始一个新的请求，被采样时返回它的 ID ，否则返回 0
+        uint64_t sample() noexcept;
+
+        // request_id 不为 0 时，记录 name 阶段从 start 到现在的时间
+        void record(const char *name, uint64_t connection_id, uint64_t request_id,
+                    std::chrono::steady_clock::time_point start) noexcept;
+
+        // 同上，但是使用调用者已经取得的结束时间
+        void record(const char *name, uint64_t connection_id, uint64_t request_id,
+                    std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) noexcept;
+
+        // request_id 不为 0 时返回当前时间，用于只在被采样的请求中取得阶段的开始时间
+        [[nodiscard]] static std::chrono::steady_clock::time_point now_if(uint64_t request_id) noexcept;
+
+        // 汇总整个进程的 trace ，没有 attach 时返回一个空的 trace
+        [[nodiscard]] std::string format() const;
+
+    private:
+        tracer() = default;
+
+        const trace_buffer *trace_buffer_ = nullptr;
+        trace_ring *trace_ring_ = nullptr;
+        size_t sample_interval_ = 0;
+        uint64_t connection_count_ = 0;
+        uint64_t request_count_ = 0;
+    };
+}
+
+#endif
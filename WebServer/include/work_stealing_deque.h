@@ -0,0 +1,61 @@
+#ifndef WORK_STEALING_DEQUE_H
+#define WORK_STEALING_DEQUE_H
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace WebServer {
+
+    // Chase-Lev 无锁工作窃取双端队列，保存等待运行的协程
+    // 只有所属的线程可以调用 push() 和 pop() ，在底部进行 LIFO 的操作
+    // 其他线程可以并发地调用 steal() ，从顶部窃取最早加入的协程
+    // 内存序参考 "Correct and Efficient Work-Stealing for Weak Memory Models" (Lê et al., PPoPP 2013)
+    class work_stealing_deque {
+    public:
+        work_stealing_deque();
+
+        work_stealing_deque(const work_stealing_deque &other) = delete;
+
+        work_stealing_deque &operator=(const work_stealing_deque &other) = delete;
+
+        // 只能由所属的线程调用，队列满时扩容
+        void push(std::coroutine_handle<> coroutine);
+
+        // 只能由所属的线程调用，队列为空时返回 nullptr
+        std::coroutine_handle<> pop();
+
+        // 可以由任意线程调用，队列为空或者和其他线程竞争失败时返回 nullptr
+        std::coroutine_handle<> steal();
+
+        // 可以由任意线程调用，结果只是一个近似值
+        [[nodiscard]] bool empty() const noexcept;
+
+    private:
+        // 容量是 2 的幂的环形数组，元素是协程的地址
+        class ring {
+        public:
+            explicit ring(size_t capacity);
+
+            [[nodiscard]] size_t capacity() const noexcept;
+
+            [[nodiscard]] void *load(int64_t index) const noexcept;
+
+            void store(int64_t index, void *coroutine_address) noexcept;
+
+        private:
+            std::vector<std::atomic<void *>> element_list_;
+        };
+
+        std::atomic<int64_t> top_ = 0;
+        std::atomic<int64_t> bottom_ = 0;
+        std::atomic<ring *> ring_;
+        // 扩容之后，旧的数组可能还在被窃取的线程读取，所以一直保留到队列销毁
+        std::vector<std::unique_ptr<ring>> ring_list_;
+    };
+}
+
+#endif
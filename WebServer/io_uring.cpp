@@ -1,19 +1,123 @@
 #include <liburing.h>
 #include <liburing/barrier.h>
 #include <liburing/io_uring.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <span>
 #include <stdexcept>
+#include <utility>
+#include <sys/resource.h>
 #include "io_uring.h"
 #include "constant.h"
 
 namespace WebServer {
+    // 是否优先使用 SQPOLL 模式，必须在创建任何 io_uring 之前设置
+    std::atomic<bool> sqpoll_enabled = false;
+
+    // 一组 io_uring 的创建参数，按照从好到差的顺序依次尝试，内核不支持时退回到下一组
+    struct setup_mode {
+        unsigned int flags;
+        const char *name;
+    };
+
+    // SQPOLL 模式由内核线程轮询 sq ，提交请求不需要系统调用，代价是每个 io_uring 额外占用一个 CPU
+    // 旧的内核只允许特权进程使用 SQPOLL ，这时会得到 EPERM ，同样退回到普通模式
+    constexpr std::array sqpoll_setup_mode_list{
+#ifdef IORING_SETUP_DEFER_TASKRUN
+            setup_mode{IORING_SETUP_SQPOLL | IORING_SETUP_SINGLE_ISSUER, "SQPOLL | SINGLE_ISSUER"},
+#endif
+            setup_mode{IORING_SETUP_SQPOLL, "SQPOLL"},
+    };
+
+    // 每个 io_uring 只被创建它的线程使用，正好符合 SINGLE_ISSUER 的要求
+    // DEFER_TASKRUN 让内核把完成事件推迟到 submit_and_wait 时再处理，不会在任意的系统调用返回时打断线程
+    // COOP_TASKRUN 至少避免了用 IPI 打断正在运行的线程
+    constexpr std::array setup_mode_list{
+#ifdef IORING_SETUP_DEFER_TASKRUN
+            setup_mode{IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN, "SINGLE_ISSUER | DEFER_TASKRUN"},
+            setup_mode{IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN, "SINGLE_ISSUER | COOP_TASKRUN"},
+#endif
+#ifdef IORING_SETUP_COOP_TASKRUN
+            setup_mode{IORING_SETUP_COOP_TASKRUN, "COOP_TASKRUN"},
+#endif
+            setup_mode{0, "default"},
+    };
+
     io_uring::io_uring() {
-        if (const int result = io_uring_queue_init(IO_URING_QUEUE_SIZE, &io_uring_, 0); result != 0) {
-            throw std::runtime_error("failed to invoke 'io_uring_queue_init'");
+        // EINVAL 表示内核不认识某个标志或者不支持这个组合，EPERM 表示没有使用 SQPOLL 的权限
+        const auto try_setup = [this](const setup_mode &mode) {
+            io_uring_params params{};
+            params.flags = mode.flags;
+            if (mode.flags & IORING_SETUP_SQPOLL) {
+                params.sq_thread_idle = SQPOLL_IDLE_TIME;
+            }
+            const int result = io_uring_queue_init_params(IO_URING_QUEUE_SIZE, &io_uring_, &params);
+            if (result != 0 && result != -EINVAL && result != -EPERM) {
+                throw std::runtime_error("failed to invoke 'io_uring_queue_init_params'");
+            }
+            return result == 0;
+        };
+
+        const auto choose_mode = [&try_setup](const std::span<const setup_mode> mode_list) -> const setup_mode * {
+            for (const setup_mode &mode: mode_list) {
+                if (try_setup(mode)) {
+                    return &mode;
+                }
+            }
+            return nullptr;
+        };
+        const setup_mode *chosen_mode = nullptr;
+        if (sqpoll_enabled.load(std::memory_order_relaxed)) {
+            chosen_mode = choose_mode(sqpoll_setup_mode_list);
+        }
+        if (chosen_mode == nullptr) {
+            chosen_mode = choose_mode(setup_mode_list);
         }
+        if (chosen_mode == nullptr) {
+            throw std::runtime_error("failed to invoke 'io_uring_queue_init_params'");
+        }
+
+        // 注册 io_uring 自身的 fd ，之后每次 io_uring_enter 时内核不需要再查找和引用计数这个 fd
+        const bool ring_file_descriptor_registered = io_uring_register_ring_fd(&io_uring_) == 1;
+
+        // 注册一个空的固定文件表，accept 到的连接直接放入这个表中，之后的请求不需要在内核中查找和引用计数 fd
+        // 固定文件表的大小受到 RLIMIT_NOFILE 的限制
+        rlimit file_limit{};
+        getrlimit(RLIMIT_NOFILE, &file_limit);
+        const auto fixed_file_table_size = static_cast<unsigned int>(
+                std::min<rlim_t>(FIXED_FILE_TABLE_SIZE, file_limit.rlim_cur)
+        );
+        if (io_uring_register_files_sparse(&io_uring_, fixed_file_table_size) != 0) {
+            throw std::runtime_error("failed to invoke 'io_uring_register_files_sparse'");
+        }
+
+        // 注册一个空的固定缓冲区表，之后再按需填入缓冲区
+        // 内核不支持或者超出 RLIMIT_MEMLOCK 时，零拷贝发送只使用普通的缓冲区
+        if (io_uring_register_buffers_sparse(&io_uring_, REGISTERED_BUFFER_COUNT) == 0) {
+            free_buffer_index_list_.reserve(REGISTERED_BUFFER_COUNT);
+            for (int buffer_index = REGISTERED_BUFFER_COUNT - 1; buffer_index >= 0; --buffer_index) {
+                free_buffer_index_list_.emplace_back(buffer_index);
+            }
+        }
+
+        // 每个线程都会创建一个 io_uring ，它们的选择是一样的，所以只输出一次
+        static std::once_flag log_flag;
+        std::call_once(log_flag, [&]() {
+            std::cout << "io_uring setup: " << chosen_mode->name
+                      << (ring_file_descriptor_registered ? ", registered ring fd" : "")
+                      << (is_recv_bundle_supported() ? ", recv bundle" : "") << std::endl;
+        });
     }
 
     io_uring::~io_uring() { io_uring_queue_exit(&io_uring_); }
 
+    void io_uring::enable_sqpoll() noexcept { sqpoll_enabled.store(true, std::memory_order_relaxed); }
+
     io_uring &io_uring::get_instance() noexcept {
         thread_local io_uring instance;
         return instance;
@@ -43,6 +147,10 @@ namespace WebServer {
 
     void io_uring::cqe_seen(io_uring_cqe *const cqe) { io_uring_cqe_seen(&io_uring_, cqe); }
 
+    unsigned int io_uring::sq_ready() const noexcept { return io_uring_sq_ready(&io_uring_); }
+
+    unsigned int io_uring::cq_ready() const noexcept { return io_uring_cq_ready(&io_uring_); }
+
     int io_uring::submit_and_wait(const int wait_nr) {
         const int result = io_uring_submit_and_wait(&io_uring_, wait_nr);
         if (result < 0) {
@@ -51,55 +159,263 @@ namespace WebServer {
         return result;
     }
 
+    void io_uring::submit_and_wait_timeout(const unsigned int wait_nr, const std::chrono::nanoseconds timeout) {
+        if (!(io_uring_.features & IORING_FEAT_EXT_ARG)) {
+            submit_and_wait(1);
+            return;
+        }
+        __kernel_timespec kernel_timeout{
+                .tv_sec = std::chrono::duration_cast<std::chrono::seconds>(timeout).count(),
+                .tv_nsec = (timeout % std::chrono::seconds(1)).count()
+        };
+        io_uring_cqe *cqe = nullptr;
+        const int result = io_uring_submit_and_wait_timeout(&io_uring_, &cqe, wait_nr, &kernel_timeout, nullptr);
+        if (result < 0 && result != -ETIME && result != -EINTR) {
+            throw std::runtime_error("failed to invoke 'io_uring_submit_and_wait_timeout'");
+        }
+    }
+
+    void io_uring::get_events() {
+        if (io_uring_.flags & IORING_SETUP_SQPOLL) {
+            return;
+        }
+        if (const int result = io_uring_get_events(&io_uring_); result < 0 && result != -EINTR) {
+            throw std::runtime_error("failed to invoke 'io_uring_get_events'");
+        }
+    }
+
+    io_uring_sqe *io_uring::get_sqe(const unsigned int count) {
+        // SQ 已满时，先把已经准备好的请求提交给内核，腾出空间，而不是得到一个空指针
+        while (io_uring_sq_space_left(&io_uring_) < count) {
+            if (const int result = io_uring_submit(&io_uring_); result < 0 && result != -EINTR) {
+                throw std::runtime_error("failed to invoke 'io_uring_submit'");
+            }
+            // SQPOLL 模式下由内核线程取走请求，提交只是唤醒它，需要等到它真正腾出空间
+            if (io_uring_sq_space_left(&io_uring_) < count && (io_uring_.flags & IORING_SETUP_SQPOLL)) {
+                io_uring_sqring_wait(&io_uring_);
+            }
+        }
+        ++prepared_sqe_count_;
+        return io_uring_get_sqe(&io_uring_);
+    }
+
+    unsigned int io_uring::take_prepared_sqe_count() noexcept { return std::exchange(prepared_sqe_count_, 0); }
+
     void io_uring::submit_multishot_accept_request(
             sqe_data *sqe_data, const int raw_file_descriptor, sockaddr *client_addr, socklen_t *client_len
     ) {
-        io_uring_sqe *sqe = io_uring_get_sqe(&io_uring_);
-        io_uring_prep_multishot_accept(sqe, raw_file_descriptor, client_addr, client_len, 0);
+        io_uring_sqe *sqe = get_sqe(1);
+        io_uring_prep_multishot_accept_direct(sqe, raw_file_descriptor, client_addr, client_len, 0);
         io_uring_sqe_set_data(sqe, sqe_data);
     }
 
-    void io_uring::submit_recv_request(
-            sqe_data *sqe_data, const int raw_file_descriptor, const size_t length
+    void io_uring::submit_multishot_recv_request(
+            sqe_data *sqe_data, const int raw_file_descriptor, const bool fixed_file, const unsigned int buffer_group
     ) {
-        io_uring_sqe *sqe = io_uring_get_sqe(&io_uring_);
-        io_uring_prep_recv(sqe, raw_file_descriptor, nullptr, length, 0);
-        io_uring_sqe_set_flags(sqe, IOSQE_BUFFER_SELECT);
+        io_uring_sqe *sqe = get_sqe(1);
+        io_uring_prep_recv_multishot(sqe, raw_file_descriptor, nullptr, 0, 0);
+        io_uring_sqe_set_flags(sqe, IOSQE_BUFFER_SELECT | (fixed_file ? IOSQE_FIXED_FILE : 0));
+        io_uring_sqe_set_data(sqe, sqe_data);
+        sqe->buf_group = buffer_group;
+#ifdef IORING_RECVSEND_BUNDLE
+        if (is_recv_bundle_supported()) {
+            sqe->ioprio |= IORING_RECVSEND_BUNDLE;
+        }
+#endif
+    }
+
+    void io_uring::submit_connect_request(
+            sqe_data *sqe_data, const int raw_file_descriptor, const sockaddr *address, const socklen_t address_size
+    ) {
+        io_uring_sqe *sqe = get_sqe(1);
+        io_uring_prep_connect(sqe, raw_file_descriptor, address, address_size);
         io_uring_sqe_set_data(sqe, sqe_data);
-        sqe->buf_group = BUFFER_GROUP_ID;
     }
 
     void io_uring::submit_send_request(
-            sqe_data *sqe_data, const int raw_file_descriptor, const std::span<char> &buffer,
-            const size_t length
+            sqe_data *sqe_data, const int raw_file_descriptor, const bool fixed_file,
+            const std::span<const char> buffer, const size_t length
     ) {
-        io_uring_sqe *sqe = io_uring_get_sqe(&io_uring_);
+        io_uring_sqe *sqe = get_sqe(1);
         io_uring_prep_send(sqe, raw_file_descriptor, buffer.data(), length, 0);
+        io_uring_sqe_set_flags(sqe, fixed_file ? IOSQE_FIXED_FILE : 0);
+        io_uring_sqe_set_data(sqe, sqe_data);
+    }
+
+    void io_uring::submit_sendmsg_request(
+            sqe_data *sqe_data, const int raw_file_descriptor, const bool fixed_file, const msghdr *message
+    ) {
+        io_uring_sqe *sqe = get_sqe(1);
+        io_uring_prep_sendmsg(sqe, raw_file_descriptor, message, 0);
+        io_uring_sqe_set_flags(sqe, fixed_file ? IOSQE_FIXED_FILE : 0);
+        io_uring_sqe_set_data(sqe, sqe_data);
+    }
+
+    void io_uring::submit_send_zc_request(
+            sqe_data *sqe_data, const int raw_file_descriptor, const bool fixed_file,
+            const std::span<const char> buffer, const size_t length, const int buffer_index
+    ) {
+        io_uring_sqe *sqe = get_sqe(1);
+        if (buffer_index == -1) {
+            io_uring_prep_send_zc(sqe, raw_file_descriptor, buffer.data(), length, 0, 0);
+        } else {
+            io_uring_prep_send_zc_fixed(sqe, raw_file_descriptor, buffer.data(), length, 0, 0, buffer_index);
+        }
+        io_uring_sqe_set_flags(sqe, fixed_file ? IOSQE_FIXED_FILE : 0);
+        io_uring_sqe_set_data(sqe, sqe_data);
+    }
+
+    void io_uring::submit_read_request(
+            sqe_data *sqe_data, const int raw_file_descriptor, const std::span<char> &buffer,
+            const int64_t offset
+    ) {
+        io_uring_sqe *sqe = get_sqe(1);
+        io_uring_prep_read(sqe, raw_file_descriptor, buffer.data(), buffer.size(), offset);
+        io_uring_sqe_set_data(sqe, sqe_data);
+    }
+
+    void io_uring::submit_write_request(
+            sqe_data *sqe_data, const int raw_file_descriptor, const std::span<const char> buffer,
+            const int64_t offset
+    ) {
+        io_uring_sqe *sqe = get_sqe(1);
+        io_uring_prep_write(sqe, raw_file_descriptor, buffer.data(), buffer.size(), offset);
+        io_uring_sqe_set_data(sqe, sqe_data);
+    }
+
+    void io_uring::submit_openat2_request(
+            sqe_data *sqe_data, const int raw_directory_file_descriptor, const char *path, open_how *how
+    ) {
+        io_uring_sqe *sqe = get_sqe(1);
+        io_uring_prep_openat2(sqe, raw_directory_file_descriptor, path, how);
+        io_uring_sqe_set_data(sqe, sqe_data);
+    }
+
+    void io_uring::submit_statx_request(
+            sqe_data *sqe_data, const int raw_file_descriptor, const char *path, const int flags,
+            const unsigned int mask, struct statx *statx
+    ) {
+        io_uring_sqe *sqe = get_sqe(1);
+        io_uring_prep_statx(sqe, raw_file_descriptor, path, flags, mask, statx);
+        io_uring_sqe_set_data(sqe, sqe_data);
+    }
+
+    void io_uring::submit_linkat_request(
+            sqe_data *sqe_data, const int raw_old_directory_file_descriptor, const char *old_path,
+            const int raw_new_directory_file_descriptor, const char *new_path, const int flags
+    ) {
+        io_uring_sqe *sqe = get_sqe(1);
+        io_uring_prep_linkat(
+                sqe, raw_old_directory_file_descriptor, old_path, raw_new_directory_file_descriptor, new_path, flags
+        );
+        io_uring_sqe_set_data(sqe, sqe_data);
+    }
+
+    void io_uring::submit_renameat_request(
+            sqe_data *sqe_data, const int raw_old_directory_file_descriptor, const char *old_path,
+            const int raw_new_directory_file_descriptor, const char *new_path
+    ) {
+        io_uring_sqe *sqe = get_sqe(1);
+        io_uring_prep_renameat(
+                sqe, raw_old_directory_file_descriptor, old_path, raw_new_directory_file_descriptor, new_path, 0
+        );
+        io_uring_sqe_set_data(sqe, sqe_data);
+    }
+
+    void io_uring::submit_unlinkat_request(
+            sqe_data *sqe_data, const int raw_directory_file_descriptor, const char *path
+    ) {
+        io_uring_sqe *sqe = get_sqe(1);
+        io_uring_prep_unlinkat(sqe, raw_directory_file_descriptor, path, 0);
         io_uring_sqe_set_data(sqe, sqe_data);
     }
 
     void io_uring::submit_splice_request(
-            sqe_data *sqe_data, int raw_file_descriptor_in, int raw_file_descriptor_out, size_t length
+            sqe_data *sqe_data, const int raw_file_descriptor_in, const bool fixed_file_in, const int64_t offset_in,
+            const int raw_file_descriptor_out, const bool fixed_file_out, const int64_t offset_out,
+            const size_t length
     ) {
-        io_uring_sqe *sqe = io_uring_get_sqe(&io_uring_);
-        io_uring_prep_splice(sqe, raw_file_descriptor_in, -1, raw_file_descriptor_out, -1, length, 0);
+        io_uring_sqe *sqe = get_sqe(1);
+        // 输入 fd 通过 SPLICE_F_FD_IN_FIXED 标志，输出 fd 通过 IOSQE_FIXED_FILE 标志指定是否位于固定文件表中
+        io_uring_prep_splice(
+                sqe, raw_file_descriptor_in, offset_in, raw_file_descriptor_out, offset_out, length,
+                fixed_file_in ? SPLICE_F_FD_IN_FIXED : 0
+        );
+        io_uring_sqe_set_flags(sqe, fixed_file_out ? IOSQE_FIXED_FILE : 0);
         io_uring_sqe_set_data(sqe, sqe_data);
     }
 
+    void io_uring::submit_linked_splice_request(
+            sqe_data *read_sqe_data, sqe_data *write_sqe_data,
+            const int raw_file_descriptor_in, const bool fixed_file_in, const int64_t offset_in,
+            const int raw_pipe_write_file_descriptor, const int raw_pipe_read_file_descriptor,
+            const int raw_file_descriptor_out, const bool fixed_file_out, const size_t length
+    ) {
+        // 两个链接的请求必须在同一次提交中，先为它们一起预留空间，中间不能因为 SQ 已满而提交
+        io_uring_sqe *read_sqe = get_sqe(2);
+        io_uring_prep_splice(
+                read_sqe, raw_file_descriptor_in, offset_in, raw_pipe_write_file_descriptor, -1, length,
+                fixed_file_in ? SPLICE_F_FD_IN_FIXED : 0
+        );
+        io_uring_sqe_set_flags(read_sqe, IOSQE_IO_LINK);
+        io_uring_sqe_set_data(read_sqe, read_sqe_data);
+
+        io_uring_sqe *write_sqe = get_sqe(1);
+        io_uring_prep_splice(
+                write_sqe, raw_pipe_read_file_descriptor, -1, raw_file_descriptor_out, -1, length, 0
+        );
+        io_uring_sqe_set_flags(write_sqe, fixed_file_out ? IOSQE_FIXED_FILE : 0);
+        io_uring_sqe_set_data(write_sqe, write_sqe_data);
+    }
+
     void io_uring::submit_cancel_request(sqe_data *sqe_data) {
-        io_uring_sqe *sqe = io_uring_get_sqe(&io_uring_);
+        io_uring_sqe *sqe = get_sqe(1);
         io_uring_prep_cancel(sqe, sqe_data, 0);
+        io_uring_sqe_set_data(sqe, nullptr);
+    }
+
+    void io_uring::submit_cancel_file_descriptor_request(const int raw_file_descriptor, const bool fixed_file) {
+        io_uring_sqe *sqe = get_sqe(1);
+        io_uring_prep_cancel_fd(
+                sqe, raw_file_descriptor, IORING_ASYNC_CANCEL_ALL | (fixed_file ? IORING_ASYNC_CANCEL_FD_FIXED : 0)
+        );
+        io_uring_sqe_set_data(sqe, nullptr);
+    }
+
+    void io_uring::submit_timeout_request(sqe_data *sqe_data, __kernel_timespec *timeout) {
+        io_uring_sqe *sqe = get_sqe(1);
+        io_uring_prep_timeout(sqe, timeout, 0, 0);
+        io_uring_sqe_set_data(sqe, sqe_data);
+    }
+
+    void io_uring::submit_nop_request(sqe_data *sqe_data) {
+        io_uring_sqe *sqe = get_sqe(1);
+        io_uring_prep_nop(sqe);
+        io_uring_sqe_set_data(sqe, sqe_data);
+    }
+
+    void io_uring::submit_close_direct_request(const int file_index) {
+        io_uring_sqe *sqe = get_sqe(1);
+        io_uring_prep_close_direct(sqe, file_index);
+        io_uring_sqe_set_data(sqe, nullptr);
+    }
+
+    bool io_uring::is_recv_bundle_supported() const noexcept {
+#ifdef IORING_FEAT_RECVSEND_BUNDLE
+        return io_uring_.features & IORING_FEAT_RECVSEND_BUNDLE;
+#else
+        return false;
+#endif
     }
 
     void io_uring::setup_buffer_ring(
-            io_uring_buf_ring *buffer_ring,
-            std::span<std::vector<char>> buffer_list,
-            const unsigned int buffer_ring_size
+            io_uring_buf_ring *buffer_ring, const unsigned int buffer_group, char *buffer_area,
+            const size_t buffer_size, const unsigned int buffer_ring_size
     ) {
         io_uring_buf_reg io_uring_buf_reg{
                 .ring_addr = reinterpret_cast<__uint64_t>(buffer_ring),
                 .ring_entries = buffer_ring_size,
-                .bgid = BUFFER_GROUP_ID,
+                .bgid = static_cast<__u16>(buffer_group),
         };
 
         const int result = io_uring_register_buf_ring(&io_uring_, &io_uring_buf_reg, 0);
@@ -111,23 +427,42 @@ namespace WebServer {
         const unsigned int mask = io_uring_buf_ring_mask(buffer_ring_size);
         for (unsigned int buffer_id = 0; buffer_id < buffer_ring_size; ++buffer_id) {
             io_uring_buf_ring_add(
-                    buffer_ring, buffer_list[buffer_id].data(),
-                    buffer_list[buffer_id].size(), buffer_id, mask,
-                    buffer_id
+                    buffer_ring, buffer_area + buffer_id * buffer_size, buffer_size, buffer_id, mask, buffer_id
             );
         }
         io_uring_buf_ring_advance(buffer_ring, buffer_ring_size);
-    };
+    }
 
     void io_uring::add_buffer(
-            io_uring_buf_ring *buffer_ring,
-            std::span<char> buffer, const unsigned int buffer_id,
-            const unsigned int buffer_ring_size
+            io_uring_buf_ring *buffer_ring, std::span<char> buffer, const unsigned int buffer_id,
+            const unsigned int buffer_ring_size, const unsigned int offset
     ) {
         const unsigned int mask = io_uring_buf_ring_mask(buffer_ring_size);
-        io_uring_buf_ring_add(buffer_ring, buffer.data(), buffer.size(),
-                              buffer_id, mask, buffer_id);
-        io_uring_buf_ring_advance(buffer_ring, 1);
+        io_uring_buf_ring_add(buffer_ring, buffer.data(), buffer.size(), buffer_id, mask, static_cast<int>(offset));
     }
-}
 
+    void io_uring::advance_buffer_ring(io_uring_buf_ring *buffer_ring, const unsigned int count) {
+        io_uring_buf_ring_advance(buffer_ring, static_cast<int>(count));
+    }
+
+    int io_uring::register_buffer(const std::span<const char> buffer) {
+        if (free_buffer_index_list_.empty()) {
+            return -1;
+        }
+
+        const int buffer_index = free_buffer_index_list_.back();
+        const iovec buffer_iovec{.iov_base = const_cast<char *>(buffer.data()), .iov_len = buffer.size()};
+        if (io_uring_register_buffers_update_tag(&io_uring_, buffer_index, &buffer_iovec, nullptr, 1) != 1) {
+            return -1;
+        }
+        free_buffer_index_list_.pop_back();
+        return buffer_index;
+    }
+
+    void io_uring::unregister_buffer(const int buffer_index) {
+        // 用一个空的 iovec 替换掉原来的缓冲区，内核会在引用它的请求全部完成后才解除内存页的锁定
+        const iovec buffer_iovec{.iov_base = nullptr, .iov_len = 0};
+        io_uring_register_buffers_update_tag(&io_uring_, buffer_index, &buffer_iovec, nullptr, 1);
+        free_buffer_index_list_.emplace_back(buffer_index);
+    }
+}
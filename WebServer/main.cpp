@@ -1,9 +1,93 @@
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
+#include <string_view>
+#include <thread>
+#include "completion_batcher.h"
 #include "http_server.h"
+#include "io_uring.h"
+#include "request_body.h"
+#include "socket.h"
+#include "tracer.h"
 
+// 如果 argument 是 "<name><数值>" 的形式，把数值写入 value 并返回 true ，数值格式错误时退出进程
+template<typename T>
+bool parse_number(const std::string_view argument, const std::string_view name, T &value) {
+    if (!argument.starts_with(name)) {
+        return false;
+    }
+    const std::string_view text = argument.substr(name.size());
+    if (const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+            error != std::errc{} || end != text.data() + text.size()) {
+        std::cerr << "invalid argument: " << argument << std::endl;
+        std::exit(1);
+    }
+    return true;
+}
+
+// 如果 argument 是 "<name><秒数>" 的形式，把秒数写入 timeout 并返回 true
+bool parse_timeout(const std::string_view argument, const std::string_view name, std::chrono::milliseconds &timeout) {
+    unsigned int seconds = 0;
+    if (!parse_number(argument, name, seconds)) {
+        return false;
+    }
+    timeout = std::chrono::seconds(seconds);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    WebServer::timeout_config timeout_config;
+    const char *handoff_path = nullptr;
+    for (int index = 1; index < argc; ++index) {
+        const std::string_view argument(argv[index]);
+        // --sqpoll 让每个线程的 io_uring 使用内核轮询线程提交请求，适合对延迟敏感并且 CPU 充足的部署
+        if (argument == "--sqpoll") {
+            WebServer::io_uring::enable_sqpoll();
+            continue;
+        }
+        // --busy-poll=<微秒> 在低负载时阻塞之前先忙轮询一段时间，用 CPU 换取更低的唤醒延迟
+        if (unsigned int busy_poll_time = 0; parse_number(argument, "--busy-poll=", busy_poll_time)) {
+            WebServer::completion_batcher::enable_busy_poll(std::chrono::microseconds(busy_poll_time));
+            continue;
+        }
+        // 连接的超时时间，单位是秒，为 0 表示不限制
+        if (parse_timeout(argument, "--idle-timeout=", timeout_config.idle_timeout) ||
+            parse_timeout(argument, "--header-timeout=", timeout_config.header_timeout) ||
+            parse_timeout(argument, "--send-timeout=", timeout_config.send_timeout) ||
+            parse_timeout(argument, "--drain-timeout=", timeout_config.drain_timeout)) {
+            continue;
+        }
+        // --zero-copy-threshold=<字节数> 不小于这个长度的响应使用零拷贝的 send ，0 表示不使用零拷贝
+        if (size_t threshold = 0; parse_number(argument, "--zero-copy-threshold=", threshold)) {
+            WebServer::client_socket::set_zero_copy_threshold(threshold);
+            continue;
+        }
+        // --trace-sample=N 每 N 个请求追踪一个，通过 SIGUSR1 或者 TRACE_URL 导出
+        if (size_t sample_interval = 0; parse_number(argument, "--trace-sample=", sample_interval)) {
+            WebServer::tracer::enable(sample_interval);
+            continue;
+        }
+        // --handoff=<路径> 启用零停机升级：启动时从这个 Unix 套接字上的旧进程接收监听套接字，之后在上面等待下一个新进程
+        if (argument.starts_with("--handoff=")) {
+            handoff_path = argv[index] + std::string_view("--handoff=").size();
+            continue;
+        }
+        // --stats-url 允许通过 STATS_URL 和 TRACE_URL 读取统计数据和 trace ，只应该在可信的网络中使用
+        if (argument == "--stats-url") {
+            WebServer::http_server::enable_stats_url();
+            continue;
+        }
+        // --upload-dir=<路径> 允许 PUT 上传文件，文件只能保存在这个目录之下。没有这个参数时 PUT 请求得到 405
+        if (argument.starts_with("--upload-dir=")) {
+            WebServer::request_body::enable_upload(argv[index] + std::string_view("--upload-dir=").size());
+            continue;
+        }
+        std::cerr << "unknown argument: " << argument << std::endl;
+    }
 
-int main() {
-    WebServer::http_server server;
+    WebServer::http_server server(std::thread::hardware_concurrency(), timeout_config);
     std::cout << "Running..." << std::endl;
-    server.listen("18080");
+    server.listen("18080", handoff_path);
+    std::cout << "Stopped" << std::endl;
 }
@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <bit>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <sys/mman.h>
+#include <tuple>
+#include <unistd.h>
+#include "metrics.h"
+
+namespace WebServer {
+    constexpr std::array<std::string_view, metrics::COUNTER_COUNT> COUNTER_NAME_LIST{
+            "accepted_connection", "request", "error_response", "timeout", "sent_byte", "response_cache_hit",
+            "response_cache_miss", "frame_large_allocation", "frame_reuse", "frame_remote_free"
+    };
+
+    constexpr std::array<std::string_view, metrics::GAUGE_COUNT> GAUGE_NAME_LIST{
+            "connection", "borrowed_buffer", "inflight_sqe", "pending_sqe", "ready_cqe"
+    };
+
+    constexpr std::array<std::string_view, metrics::BUFFER_GAUGE_COUNT> BUFFER_GAUGE_NAME_LIST{
+            "buffer_group_", "buffer_low_watermark_", "buffer_exhaustion_", "buffer_waiting_"
+    };
+
+    constexpr std::array<std::string_view, metrics::FRAME_COUNTER_COUNT> FRAME_COUNTER_NAME_LIST{"frame_allocation_"};
+
+    constexpr std::array<std::string_view, metrics::PHASE_COUNT> PHASE_NAME_LIST{
+            "accept", "parse", "lookup", "send_header", "splice"
+    };
+
+    // 直方图中输出的分位数，以及它们在名字中的写法
+    constexpr std::array<std::tuple<double, std::string_view>, 5> QUANTILE_LIST{
+            std::tuple{0.5, "p50"}, std::tuple{0.9, "p90"}, std::tuple{0.99, "p99"}, std::tuple{0.999, "p999"},
+            std::tuple{0.9999, "p9999"}
+    };
+
+    // 只有当前线程写入 value ，所以不需要原子的读-改-写指令
+    template<typename T>
+    void relaxed_add(std::atomic<T> &value, const T delta) noexcept {
+        value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    // 汇总 worker_slot_list 中的所有 worker_slot
+    std::string format_worker_slot_list(const metrics::worker_slot *worker_slot_list, const size_t worker_count) {
+        std::string result;
+        const auto append_line = [&result](const std::string_view name, const auto value) {
+            result.append(name);
+            result.push_back(' ');
+            result.append(std::to_string(value));
+            result.push_back('\n');
+        };
+
+        append_line("worker", worker_count);
+        for (size_t counter = 0; counter < metrics::COUNTER_COUNT; ++counter) {
+            uint64_t value = 0;
+            for (size_t worker_index = 0; worker_index < worker_count; ++worker_index) {
+                value += worker_slot_list[worker_index].counter_list[counter].load(std::memory_order_relaxed);
+            }
+            append_line(COUNTER_NAME_LIST[counter], value);
+        }
+        for (size_t gauge = 0; gauge < metrics::GAUGE_COUNT; ++gauge) {
+            int64_t value = 0;
+            for (size_t worker_index = 0; worker_index < worker_count; ++worker_index) {
+                value += worker_slot_list[worker_index].gauge_list[gauge].load(std::memory_order_relaxed);
+            }
+            append_line(GAUGE_NAME_LIST[gauge], value);
+        }
+        for (size_t buffer_gauge = 0; buffer_gauge < metrics::BUFFER_GAUGE_COUNT; ++buffer_gauge) {
+            const bool minimum = buffer_gauge == static_cast<size_t>(metrics::buffer_gauge::low_watermark);
+            for (size_t size_class = 0; size_class < BUFFER_SIZE_CLASS_COUNT; ++size_class) {
+                int64_t value = 0;
+                for (size_t worker_index = 0; worker_index < worker_count; ++worker_index) {
+                    const int64_t worker_value =
+                            worker_slot_list[worker_index].buffer_gauge_list[buffer_gauge][size_class].load(
+                                    std::memory_order_relaxed
+                            );
+                    if (!minimum) {
+                        value += worker_value;
+                    } else if (worker_index == 0 || worker_value < value) {
+                        value = worker_value;
+                    }
+                }
+                const std::string name = std::string(BUFFER_GAUGE_NAME_LIST[buffer_gauge]) +
+                                         std::to_string(BUFFER_SIZE_LIST[size_class]);
+                append_line(name, value);
+            }
+        }
+        for (size_t frame_counter = 0; frame_counter < metrics::FRAME_COUNTER_COUNT; ++frame_counter) {
+            for (size_t size_class = 0; size_class < FRAME_SIZE_CLASS_COUNT; ++size_class) {
+                uint64_t value = 0;
+                for (size_t worker_index = 0; worker_index < worker_count; ++worker_index) {
+                    value += worker_slot_list[worker_index].frame_counter_list[frame_counter][size_class].load(
+                            std::memory_order_relaxed
+                    );
+                }
+                const std::string name = std::string(FRAME_COUNTER_NAME_LIST[frame_counter]) +
+                                         std::to_string(MIN_FRAME_SIZE << size_class);
+                append_line(name, value);
+            }
+        }
+
+        std::array<uint64_t, HISTOGRAM_BUCKET_COUNT> bucket_list;
+        for (size_t phase = 0; phase < metrics::PHASE_COUNT; ++phase) {
+            bucket_list.fill(0);
+            uint64_t count = 0;
+            uint64_t sum = 0;
+            uint64_t max = 0;
+            for (size_t worker_index = 0; worker_index < worker_count; ++worker_index) {
+                const metrics::histogram &histogram = worker_slot_list[worker_index].histogram_list[phase];
+                for (size_t index = 0; index < HISTOGRAM_BUCKET_COUNT; ++index) {
+                    bucket_list[index] += histogram.bucket_list[index].load(std::memory_order_relaxed);
+                }
+                sum += histogram.sum.load(std::memory_order_relaxed);
+                max = std::max(max, histogram.max.load(std::memory_order_relaxed));
+            }
+            // 读取期间其他线程可能还在写入，所以总数以实际读到的桶为准
+            for (const uint64_t bucket: bucket_list) {
+                count += bucket;
+            }
+
+            const std::string prefix = std::string(PHASE_NAME_LIST[phase]) + "_";
+            append_line(prefix + "count", count);
+            append_line(prefix + "mean_ns", count == 0 ? 0 : sum / count);
+            for (const auto &[quantile, quantile_name]: QUANTILE_LIST) {
+                // 第一个累计数量达到 quantile * count 的桶，报告桶的上界，不会超过实际的最大值
+                const auto target = static_cast<uint64_t>(quantile * static_cast<double>(count) + 0.5);
+                uint64_t value = 0;
+                uint64_t cumulative_count = 0;
+                for (size_t index = 0; index < HISTOGRAM_BUCKET_COUNT && count > 0; ++index) {
+                    cumulative_count += bucket_list[index];
+                    if (cumulative_count >= std::max<uint64_t>(target, 1)) {
+                        value = std::min(metrics::histogram::get_bucket_upper_bound(index), max);
+                        break;
+                    }
+                }
+                append_line(prefix + std::string(quantile_name) + "_ns", value);
+            }
+            append_line(prefix + "max_ns", max);
+        }
+        return result;
+    }
+
+    size_t metrics::histogram::get_bucket_index(uint64_t value) noexcept {
+        constexpr uint64_t sub_bucket_count = 1 << HISTOGRAM_SUB_BUCKET_BITS;
+        value = std::min<uint64_t>(value, (uint64_t{1} << HISTOGRAM_VALUE_BITS) - 1);
+        if (value < sub_bucket_count) {
+            return value;
+        }
+        // 最高位之后的 HISTOGRAM_SUB_BUCKET_BITS 位决定了值在这个 2 的幂的区间中的哪个桶
+        const size_t shift = std::bit_width(value) - 1 - HISTOGRAM_SUB_BUCKET_BITS;
+        return ((shift + 1) << HISTOGRAM_SUB_BUCKET_BITS) + ((value >> shift) & (sub_bucket_count - 1));
+    }
+
+    uint64_t metrics::histogram::get_bucket_upper_bound(const size_t index) noexcept {
+        constexpr uint64_t sub_bucket_count = 1 << HISTOGRAM_SUB_BUCKET_BITS;
+        if (index < sub_bucket_count) {
+            return index;
+        }
+        const size_t shift = (index >> HISTOGRAM_SUB_BUCKET_BITS) - 1;
+        return ((sub_bucket_count + (index & (sub_bucket_count - 1)) + 1) << shift) - 1;
+    }
+
+    metrics::segment::segment(const size_t worker_count) {
+        size_ = sizeof(worker_slot) * (worker_count + 1);
+
+        // worker_slot 按照缓存行对齐，头部单独占用第一个 worker_slot 的位置
+        name_ = std::string(STATS_SHARED_MEMORY_PREFIX) + std::to_string(getpid());
+        void *memory = MAP_FAILED;
+        if (const int raw_file_descriptor = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+                raw_file_descriptor != -1) {
+            if (ftruncate(raw_file_descriptor, static_cast<off_t>(size_)) == 0) {
+                memory = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, raw_file_descriptor, 0);
+            }
+            close(raw_file_descriptor);
+            if (memory == MAP_FAILED) {
+                shm_unlink(name_.c_str());
+            }
+        }
+        if (memory == MAP_FAILED) {
+            name_.clear();
+            memory = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED) {
+                throw std::runtime_error("failed to invoke 'mmap'");
+            }
+        }
+
+        header_ = std::construct_at(static_cast<segment_header *>(memory));
+        header_->worker_count = static_cast<uint32_t>(worker_count);
+        worker_slot_list_ = reinterpret_cast<worker_slot *>(static_cast<char *>(memory) + sizeof(worker_slot));
+        for (size_t worker_index = 0; worker_index < worker_count; ++worker_index) {
+            std::construct_at(worker_slot_list_ + worker_index);
+        }
+
+        if (!name_.empty()) {
+            std::cout << "statistics: /dev/shm" << name_ << std::endl;
+        }
+    }
+
+    metrics::segment::~segment() {
+        munmap(header_, size_);
+        if (!name_.empty()) {
+            shm_unlink(name_.c_str());
+        }
+    }
+
+    metrics::worker_slot &metrics::segment::get_worker_slot(const size_t worker_index) const noexcept {
+        return worker_slot_list_[worker_index];
+    }
+
+    std::string metrics::segment::format() const {
+        return format_worker_slot_list(worker_slot_list_, header_->worker_count);
+    }
+
+    metrics &metrics::get_instance() noexcept {
+        thread_local metrics instance;
+        return instance;
+    }
+
+    void metrics::attach(const segment &segment, const size_t worker_index) noexcept {
+        segment_ = &segment;
+        worker_slot_ = &segment.get_worker_slot(worker_index);
+    }
+
+    void metrics::add(const counter counter, const uint64_t value) noexcept {
+        relaxed_add(worker_slot_->counter_list[static_cast<size_t>(counter)], value);
+    }
+
+    void metrics::set(const counter counter, const uint64_t value) noexcept {
+        worker_slot_->counter_list[static_cast<size_t>(counter)].store(value, std::memory_order_relaxed);
+    }
+
+    void metrics::add(const gauge gauge, const int64_t value) noexcept {
+        relaxed_add(worker_slot_->gauge_list[static_cast<size_t>(gauge)], value);
+    }
+
+    void metrics::set(const gauge gauge, const int64_t value) noexcept {
+        worker_slot_->gauge_list[static_cast<size_t>(gauge)].store(value, std::memory_order_relaxed);
+    }
+
+    void metrics::set(const buffer_gauge buffer_gauge, const unsigned int size_class, const int64_t value) noexcept {
+        worker_slot_->buffer_gauge_list[static_cast<size_t>(buffer_gauge)][size_class].store(
+                value, std::memory_order_relaxed
+        );
+    }
+
+    void metrics::set(const frame_counter frame_counter, const size_t size_class, const uint64_t value) noexcept {
+        worker_slot_->frame_counter_list[static_cast<size_t>(frame_counter)][size_class].store(
+                value, std::memory_order_relaxed
+        );
+    }
+
+    void metrics::record(const phase phase, const std::chrono::steady_clock::time_point start) noexcept {
+        const auto duration = std::chrono::steady_clock::now() - start;
+        const auto value = static_cast<uint64_t>(
+                std::max<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(), 0)
+        );
+
+        histogram &histogram = worker_slot_->histogram_list[static_cast<size_t>(phase)];
+        relaxed_add(histogram.bucket_list[histogram::get_bucket_index(value)], uint64_t{1});
+        relaxed_add(histogram.count, uint64_t{1});
+        relaxed_add(histogram.sum, value);
+        if (value > histogram.max.load(std::memory_order_relaxed)) {
+            histogram.max.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    std::string metrics::format() const {
+        if (segment_ != nullptr) {
+            return segment_->format();
+        }
+        return format_worker_slot_list(worker_slot_, 1);
+    }
+}
@@ -0,0 +1,77 @@
+#include <atomic>
+#include <utility>
+#include <fcntl.h>
+#include "constant.h"
+#include "pipe_pool.h"
+
+namespace WebServer {
+    // 整个进程中扩大了容量的管道一共预留的字节数
+    std::atomic<size_t> reserved_pipe_size = 0;
+
+    pipe_pool::reservation::reservation(const size_t size) noexcept {
+        size_t current_size = reserved_pipe_size.load(std::memory_order_relaxed);
+        do {
+            if (current_size + size > PIPE_TOTAL_SIZE) {
+                return;
+            }
+        } while (!reserved_pipe_size.compare_exchange_weak(
+                current_size, current_size + size, std::memory_order_relaxed
+        ));
+        size_ = size;
+    }
+
+    pipe_pool::reservation::~reservation() {
+        if (size_ != 0) {
+            reserved_pipe_size.fetch_sub(size_, std::memory_order_relaxed);
+        }
+    }
+
+    pipe_pool::reservation::reservation(reservation &&other) noexcept : size_{std::exchange(other.size_, 0)} {}
+
+    pipe_pool::reservation &pipe_pool::reservation::operator=(reservation &&other) noexcept {
+        if (this != &other) {
+            if (size_ != 0) {
+                reserved_pipe_size.fetch_sub(size_, std::memory_order_relaxed);
+            }
+            size_ = std::exchange(other.size_, 0);
+        }
+        return *this;
+    }
+
+    size_t pipe_pool::reservation::size() const noexcept { return size_; }
+
+    pipe_pool &pipe_pool::get_instance() noexcept {
+        thread_local pipe_pool instance;
+        return instance;
+    }
+
+    pipe_pool::pipe_pair pipe_pool::acquire() {
+        if (!pipe_list_.empty()) {
+            pipe_pair pipe = std::move(pipe_list_.back());
+            pipe_list_.pop_back();
+            return pipe;
+        }
+
+        auto [read_end, write_end] = WebServer::pipe();
+
+        // 扩大管道的容量，这样每一对 splice 可以移动更多的数据，减少事件循环的唤醒次数
+        // 普通用户无法超过 /proc/sys/fs/pipe-max-size ，失败时保留默认的容量，并且归还预留的字节数
+        reservation reserved_size(PIPE_SIZE);
+        if (reserved_size.size() != 0 &&
+            fcntl(write_end.get_raw_file_descriptor(), F_SETPIPE_SZ, PIPE_SIZE) == -1) {
+            reserved_size = reservation();
+        }
+        const int capacity = fcntl(write_end.get_raw_file_descriptor(), F_GETPIPE_SZ);
+
+        return {
+                std::move(read_end), std::move(write_end), capacity > 0 ? static_cast<size_t>(capacity) : 65536,
+                std::move(reserved_size)
+        };
+    }
+
+    void pipe_pool::release(pipe_pair &&pipe) {
+        if (pipe_list_.size() < PIPE_POOL_SIZE) {
+            pipe_list_.emplace_back(std::move(pipe));
+        }
+    }
+}
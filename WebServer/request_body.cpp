@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <optional>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <linux/openat2.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "constant.h"
+#include "request_body.h"
+
+namespace WebServer {
+    // 上传目录的 fd ，以及它相对于当前目录的路径，只在启动线程池之前写入
+    int upload_directory_file_descriptor = -1;
+    std::filesystem::path upload_directory_path;
+
+    void request_body::enable_upload(const std::filesystem::path &directory) {
+        upload_directory_file_descriptor = ::open(directory.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (upload_directory_file_descriptor == -1) {
+            throw std::runtime_error("failed to invoke 'open'");
+        }
+        upload_directory_path = std::filesystem::absolute(directory).lexically_normal().lexically_relative(
+                std::filesystem::current_path()
+        );
+    }
+
+    bool request_body::is_upload_enabled() noexcept { return upload_directory_file_descriptor != -1; }
+
+    request_body::request_body(const std::optional<uint64_t> content_length)
+            : chunked_{!content_length.has_value()}, remaining_length_{content_length.value_or(0)} {}
+
+    task<int> request_body::open(const std::filesystem::path &path) {
+        if (!is_upload_enabled() || !path.has_filename()) {
+            co_return -EINVAL;
+        }
+        // 路径中的 ".." 、绝对路径和符号链接都会被内核拒绝，而不是依赖对 URL 的字符串处理
+        open_how how{};
+        how.flags = O_PATH | O_DIRECTORY | O_CLOEXEC;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS;
+        const std::filesystem::path directory = path.has_parent_path() ? path.parent_path() : ".";
+        const int raw_directory_file_descriptor = co_await openat2_awaiter(
+                upload_directory_file_descriptor, directory, how
+        );
+        if (raw_directory_file_descriptor < 0) {
+            co_return raw_directory_file_descriptor;
+        }
+        file_descriptor directory_file_descriptor{raw_directory_file_descriptor};
+
+        // 目标已经是一个目录时，之后的 rename 一定会失败，现在就拒绝，不需要接收请求体
+        std::string name = path.filename().native();
+        struct statx target_status{};
+        if (co_await statx_awaiter(
+                raw_directory_file_descriptor, name.c_str(), AT_SYMLINK_NOFOLLOW, STATX_TYPE, target_status
+        ) == 0 && S_ISDIR(target_status.stx_mode)) {
+            co_return -EISDIR;
+        }
+
+        // 匿名的临时文件在同一个目录下，保证之后的 link 和 rename 在同一个文件系统中
+        how.flags = O_TMPFILE | O_WRONLY | O_CLOEXEC;
+        how.mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+        const int raw_file_descriptor = co_await openat2_awaiter(raw_directory_file_descriptor, ".", how);
+        if (raw_file_descriptor < 0) {
+            co_return raw_file_descriptor;
+        }
+
+        file_.emplace(raw_file_descriptor);
+        directory_.emplace(std::move(directory_file_descriptor));
+        name_ = std::move(name);
+        path_ = (upload_directory_path / path).lexically_normal();
+        co_return 0;
+    }
+
+    task<size_t> request_body::consume(const std::span<const char> data) {
+        if (done() || has_error()) {
+            co_return 0;
+        }
+        if (chunked_) {
+            co_return co_await consume_chunked(data);
+        }
+
+        const size_t length = std::min<uint64_t>(remaining_length_, data.size());
+        if (!co_await write(data.first(length))) {
+            error_ = true;
+        }
+        remaining_length_ -= length;
+        co_return length;
+    }
+
+    bool request_body::should_splice() const noexcept {
+        return !chunked_ && file_.has_value() && !error_ && remaining_length_ >= SPLICE_REQUEST_BODY_SIZE;
+    }
+
+    task<> request_body::splice_from(const client_socket &client_socket, timer_wheel::timer *timer) {
+        // 套接字不能指定偏移量，文件也使用当前位置写入，和 write() 保持一致
+        if (co_await splice(client_socket, -1, *file_, remaining_length_, timer) == -1) {
+            error_ = true;
+            co_return;
+        }
+        remaining_length_ = 0;
+    }
+
+    task<bool> request_body::commit() {
+        if (!file_.has_value() || committed_) {
+            co_return false;
+        }
+        // 通过 /proc/self/fd 给匿名文件一个名字不需要特权，AT_EMPTY_PATH 的方式需要 CAP_DAC_READ_SEARCH
+        const std::string file_path = "/proc/self/fd/" + std::to_string(file_->get_raw_file_descriptor());
+        const int raw_directory_file_descriptor = directory_->get_raw_file_descriptor();
+        const int link_result = co_await linkat_awaiter(
+                AT_FDCWD, file_path.c_str(), raw_directory_file_descriptor, name_.c_str(), AT_SYMLINK_FOLLOW
+        );
+        if (link_result == 0) {
+            committed_ = true;
+            co_return true;
+        }
+        if (link_result != -EEXIST) {
+            co_return false;
+        }
+
+        // link 不能覆盖已有的文件，先链接到一个临时的名字，再用 rename 原子地替换目标文件
+        thread_local std::minstd_rand random_engine{std::random_device{}()};
+        const std::string temporary_name = name_ + '.' + std::to_string(random_engine());
+        if (co_await linkat_awaiter(
+                AT_FDCWD, file_path.c_str(), raw_directory_file_descriptor, temporary_name.c_str(), AT_SYMLINK_FOLLOW
+        ) != 0) {
+            co_return false;
+        }
+        if (co_await renameat_awaiter(
+                raw_directory_file_descriptor, temporary_name.c_str(), raw_directory_file_descriptor, name_.c_str()
+        ) != 0) {
+            co_await unlinkat_awaiter(raw_directory_file_descriptor, temporary_name.c_str());
+            co_return false;
+        }
+        committed_ = true;
+        replaced_ = true;
+        co_return true;
+    }
+
+    bool request_body::is_open() const noexcept { return file_.has_value(); }
+
+    bool request_body::replaced() const noexcept { return replaced_; }
+
+    const std::filesystem::path &request_body::path() const noexcept { return path_; }
+
+    bool request_body::done() const noexcept {
+        return chunked_ ? chunk_state_ == chunk_state::done : remaining_length_ == 0;
+    }
+
+    bool request_body::has_error() const noexcept { return error_ || chunk_state_ == chunk_state::error; }
+
+    task<size_t> request_body::consume_chunked(const std::span<const char> data) {
+        // 块大小所在的行结束，大小为 0 的块表示请求体的结束，之后是 trailer
+        const auto end_size_line = [this]() {
+            chunk_state_ = remaining_length_ == 0 ? chunk_state::trailer : chunk_state::data;
+        };
+
+        size_t offset = 0;
+        while (offset < data.size() && chunk_state_ != chunk_state::done && chunk_state_ != chunk_state::error) {
+            const char c = data[offset];
+            switch (chunk_state_) {
+                case chunk_state::size: {
+                    int digit = -1;
+                    if (c >= '0' && c <= '9') {
+                        digit = c - '0';
+                    } else if (c >= 'a' && c <= 'f') {
+                        digit = c - 'a' + 10;
+                    } else if (c >= 'A' && c <= 'F') {
+                        digit = c - 'A' + 10;
+                    }
+
+                    if (digit != -1 && chunk_size_digit_count_ < 15) {
+                        remaining_length_ = remaining_length_ * 16 + digit;
+                        ++chunk_size_digit_count_;
+                    } else if (chunk_size_digit_count_ == 0 || digit != -1) {
+                        chunk_state_ = chunk_state::error;
+                        break;
+                    } else if (c == '\n') {
+                        end_size_line();
+                    } else if (c == ';' || c == ' ' || c == '\t' || c == '\r') {
+                        chunk_state_ = chunk_state::extension;
+                    } else {
+                        chunk_state_ = chunk_state::error;
+                        break;
+                    }
+                    ++offset;
+                    break;
+                }
+                case chunk_state::extension: {
+                    const auto line_end = std::find(data.begin() + static_cast<ptrdiff_t>(offset), data.end(), '\n');
+                    offset = line_end - data.begin();
+                    if (line_end != data.end()) {
+                        ++offset;
+                        end_size_line();
+                    }
+                    break;
+                }
+                case chunk_state::data: {
+                    const size_t length = std::min<uint64_t>(remaining_length_, data.size() - offset);
+                    if (!co_await write(data.subspan(offset, length))) {
+                        error_ = true;
+                        co_return offset;
+                    }
+                    offset += length;
+                    remaining_length_ -= length;
+                    if (remaining_length_ == 0) {
+                        chunk_state_ = chunk_state::data_end;
+                    }
+                    break;
+                }
+                case chunk_state::data_end:
+                    if (c == '\n') {
+                        chunk_state_ = chunk_state::size;
+                        chunk_size_digit_count_ = 0;
+                    } else if (c != '\r') {
+                        chunk_state_ = chunk_state::error;
+                        break;
+                    }
+                    ++offset;
+                    break;
+                case chunk_state::trailer:
+                    // 空行表示 trailer 的结束，trailer 中的头部都被忽略
+                    if (c == '\n') {
+                        chunk_state_ = chunk_state::done;
+                        ++offset;
+                    } else if (c == '\r') {
+                        ++offset;
+                    } else {
+                        chunk_state_ = chunk_state::trailer_line;
+                    }
+                    break;
+                case chunk_state::trailer_line: {
+                    const auto line_end = std::find(data.begin() + static_cast<ptrdiff_t>(offset), data.end(), '\n');
+                    offset = line_end - data.begin();
+                    if (line_end != data.end()) {
+                        ++offset;
+                        chunk_state_ = chunk_state::trailer;
+                    }
+                    break;
+                }
+                case chunk_state::done:
+                case chunk_state::error:
+                    break;
+            }
+        }
+        co_return offset;
+    }
+
+    task<bool> request_body::write(std::span<const char> data) {
+        if (!file_.has_value()) {
+            co_return true;
+        }
+        while (!data.empty()) {
+            const ssize_t result = co_await write_awaiter(file_->get_raw_file_descriptor(), data, -1);
+            if (result <= 0) {
+                co_return false;
+            }
+            data = data.subspan(result);
+        }
+        co_return true;
+    }
+}
@@ -0,0 +1,81 @@
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <sys/uio.h>
+#include "constant.h"
+#include "response_batch.h"
+
+namespace WebServer {
+    http_response response_batch::add_response(const http_status status) { return {arena_, status}; }
+
+    void response_batch::append(std::shared_ptr<const cached_response> response) {
+        const size_t size = response->data().size();
+        append(std::move(response), 0, size);
+    }
+
+    void response_batch::append(
+            std::shared_ptr<const cached_response> response, const size_t offset, const size_t length
+    ) {
+        close_arena_segment();
+        // 固定缓冲区中的任何一段仍然位于这个固定缓冲区中，可以使用同一个下标
+        segment_list_.emplace_back(response->data().data() + offset, 0, length, response->buffer_index());
+        response_list_.emplace_back(std::move(response));
+    }
+
+    void response_batch::append(const std::string_view data) { arena_.append(data); }
+
+    bool response_batch::empty() const noexcept { return segment_list_.empty() && arena_offset_ == arena_.size(); }
+
+    bool response_batch::full() const noexcept { return segment_list_.size() >= SEND_BATCH_SIZE; }
+
+    task<ssize_t> response_batch::flush(client_socket &client_socket) {
+        close_arena_segment();
+
+        ssize_t bytes_sent = 0;
+        for (size_t index = 0; index < segment_list_.size();) {
+            const segment &first = segment_list_[index];
+            ssize_t result;
+            if (first.buffer_index != -1) {
+                // 注册为固定缓冲区的响应体单独发送，这样可以使用零拷贝的 send
+                result = co_await client_socket.send({first.data, first.length}, first.length, first.buffer_index);
+                ++index;
+            } else {
+                // 其余连续的数据合并成一次 sendmsg
+                iovec_list_.clear();
+                for (; index < segment_list_.size() && segment_list_[index].buffer_index == -1; ++index) {
+                    const segment &segment = segment_list_[index];
+                    const char *data = segment.data == nullptr ? arena_.data() + segment.offset : segment.data;
+                    iovec_list_.emplace_back(const_cast<char *>(data), segment.length);
+                }
+                if (iovec_list_.size() == 1) {
+                    const auto [data, length] = iovec_list_.front();
+                    result = co_await client_socket.send({static_cast<const char *>(data), length}, length);
+                } else {
+                    result = co_await client_socket.send(iovec_list_);
+                }
+            }
+            if (result == -1) {
+                bytes_sent = -1;
+                break;
+            }
+            bytes_sent += result;
+        }
+
+        // 只清空内容，保留容量给之后的响应使用
+        arena_.clear();
+        arena_offset_ = 0;
+        segment_list_.clear();
+        response_list_.clear();
+        co_return bytes_sent;
+    }
+
+    void response_batch::close_arena_segment() {
+        if (arena_offset_ < arena_.size()) {
+            segment_list_.emplace_back(nullptr, arena_offset_, arena_.size() - arena_offset_, -1);
+            arena_offset_ = arena_.size();
+        }
+    }
+}
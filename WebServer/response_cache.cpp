@@ -0,0 +1,129 @@
+#include <string>
+#include <utility>
+#include "constant.h"
+#include "file_descriptor.h"
+#include "io_uring.h"
+#include "response_cache.h"
+#include "socket.h"
+
+namespace WebServer {
+    cached_response::cached_response(std::string data, const bool registered) : data_{std::move(data)} {
+        if (const size_t threshold = client_socket::get_zero_copy_threshold();
+                registered && threshold != 0 && data_.size() >= threshold) {
+            buffer_index_ = io_uring::get_instance().register_buffer(data_);
+        }
+    }
+
+    cached_response::~cached_response() {
+        if (buffer_index_ != -1) {
+            io_uring::get_instance().unregister_buffer(buffer_index_);
+        }
+    }
+
+    const std::string &cached_response::data() const noexcept { return data_; }
+
+    int cached_response::buffer_index() const noexcept { return buffer_index_; }
+
+    response_cache &response_cache::get_instance() noexcept {
+        thread_local response_cache instance;
+        return instance;
+    }
+
+    response_cache::load_awaiter::load_awaiter(load_state &load_state) : load_state_{load_state} {}
+
+    bool response_cache::load_awaiter::await_ready() const noexcept { return false; }
+
+    void response_cache::load_awaiter::await_suspend(std::coroutine_handle<> coroutine) const {
+        load_state_.waiting_coroutine_list.emplace_back(coroutine);
+    }
+
+    void response_cache::load_awaiter::await_resume() const noexcept {}
+
+    task<std::shared_ptr<const cached_response>> response_cache::get(
+            const std::filesystem::path &path, const file_cache::entry &file
+    ) {
+        const std::string key = path.native();
+
+        if (const auto iterator = cache_map_.find(key); iterator != cache_map_.end()) {
+            // ETag 没有变化，说明文件没有被修改过，缓存的响应仍然有效
+            if (iterator->second.entity_tag == file.entity_tag) {
+                ++hit_count_;
+                lru_list_.splice(lru_list_.begin(), lru_list_, iterator->second.lru_iterator);
+                co_return iterator->second.response;
+            }
+            erase(iterator);
+        }
+        ++miss_count_;
+
+        // 已经有协程在读取同一个版本的文件，等待它完成并直接使用它的结果
+        if (const auto iterator = load_state_map_.find(key);
+                iterator != load_state_map_.end() && iterator->second->entity_tag == file.entity_tag) {
+            const std::shared_ptr<load_state> state = iterator->second;
+            co_await load_awaiter(*state);
+            co_return state->response;
+        }
+
+        const auto state = std::make_shared<load_state>();
+        state->entity_tag = file.entity_tag;
+        load_state_map_[key] = state;
+
+        state->response = co_await load(file);
+
+        // 读取期间可能有一个更新版本的读取替换了这里的 load_state ，这时不能删除它
+        if (const auto iterator = load_state_map_.find(key);
+                iterator != load_state_map_.end() && iterator->second == state) {
+            load_state_map_.erase(iterator);
+        }
+        if (state->response != nullptr && !cache_map_.contains(key)) {
+            insert(key, cache_node{file.entity_tag, state->response, {}});
+        }
+
+        // 唤醒所有等待这次读取的协程
+        for (const std::coroutine_handle<> coroutine: std::exchange(state->waiting_coroutine_list, {})) {
+            coroutine.resume();
+        }
+        co_return state->response;
+    }
+
+    size_t response_cache::hit_count() const noexcept { return hit_count_; }
+
+    size_t response_cache::miss_count() const noexcept { return miss_count_; }
+
+    size_t response_cache::size() const noexcept { return size_; }
+
+    task<std::shared_ptr<const cached_response>> response_cache::load(const file_cache::entry &file) {
+        std::string data(file.size, '\0');
+
+        size_t bytes_read = 0;
+        while (bytes_read < file.size) {
+            const ssize_t result = co_await read_awaiter(
+                    file.file->get_raw_file_descriptor(), std::span<char>(data).subspan(bytes_read),
+                    static_cast<int64_t>(bytes_read)
+            );
+            // 返回 0 说明文件在读取过程中被截断了
+            if (result <= 0) {
+                co_return nullptr;
+            }
+            bytes_read += result;
+        }
+        co_return std::make_shared<const cached_response>(std::move(data), true);
+    }
+
+    void response_cache::insert(const std::string &path, cache_node cache_node) {
+        lru_list_.push_front(path);
+        cache_node.lru_iterator = lru_list_.begin();
+        size_ += cache_node.response->data().size() + RESPONSE_CACHE_NODE_SIZE;
+        cache_map_[path] = std::move(cache_node);
+
+        // 超出字节预算时淘汰最久没有使用的响应，正在发送中的响应由 shared_ptr 保证不会被提前释放
+        while (size_ > RESPONSE_CACHE_SIZE && !lru_list_.empty()) {
+            erase(cache_map_.find(lru_list_.back()));
+        }
+    }
+
+    void response_cache::erase(const std::unordered_map<std::string, cache_node>::iterator iterator) {
+        size_ -= iterator->second.response->data().size() + RESPONSE_CACHE_NODE_SIZE;
+        lru_list_.erase(iterator->second.lru_iterator);
+        cache_map_.erase(iterator);
+    }
+}
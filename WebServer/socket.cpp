@@ -1,9 +1,14 @@
+#include <algorithm>
+#include <cerrno>
 #include <cstring>
 #include <span>
 #include <stdexcept>
+#include <vector>
 #include <liburing/io_uring.h>
+#include <linux/filter.h>
 #include <netdb.h>
 
+#include "buffer_ring.h"
 #include "constant.h"
 #include "file_descriptor.h"
 #include "socket.h"
@@ -11,6 +16,8 @@
 namespace WebServer {
     server_socket::server_socket() = default;
 
+    server_socket::server_socket(const int raw_file_descriptor) : file_descriptor{raw_file_descriptor} {}
+
     void server_socket::bind(const char *port) {
         addrinfo address_hints;
         addrinfo *socket_address;
@@ -63,6 +70,38 @@ namespace WebServer {
         }
     }
 
+    bool server_socket::attach_reuseport_cpu_program(const std::span<const int> cpu_list) const {
+        if (!raw_file_descriptor_.has_value()) {
+            throw std::runtime_error("the file descriptor is invalid");
+        }
+
+        // 读取处理当前数据包的 CPU ，依次和每个套接字的 CPU 比较，返回第一个相同的套接字的下标
+        // 返回值超出组中套接字的数量时，内核退回到按照哈希选择套接字
+        std::vector<sock_filter> instruction_list;
+        instruction_list.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU)));
+        for (size_t socket_index = 0; socket_index < cpu_list.size(); ++socket_index) {
+            if (cpu_list[socket_index] < 0) {
+                continue;
+            }
+            instruction_list.push_back(
+                    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, static_cast<uint32_t>(cpu_list[socket_index]), 0, 1)
+            );
+            instruction_list.push_back(BPF_STMT(BPF_RET | BPF_K, static_cast<uint32_t>(socket_index)));
+        }
+        instruction_list.push_back(BPF_STMT(BPF_RET | BPF_K, static_cast<uint32_t>(cpu_list.size())));
+        if (instruction_list.size() > BPF_MAXINSNS) {
+            return false;
+        }
+
+        const sock_fprog program{
+                .len = static_cast<unsigned short>(instruction_list.size()),
+                .filter = instruction_list.data(),
+        };
+        return setsockopt(
+                raw_file_descriptor_.value(), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)
+        ) == 0;
+    }
+
     server_socket::multishot_accept_guard::multishot_accept_guard(
             const int raw_file_descriptor, sockaddr_storage *client_address,
             socklen_t *client_address_size
@@ -71,7 +110,9 @@ namespace WebServer {
               client_address_size_{client_address_size} {}
 
     server_socket::multishot_accept_guard::~multishot_accept_guard() {
-        io_uring::get_instance().submit_cancel_request(&sqe_data_);
+        if (!initial_await_ && !stopped_) {
+            io_uring::get_instance().submit_cancel_request(&sqe_data_);
+        }
     }
 
     bool server_socket::multishot_accept_guard::await_ready() const { return false; }
@@ -88,20 +129,40 @@ namespace WebServer {
         }
     }
 
+    // 返回新连接在固定文件表中的下标，失败时返回负数的错误码
     int server_socket::multishot_accept_guard::await_resume() {
         // 这个方法检查 sqe_data_.cqe_flags 是否包含 IORING_CQE_F_MORE 标志
         // 这个标志表示是否有更多的事件需要处理
         // 如果没有（即该标志位未被设置），那么会再次提交一个接收新连接的请求
+        // 请求已经被取消时不再重新提交
         if (!(sqe_data_.cqe_flags & IORING_CQE_F_MORE)) {
-            io_uring::get_instance().submit_multishot_accept_request(
-                    &sqe_data_, raw_file_descriptor_,
-                    reinterpret_cast<sockaddr *>(client_address_),
-                    client_address_size_
-            );
+            if (cancelled_) {
+                stopped_ = true;
+            } else {
+                io_uring::get_instance().submit_multishot_accept_request(
+                        &sqe_data_, raw_file_descriptor_,
+                        reinterpret_cast<sockaddr *>(client_address_),
+                        client_address_size_
+                );
+            }
         }
         return sqe_data_.cqe_res;
     }
 
+    void server_socket::multishot_accept_guard::cancel() {
+        if (cancelled_) {
+            return;
+        }
+        cancelled_ = true;
+        if (initial_await_) {
+            stopped_ = true;
+            return;
+        }
+        io_uring::get_instance().submit_cancel_request(&sqe_data_);
+    }
+
+    bool server_socket::multishot_accept_guard::is_stopped() const noexcept { return stopped_; }
+
     server_socket::multishot_accept_guard &
     server_socket::accept(sockaddr_storage *client_address, socklen_t *client_address_size) {
         if (!raw_file_descriptor_.has_value()) {
@@ -121,58 +182,379 @@ namespace WebServer {
         return multishot_accept_guard_.value();
     }
 
-    client_socket::client_socket(const int raw_file_descriptor)
-            : file_descriptor{raw_file_descriptor} {}
+    void server_socket::stop_accept() {
+        if (multishot_accept_guard_.has_value()) {
+            multishot_accept_guard_->cancel();
+        }
+    }
+
+    bool server_socket::is_accept_stopped() const noexcept {
+        return multishot_accept_guard_.has_value() && multishot_accept_guard_->is_stopped();
+    }
+
+    client_socket::client_socket(const int raw_file_descriptor, const bool fixed_file)
+            : file_descriptor{raw_file_descriptor} {
+        fixed_file_ = fixed_file;
+    }
+
+    client_socket::multishot_recv_guard::multishot_recv_guard(
+            const int raw_file_descriptor, const bool fixed_file
+    )
+            : raw_file_descriptor_{raw_file_descriptor}, fixed_file_{fixed_file},
+              recv_state_{std::make_unique<recv_state>()} {
+        recv_state_->recv_sqe_data.cqe_queue = &recv_state_->cqe_queue;
+        recv_state_->recv_request.recv_sqe_data = &recv_state_->recv_sqe_data;
+        recv_state_->recv_request.raw_file_descriptor = raw_file_descriptor;
+        recv_state_->recv_request.fixed_file = fixed_file;
+    }
+
+    client_socket::multishot_recv_guard::~multishot_recv_guard() {
+        if (recv_state_ == nullptr) {
+            return;
+        }
+        // 还在等待缓冲区的请求没有提交给内核，只需要移出等待队列
+        if (recv_state_->recv_request.waiting) {
+            buffer_ring::get_instance().cancel_recv(recv_state_->recv_request);
+            recv_state_->submitted = false;
+        }
+        if (!recv_state_->submitted && recv_state_->cqe_queue.empty()) {
+            return;
+        }
+        if (recv_state_->submitted) {
+            io_uring::get_instance().submit_cancel_request(&recv_state_->recv_sqe_data);
+        }
+        task<> drain_task = drain(std::move(recv_state_));
+        drain_task.resume();
+        drain_task.detach();
+    }
+
+    bool client_socket::multishot_recv_guard::await_ready() {
+        std::queue<std::tuple<int, unsigned int>> &cqe_queue = recv_state_->cqe_queue;
+        while (!cqe_queue.empty()) {
+            const int cqe_res = std::get<0>(cqe_queue.front());
+            if (cqe_res == -ENOBUFS) {
+                // 内核已经取完了这个组的缓冲区，下次提交时 buffer_ring 会选择其他的组，或者让请求等待缓冲区
+                buffer_ring::get_instance().report_exhausted(recv_state_->recv_request.buffer_group);
+            } else if (!(recv_state_->regrouping && cqe_res == -ECANCELED)) {
+                break;
+            }
+            cqe_queue.pop();
+            recv_state_->submitted = false;
+            recv_state_->regrouping = false;
+        }
+        return !cqe_queue.empty();
+    }
+
+    void client_socket::multishot_recv_guard::await_suspend(std::coroutine_handle<> coroutine) {
+        recv_state_->recv_sqe_data.coroutine = coroutine.address();
+        if (!recv_state_->submitted) {
+            buffer_ring::get_instance().submit_recv(
+                    recv_state_->recv_request, buffer_ring::select_size_class(recv_state_->recv_size)
+            );
+            recv_state_->submitted = true;
+        }
+    }
+
+    std::tuple<unsigned int, unsigned int, ssize_t> client_socket::multishot_recv_guard::await_resume() {
+        // 协程不再等待 recv ，之后到达的 CQE 只放入队列，不唤醒协程
+        recv_state_->recv_sqe_data.coroutine = nullptr;
+
+        const auto [cqe_res, cqe_flags] = recv_state_->cqe_queue.front();
+        recv_state_->cqe_queue.pop();
+
+        // 没有 IORING_CQE_F_MORE 标志说明请求已经结束，下次等待时需要重新提交
+        if (!(cqe_flags & IORING_CQE_F_MORE)) {
+            recv_state_->submitted = false;
+            recv_state_->regrouping = false;
+        }
+        buffer_ring &buffer_ring = buffer_ring::get_instance();
+        const unsigned int buffer_group = recv_state_->recv_request.buffer_group;
+        if (!(cqe_flags & IORING_CQE_F_BUFFER)) {
+            return {buffer_group, 0, cqe_res};
+        }
+
+        // 数据填满了缓冲区时，实际到达的数据很可能比缓冲区更大
+        const unsigned int size_class = buffer_ring.get_size_class(buffer_group);
+        const size_t buffer_size = BUFFER_SIZE_LIST[size_class];
+        const size_t recv_size = static_cast<size_t>(cqe_res) >= buffer_size ?
+                                 std::max<size_t>(cqe_res, buffer_size + 1) : cqe_res;
+        recv_state_->recv_size = std::max(recv_size, recv_state_->recv_size / 2);
+
+        // 当前的缓冲区组太小，数据被拆分到了多个缓冲区中，取消请求，之后用更大的缓冲区组重新提交
+        if (recv_state_->submitted && !recv_state_->regrouping &&
+            buffer_ring::select_size_class(recv_state_->recv_size) > size_class) {
+            io_uring::get_instance().submit_cancel_request(&recv_state_->recv_sqe_data);
+            recv_state_->regrouping = true;
+        }
+
+        const unsigned int buffer_id = cqe_flags >> IORING_CQE_BUFFER_SHIFT;
+        return {buffer_group, buffer_id, cqe_res};
+    }
+
+    task<> client_socket::multishot_recv_guard::stop() {
+        if (recv_state_->recv_request.waiting) {
+            buffer_ring::get_instance().cancel_recv(recv_state_->recv_request);
+            recv_state_->submitted = false;
+        }
+        if (!recv_state_->submitted) {
+            co_return;
+        }
+        io_uring::get_instance().submit_cancel_request(&recv_state_->recv_sqe_data);
+
+        // 请求的最后一个 CQE 没有 IORING_CQE_F_MORE 标志，它可能早于取消请求到达，也可能是取消产生的 -ECANCELED
+        std::queue<std::tuple<int, unsigned int>> &cqe_queue = recv_state_->cqe_queue;
+        while (cqe_queue.empty() || (std::get<1>(cqe_queue.back()) & IORING_CQE_F_MORE)) {
+            co_await cqe_awaiter(*recv_state_, cqe_queue.size());
+        }
+        recv_state_->submitted = false;
+        recv_state_->regrouping = false;
+
+        // 去掉取消产生的 CQE ，它不包含数据，不能让 recv() 把它当作连接出错
+        std::queue<std::tuple<int, unsigned int>> result_queue;
+        for (; !cqe_queue.empty(); cqe_queue.pop()) {
+            if (std::get<0>(cqe_queue.front()) != -ECANCELED) {
+                result_queue.emplace(cqe_queue.front());
+            }
+        }
+        cqe_queue.swap(result_queue);
+    }
+
+    bool client_socket::multishot_recv_guard::has_pending_result() const { return !recv_state_->cqe_queue.empty(); }
+
+    void client_socket::multishot_recv_guard::cancel() {
+        // 请求结束时的 -ECANCELED 需要返回给调用者，不能当作更换缓冲区组而跳过
+        recv_state_->regrouping = false;
+
+        // 还在等待缓冲区的请求没有提交给内核，用一个 nop 请求产生一个表示连接关闭的 CQE 来结束它
+        if (recv_state_->recv_request.waiting) {
+            buffer_ring::get_instance().cancel_recv(recv_state_->recv_request);
+            io_uring::get_instance().submit_nop_request(&recv_state_->recv_sqe_data);
+        } else if (recv_state_->submitted) {
+            io_uring::get_instance().submit_cancel_request(&recv_state_->recv_sqe_data);
+        }
+    }
+
+    client_socket::multishot_recv_guard::cqe_awaiter::cqe_awaiter(recv_state &recv_state, const size_t queue_size)
+            : recv_state_{recv_state}, queue_size_{queue_size} {}
+
+    bool client_socket::multishot_recv_guard::cqe_awaiter::await_ready() const {
+        return recv_state_.cqe_queue.size() > queue_size_;
+    }
+
+    void client_socket::multishot_recv_guard::cqe_awaiter::await_suspend(std::coroutine_handle<> coroutine) {
+        recv_state_.recv_sqe_data.coroutine = coroutine.address();
+    }
+
+    void client_socket::multishot_recv_guard::cqe_awaiter::await_resume() {
+        recv_state_.recv_sqe_data.coroutine = nullptr;
+    }
+
+    task<> client_socket::multishot_recv_guard::drain(std::unique_ptr<recv_state> recv_state) {
+        std::vector<buffer_ring::borrowed_buffer> buffer_list;
+        buffer_ring &buffer_ring = buffer_ring::get_instance();
+        // 请求已经被 stop() 结束时，只需要归还队列中剩下的缓冲区
+        while (recv_state->submitted || !recv_state->cqe_queue.empty()) {
+            co_await cqe_awaiter(*recv_state, 0);
+
+            const auto [cqe_res, cqe_flags] = recv_state->cqe_queue.front();
+            recv_state->cqe_queue.pop();
+
+            if ((cqe_flags & IORING_CQE_F_BUFFER) && cqe_res > 0) {
+                buffer_ring.borrow_buffer_list(
+                        recv_state->recv_request.buffer_group, cqe_flags >> IORING_CQE_BUFFER_SHIFT, cqe_res,
+                        buffer_list
+                );
+                for (const auto &[buffer_group, buffer_id, _]: buffer_list) {
+                    buffer_ring.return_buffer(buffer_group, buffer_id);
+                }
+            }
+            if (!(cqe_flags & IORING_CQE_F_MORE)) {
+                recv_state->submitted = false;
+            }
+        }
+    }
 
-    client_socket::recv_awaiter::recv_awaiter(const int raw_file_descriptor, const size_t length)
-            : raw_file_descriptor_{raw_file_descriptor}, length_{length} {}
+    client_socket::recv_awaiter::recv_awaiter(multishot_recv_guard &multishot_recv_guard)
+            : multishot_recv_guard_{multishot_recv_guard} {}
 
-    bool client_socket::recv_awaiter::await_ready() const { return false; }
+    bool client_socket::recv_awaiter::await_ready() const { return multishot_recv_guard_.await_ready(); }
 
     void client_socket::recv_awaiter::await_suspend(std::coroutine_handle<> coroutine) {
-        sqe_data_.coroutine = coroutine.address();
-        io_uring::get_instance().submit_recv_request(&sqe_data_, raw_file_descriptor_, length_);
+        multishot_recv_guard_.await_suspend(coroutine);
+    }
+
+    std::tuple<unsigned int, unsigned int, ssize_t> client_socket::recv_awaiter::await_resume() {
+        return multishot_recv_guard_.await_resume();
+    }
+
+    client_socket::recv_awaiter client_socket::recv() {
+        if (!raw_file_descriptor_.has_value()) {
+            throw std::runtime_error("the file descriptor is invalid");
+        }
+
+        // 第一次调用时才创建 multishot_recv_guard ，之后的调用都复用同一个请求
+        if (!multishot_recv_guard_.has_value()) {
+            multishot_recv_guard_.emplace(raw_file_descriptor_.value(), fixed_file_);
+        }
+        return recv_awaiter{multishot_recv_guard_.value()};
     }
 
-    std::tuple<unsigned int, ssize_t> client_socket::recv_awaiter::await_resume() {
-        if (sqe_data_.cqe_flags | IORING_CQE_F_BUFFER) {
-            const unsigned int buffer_id = sqe_data_.cqe_flags >> IORING_CQE_BUFFER_SHIFT;
-            return {buffer_id, sqe_data_.cqe_res};
+    task<> client_socket::stop_recv() {
+        if (multishot_recv_guard_.has_value()) {
+            co_await multishot_recv_guard_->stop();
         }
-        return {};
     }
 
-    client_socket::recv_awaiter client_socket::recv(const size_t length) {
-        if (raw_file_descriptor_.has_value()) {
-            return {raw_file_descriptor_.value(), length};
+    bool client_socket::has_received_data() const {
+        return multishot_recv_guard_.has_value() && multishot_recv_guard_->has_pending_result();
+    }
+
+    void client_socket::cancel() {
+        if (!raw_file_descriptor_.has_value()) {
+            return;
+        }
+        if (multishot_recv_guard_.has_value()) {
+            multishot_recv_guard_->cancel();
         }
-        throw std::runtime_error("the file descriptor is invalid");
+        io_uring::get_instance().submit_cancel_file_descriptor_request(raw_file_descriptor_.value(), fixed_file_);
+    }
+
+    client_socket::connect_awaiter::connect_awaiter(
+            const int raw_file_descriptor, const sockaddr *address, const socklen_t address_size
+    )
+            : raw_file_descriptor_{raw_file_descriptor}, address_{address}, address_size_{address_size} {}
+
+    bool client_socket::connect_awaiter::await_ready() const { return false; }
+
+    void client_socket::connect_awaiter::await_suspend(std::coroutine_handle<> coroutine) {
+        sqe_data_.coroutine = coroutine.address();
+
+        io_uring::get_instance().submit_connect_request(
+                &sqe_data_, raw_file_descriptor_, address_, address_size_
+        );
+    }
+
+    int client_socket::connect_awaiter::await_resume() const { return sqe_data_.cqe_res; }
+
+    client_socket::connect_awaiter client_socket::connect(const sockaddr *address, const socklen_t address_size) {
+        if (!raw_file_descriptor_.has_value() || fixed_file_) {
+            throw std::runtime_error("the file descriptor is invalid");
+        }
+        return connect_awaiter{raw_file_descriptor_.value(), address, address_size};
     }
 
     client_socket::send_awaiter::send_awaiter(
-            const int raw_file_descriptor, const std::span<char> &buffer, const size_t length
+            const int raw_file_descriptor, const bool fixed_file, const std::span<const char> buffer,
+            const size_t length
     )
-            : raw_file_descriptor_{raw_file_descriptor}, length_{length}, buffer_{buffer} {};
+            : raw_file_descriptor_{raw_file_descriptor}, fixed_file_{fixed_file}, length_{length},
+              buffer_{buffer} {};
 
     bool client_socket::send_awaiter::await_ready() const { return false; }
 
     void client_socket::send_awaiter::await_suspend(std::coroutine_handle<> coroutine) {
         sqe_data_.coroutine = coroutine.address();
 
-        io_uring::get_instance().submit_send_request(&sqe_data_, raw_file_descriptor_, buffer_, length_);
+        io_uring::get_instance().submit_send_request(
+                &sqe_data_, raw_file_descriptor_, fixed_file_, buffer_, length_
+        );
     }
 
     ssize_t client_socket::send_awaiter::await_resume() const { return sqe_data_.cqe_res; }
 
-    task<ssize_t> client_socket::send(const std::span<char> &buffer, const size_t length) {
+    client_socket::sendmsg_awaiter::sendmsg_awaiter(
+            const int raw_file_descriptor, const bool fixed_file, const std::span<iovec> iovec_list
+    )
+            : raw_file_descriptor_{raw_file_descriptor}, fixed_file_{fixed_file} {
+        message_.msg_iov = iovec_list.data();
+        message_.msg_iovlen = iovec_list.size();
+    }
+
+    bool client_socket::sendmsg_awaiter::await_ready() const { return false; }
+
+    void client_socket::sendmsg_awaiter::await_suspend(std::coroutine_handle<> coroutine) {
+        sqe_data_.coroutine = coroutine.address();
+
+        io_uring::get_instance().submit_sendmsg_request(&sqe_data_, raw_file_descriptor_, fixed_file_, &message_);
+    }
+
+    ssize_t client_socket::sendmsg_awaiter::await_resume() const { return sqe_data_.cqe_res; }
+
+    client_socket::send_zc_awaiter::send_zc_awaiter(
+            const int raw_file_descriptor, const bool fixed_file, const std::span<const char> buffer,
+            const size_t length, const int buffer_index
+    )
+            : raw_file_descriptor_{raw_file_descriptor}, fixed_file_{fixed_file}, length_{length},
+              buffer_{buffer}, buffer_index_{buffer_index} {}
+
+    bool client_socket::send_zc_awaiter::await_ready() const { return false; }
+
+    void client_socket::send_zc_awaiter::await_suspend(std::coroutine_handle<> coroutine) {
+        sqe_data_.coroutine = coroutine.address();
+
+        // 通知的 CQE 和发送结果的 CQE 使用同一个 sqe_data ，所以再次等待时不需要提交新的请求
+        if (!submitted_) {
+            io_uring::get_instance().submit_send_zc_request(
+                    &sqe_data_, raw_file_descriptor_, fixed_file_, buffer_, length_, buffer_index_
+            );
+            submitted_ = true;
+        }
+    }
+
+    ssize_t client_socket::send_zc_awaiter::await_resume() {
+        if (!(sqe_data_.cqe_flags & IORING_CQE_F_NOTIF)) {
+            result_ = sqe_data_.cqe_res;
+        }
+        return result_;
+    }
+
+    bool client_socket::send_zc_awaiter::has_pending_notification() const {
+        return sqe_data_.cqe_flags & IORING_CQE_F_MORE;
+    }
+
+    // 零拷贝 send 的阈值，只在启动线程池之前修改
+    size_t zero_copy_threshold = ZERO_COPY_SEND_THRESHOLD;
+
+    void client_socket::set_zero_copy_threshold(const size_t threshold) noexcept { zero_copy_threshold = threshold; }
+
+    size_t client_socket::get_zero_copy_threshold() noexcept { return zero_copy_threshold; }
+
+    task<ssize_t> client_socket::send(
+            const std::span<const char> buffer, const size_t length, const int buffer_index
+    ) {
         if (!raw_file_descriptor_.has_value()) {
             throw std::runtime_error("the file descriptor is invalid");
         }
 
+        // 内核或者套接字不支持零拷贝时，当前线程之后都只使用普通的 send
+        thread_local bool zero_copy_supported = true;
+
         size_t bytes_sent = 0;
         while (bytes_sent < length) {
-            ssize_t result =
-                    co_await send_awaiter(raw_file_descriptor_.value(), buffer.subspan(bytes_sent), length);
+            const std::span<const char> remaining_buffer = buffer.subspan(bytes_sent);
+            const size_t remaining_length = length - bytes_sent;
+
+            ssize_t result;
+            if (zero_copy_supported && zero_copy_threshold != 0 && remaining_length >= zero_copy_threshold) {
+                send_zc_awaiter send_zc_awaiter(
+                        raw_file_descriptor_.value(), fixed_file_, remaining_buffer, remaining_length, buffer_index
+                );
+                result = co_await send_zc_awaiter;
+
+                // 必须等到内核释放 buffer 之后再返回，否则调用者可能会修改或释放正在发送的数据
+                if (send_zc_awaiter.has_pending_notification()) {
+                    co_await send_zc_awaiter;
+                }
+                if (result == -EOPNOTSUPP) {
+                    zero_copy_supported = false;
+                    continue;
+                }
+            } else {
+                result = co_await send_awaiter(
+                        raw_file_descriptor_.value(), fixed_file_, remaining_buffer, remaining_length
+                );
+            }
+
             if (result < 0) {
                 co_return -1;
             }
@@ -181,4 +563,35 @@ namespace WebServer {
         co_return bytes_sent;
     }
 
-} 
\ No newline at end of file
+    task<ssize_t> client_socket::send(const std::span<iovec> iovec_list) {
+        if (!raw_file_descriptor_.has_value()) {
+            throw std::runtime_error("the file descriptor is invalid");
+        }
+
+        size_t bytes_sent = 0;
+        std::span<iovec> remaining_iovec_list = iovec_list;
+        while (!remaining_iovec_list.empty()) {
+            const ssize_t result = co_await sendmsg_awaiter(
+                    raw_file_descriptor_.value(), fixed_file_, remaining_iovec_list
+            );
+            if (result < 0) {
+                co_return -1;
+            }
+            bytes_sent += result;
+
+            // 只发送了一部分时，跳过已经发送完的缓冲区，并调整第一个没有发送完的缓冲区
+            auto remaining_size = static_cast<size_t>(result);
+            while (!remaining_iovec_list.empty() && remaining_size >= remaining_iovec_list.front().iov_len) {
+                remaining_size -= remaining_iovec_list.front().iov_len;
+                remaining_iovec_list = remaining_iovec_list.subspan(1);
+            }
+            if (remaining_size > 0) {
+                iovec &front = remaining_iovec_list.front();
+                front.iov_base = static_cast<char *>(front.iov_base) + remaining_size;
+                front.iov_len -= remaining_size;
+            }
+        }
+        co_return bytes_sent;
+    }
+
+}
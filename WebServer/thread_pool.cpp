@@ -1,15 +1,66 @@
+#include <climits>
+#include <cstdint>
+#include <mutex>
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #include "thread_pool.h"
 
 namespace WebServer {
+    // 当前线程所属的线程池和它在线程池中的下标，不属于任何线程池时为 nullptr
+    thread_local thread_pool *current_thread_pool = nullptr;
+    thread_local size_t current_worker_index = 0;
+
+    void futex_wait(std::atomic<uint32_t> &futex, const uint32_t expected) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&futex), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+    }
+
+    void futex_wake(std::atomic<uint32_t> &futex, const int count) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&futex), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+    }
+
+    // xorshift 伪随机数，只用来选择窃取的起点
+    size_t random_index(const size_t bound) {
+        thread_local uint64_t state = reinterpret_cast<uintptr_t>(&state) | 1;
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state % bound;
+    }
+
     thread_pool::thread_pool(const std::size_t thread_count) {
-        for (size_t _ = 0; _ < thread_count; ++_) {
-            thread_list_.emplace_back([&]() { thread_loop(); });
+        // 只使用进程允许使用的 CPU ，比如容器中通过 cpuset 限制的 CPU
+        std::vector<int> allowed_cpu_list;
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &cpu_set)) {
+                    allowed_cpu_list.emplace_back(cpu);
+                }
+            }
+        }
+
+        for (size_t worker_index = 0; worker_index < thread_count; ++worker_index) {
+            worker_list_.emplace_back(std::make_unique<worker>());
+            cpu_list_.emplace_back(
+                    allowed_cpu_list.empty() ? -1 : allowed_cpu_list[worker_index % allowed_cpu_list.size()]
+            );
+        }
+        for (size_t worker_index = 0; worker_index < thread_count; ++worker_index) {
+            thread_list_.emplace_back([this, worker_index]() { thread_loop(worker_index); });
         }
     }
 
     thread_pool::~thread_pool() {
         stop_source_.request_stop();
-        condition_variable_.notify_all();
+        for (const auto &worker: worker_list_) {
+            worker->parked.store(0, std::memory_order_seq_cst);
+            futex_wake(worker->parked, INT_MAX);
+        }
     }
 
     thread_pool::schedule_awaiter::schedule_awaiter(thread_pool &thread_pool)
@@ -27,33 +78,146 @@ namespace WebServer {
 
     size_t thread_pool::size() const noexcept { return thread_list_.size(); }
 
-    // 生产者消费者模式，
-    void thread_pool::thread_loop() {
+    int thread_pool::get_cpu(const size_t worker_index) const noexcept { return cpu_list_[worker_index]; }
+
+    size_t thread_pool::get_current_worker_index() noexcept { return current_worker_index; }
+
+    void thread_pool::pin_current_thread(const int cpu) {
+        if (cpu == -1) {
+            return;
+        }
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(cpu, &cpu_set);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+
+        // 这个线程之后创建的 io_uring 、缓冲区环和协程帧都只在这个线程上使用
+        // MPOL_LOCAL 让它们分配在当前 CPU 所在的节点上，即使进程的默认策略是交错分配
+        // 不支持 NUMA 的内核会返回 ENOSYS ，这时所有的内存本来就是本地的
+        syscall(SYS_set_mempolicy, MPOL_LOCAL, nullptr, 0);
+    }
+
+    void thread_pool::thread_loop(const size_t worker_index) {
+        current_thread_pool = this;
+        current_worker_index = worker_index;
+        pin_current_thread(cpu_list_[worker_index]);
 
-        // 首先检查stop_source_以确定是否被请求停止
-        // 如果没有被请求停止，线程将进入等待状态
-        // 等待新的协程被添加到队列中或者被请求停止，就唤醒线程
         while (!stop_source_.stop_requested()) {
-            std::unique_lock lock(mutex_);
-            condition_variable_.wait(lock, [this]() {
-                return stop_source_.stop_requested() || !coroutine_queue_.empty();
-            });
-            if (stop_source_.stop_requested()) {
-                break;
+            if (const std::coroutine_handle<> coroutine = find_coroutine(worker_index); coroutine != nullptr) {
+                coroutine.resume();
+            } else {
+                park(worker_index);
             }
+        }
+    }
 
-            // 线程将从队列中取出一个协程，解锁并执行
-            const std::coroutine_handle<> coroutine = coroutine_queue_.front();
-            coroutine_queue_.pop();
-            lock.unlock();
+    std::coroutine_handle<> thread_pool::find_coroutine(const size_t worker_index) {
+        worker &worker = *worker_list_[worker_index];
+        if (void *const coroutine_address = worker.lifo_slot.exchange(nullptr, std::memory_order_acquire)) {
+            return std::coroutine_handle<>::from_address(coroutine_address);
+        }
+        if (const std::coroutine_handle<> coroutine = worker.deque.pop(); coroutine != nullptr) {
+            return coroutine;
+        }
+        if (injection_count_.load(std::memory_order_acquire) > 0) {
+            std::lock_guard lock(injection_mutex_);
+            if (!injection_queue_.empty()) {
+                const std::coroutine_handle<> coroutine = injection_queue_.front();
+                injection_queue_.pop_front();
+                injection_count_.fetch_sub(1, std::memory_order_relaxed);
+                return coroutine;
+            }
+        }
+        return steal_coroutine(worker_index);
+    }
 
-            coroutine.resume();
+    std::coroutine_handle<> thread_pool::steal_coroutine(const size_t worker_index) {
+        const size_t worker_count = worker_list_.size();
+        const size_t start_index = random_index(worker_count);
+        for (size_t offset = 0; offset < worker_count; ++offset) {
+            const size_t victim_index = (start_index + offset) % worker_count;
+            if (victim_index == worker_index) {
+                continue;
+            }
+            worker &victim = *worker_list_[victim_index];
+            if (const std::coroutine_handle<> coroutine = victim.deque.steal(); coroutine != nullptr) {
+                return coroutine;
+            }
+            // 队列为空时才窃取 LIFO 槽，防止正在运行一个很长的协程的线程饿死它
+            if (victim.lifo_slot.load(std::memory_order_relaxed) != nullptr) {
+                if (void *const coroutine_address = victim.lifo_slot.exchange(nullptr, std::memory_order_acquire)) {
+                    return std::coroutine_handle<>::from_address(coroutine_address);
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    bool thread_pool::has_coroutine() const {
+        if (injection_count_.load(std::memory_order_acquire) > 0) {
+            return true;
+        }
+        for (const auto &worker: worker_list_) {
+            if (!worker->deque.empty() || worker->lifo_slot.load(std::memory_order_acquire) != nullptr) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void thread_pool::park(const size_t worker_index) {
+        worker &worker = *worker_list_[worker_index];
+
+        // 先声明自己将要休眠，再做最后一次检查。和 enqueue() 中先加入队列、再检查 parked_count_ 的顺序配合
+        // 两边都使用 seq_cst ，保证不会出现协程已经入队、但是所有的线程都没有看到它而休眠的情况
+        worker.parked.store(1, std::memory_order_seq_cst);
+        parked_count_.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (stop_source_.stop_requested() || has_coroutine()) {
+            // 如果唤醒者已经把 parked 改为 0 ，它也已经减少了 parked_count_
+            if (worker.parked.exchange(0, std::memory_order_seq_cst) == 1) {
+                parked_count_.fetch_sub(1, std::memory_order_seq_cst);
+            }
+            return;
+        }
+
+        while (worker.parked.load(std::memory_order_acquire) == 1 && !stop_source_.stop_requested()) {
+            futex_wait(worker.parked, 1);
+        }
+    }
+
+    void thread_pool::wake_one() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (parked_count_.load(std::memory_order_seq_cst) == 0) {
+            return;
+        }
+
+        const size_t worker_count = worker_list_.size();
+        const size_t start_index = random_index(worker_count);
+        for (size_t offset = 0; offset < worker_count; ++offset) {
+            worker &worker = *worker_list_[(start_index + offset) % worker_count];
+            uint32_t expected = 1;
+            if (worker.parked.compare_exchange_strong(expected, 0, std::memory_order_seq_cst)) {
+                parked_count_.fetch_sub(1, std::memory_order_seq_cst);
+                futex_wake(worker.parked, 1);
+                return;
+            }
         }
     }
 
     void thread_pool::enqueue(std::coroutine_handle<> coroutine) {
-        std::unique_lock lock(mutex_);
-        coroutine_queue_.emplace(coroutine);
-        condition_variable_.notify_one();
+        if (current_thread_pool == this) {
+            // 新的协程放入 LIFO 槽，原来在 LIFO 槽中的协程移到自己的队列中
+            worker &worker = *worker_list_[current_worker_index];
+            if (void *const previous = worker.lifo_slot.exchange(coroutine.address(), std::memory_order_acq_rel)) {
+                worker.deque.push(std::coroutine_handle<>::from_address(previous));
+            }
+        } else {
+            std::lock_guard lock(injection_mutex_);
+            injection_queue_.emplace_back(coroutine);
+            injection_count_.fetch_add(1, std::memory_order_release);
+        }
+        wake_one();
     }
 }
@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <chrono>
+#include <utility>
+#include "timer_wheel.h"
+
+namespace WebServer {
+    timer_wheel::timer::timer(std::function<void()> callback) : callback_{std::move(callback)} {}
+
+    timer_wheel::timer::~timer() { stop(); }
+
+    void timer_wheel::timer::start(const std::chrono::milliseconds timeout) {
+        timeout_ = timeout;
+        restart();
+    }
+
+    void timer_wheel::timer::restart() {
+        timer_wheel &timer_wheel = timer_wheel::get_instance();
+        if (linked_) {
+            timer_wheel.remove(*this);
+        }
+        if (timeout_.count() <= 0) {
+            return;
+        }
+        // 向上取整，定时器不会早于 timeout 到期，最多晚一个 tick
+        const uint64_t tick_count = (timeout_ + TIMER_WHEEL_TICK - std::chrono::milliseconds(1)) / TIMER_WHEEL_TICK;
+        expire_tick_ = get_current_tick() + std::max<uint64_t>(tick_count, 1);
+        timer_wheel.insert(*this);
+    }
+
+    void timer_wheel::timer::stop() {
+        if (linked_) {
+            timer_wheel::get_instance().remove(*this);
+        }
+    }
+
+    bool timer_wheel::timer::is_expired() const noexcept { return expired_; }
+
+    timer_wheel &timer_wheel::get_instance() noexcept {
+        thread_local timer_wheel instance;
+        return instance;
+    }
+
+    task<> timer_wheel::run() {
+        current_tick_ = get_current_tick();
+        while (true) {
+            if (timer_count_ == 0) {
+                co_await idle_awaiter(*this);
+                // 空闲期间没有定时器，跳过的 tick 都不需要处理
+                current_tick_ = get_current_tick();
+            }
+            co_await tick_awaiter();
+            expire(get_current_tick());
+        }
+    }
+
+    timer_wheel::tick_awaiter::tick_awaiter() {
+        const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(TIMER_WHEEL_TICK).count();
+        timeout_.tv_sec = nanoseconds / 1'000'000'000;
+        timeout_.tv_nsec = nanoseconds % 1'000'000'000;
+    }
+
+    bool timer_wheel::tick_awaiter::await_ready() const noexcept { return false; }
+
+    void timer_wheel::tick_awaiter::await_suspend(std::coroutine_handle<> coroutine) {
+        sqe_data_.coroutine = coroutine.address();
+        io_uring::get_instance().submit_timeout_request(&sqe_data_, &timeout_);
+    }
+
+    void timer_wheel::tick_awaiter::await_resume() const noexcept {}
+
+    timer_wheel::idle_awaiter::idle_awaiter(timer_wheel &timer_wheel) : timer_wheel_{timer_wheel} {}
+
+    bool timer_wheel::idle_awaiter::await_ready() const noexcept { return timer_wheel_.timer_count_ > 0; }
+
+    void timer_wheel::idle_awaiter::await_suspend(std::coroutine_handle<> coroutine) const noexcept {
+        timer_wheel_.idle_coroutine_ = coroutine;
+    }
+
+    void timer_wheel::idle_awaiter::await_resume() const noexcept {}
+
+    uint64_t timer_wheel::get_current_tick() noexcept {
+        const auto now = std::chrono::steady_clock::now().time_since_epoch();
+        return std::chrono::duration_cast<std::chrono::milliseconds>(now) / TIMER_WHEEL_TICK;
+    }
+
+    void timer_wheel::insert(timer &timer) {
+        timer_node &slot = slot_list_[timer.expire_tick_ % TIMER_WHEEL_SIZE];
+        timer.previous = slot.previous;
+        timer.next = &slot;
+        slot.previous->next = &timer;
+        slot.previous = &timer;
+        timer.linked_ = true;
+
+        // 第一个定时器开始计时，唤醒 run() 开始提交 timeout 请求
+        if (++timer_count_ == 1 && idle_coroutine_ != nullptr) {
+            std::exchange(idle_coroutine_, nullptr).resume();
+        }
+    }
+
+    void timer_wheel::remove(timer &timer) {
+        timer.previous->next = timer.next;
+        timer.next->previous = timer.previous;
+        timer.previous = &timer;
+        timer.next = &timer;
+        timer.linked_ = false;
+        --timer_count_;
+    }
+
+    void timer_wheel::expire(const uint64_t tick) {
+        // 事件循环可能被阻塞了多个 tick ，这时需要依次处理跳过的槽，超过一圈时每个槽只需要处理一次
+        const uint64_t last_tick = std::min(tick, current_tick_ + TIMER_WHEEL_SIZE);
+        for (; current_tick_ < last_tick; ++current_tick_) {
+            timer_node &slot = slot_list_[(current_tick_ + 1) % TIMER_WHEEL_SIZE];
+            if (slot.next == &slot) {
+                continue;
+            }
+
+            // 把整个槽移到 expiring_list_ 中，再逐个取出：没有到期的放回槽中，到期的调用 callback
+            expiring_list_.next = slot.next;
+            expiring_list_.previous = slot.previous;
+            slot.next->previous = &expiring_list_;
+            slot.previous->next = &expiring_list_;
+            slot.next = &slot;
+            slot.previous = &slot;
+
+            while (expiring_list_.next != &expiring_list_) {
+                timer &timer = static_cast<class timer &>(*expiring_list_.next);
+                remove(timer);
+                if (timer.expire_tick_ > tick) {
+                    insert(timer);
+                    continue;
+                }
+                timer.expired_ = true;
+                timer.callback_();
+            }
+        }
+        current_tick_ = tick;
+    }
+}
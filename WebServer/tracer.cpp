@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <fstream>
+#include <string_view>
+#include <vector>
+#include "tracer.h"
+
+namespace WebServer {
+    std::atomic<size_t> trace_sample_interval = 0;
+
+    // steady_clock 的纳秒数
+    uint64_t to_nanoseconds(const std::chrono::steady_clock::time_point time_point) noexcept {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time_point.time_since_epoch()).count();
+    }
+
+    // Chrome trace 的时间单位是微秒，保留三位小数，也就是精确到纳秒
+    void append_microseconds(std::string &result, const uint64_t nanoseconds) {
+        result.append(std::to_string(nanoseconds / 1000));
+        result.push_back('.');
+        const std::string fraction = std::to_string(nanoseconds % 1000);
+        result.append(3 - fraction.size(), '0');
+        result.append(fraction);
+    }
+
+    tracer::trace_buffer::trace_buffer(const size_t worker_count) : worker_count_{worker_count} {
+        if (trace_sample_interval.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        ring_list_ = std::make_unique<trace_ring[]>(worker_count);
+        for (size_t worker_index = 0; worker_index < worker_count; ++worker_index) {
+            ring_list_[worker_index].event_list = std::make_unique<trace_event[]>(TRACE_RING_SIZE);
+        }
+    }
+
+    tracer::trace_ring *tracer::trace_buffer::get_ring(const size_t worker_index) const noexcept {
+        return ring_list_ != nullptr ? &ring_list_[worker_index] : nullptr;
+    }
+
+    std::string tracer::trace_buffer::format() const {
+        std::string result = R"({"displayTimeUnit":"ns","traceEvents":[)";
+        bool first = true;
+        const auto begin_event = [&result, &first]() {
+            if (!first) {
+                result.push_back(',');
+            }
+            result.append("\n");
+            first = false;
+        };
+
+        class event_copy {
+        public:
+            const char *name;
+            uint64_t start;
+            uint64_t end;
+            uint64_t connection_id;
+            uint64_t request_id;
+        };
+        std::vector<event_copy> event_list;
+
+        for (size_t worker_index = 0; worker_index < worker_count_ && ring_list_ != nullptr; ++worker_index) {
+            begin_event();
+            result.append(R"({"name":"process_name","ph":"M","pid":)");
+            result.append(std::to_string(worker_index));
+            result.append(R"(,"args":{"name":"worker )");
+            result.append(std::to_string(worker_index));
+            result.append(R"("}})");
+
+            // 先复制，再检查复制期间写入线程是否已经覆盖了这些事件，被覆盖的事件可能是不完整的
+            const trace_ring &ring = ring_list_[worker_index];
+            const uint64_t end = ring.write_index.load(std::memory_order_acquire);
+            const uint64_t begin = end > TRACE_RING_SIZE ? end - TRACE_RING_SIZE : 0;
+            event_list.clear();
+            for (uint64_t index = begin; index < end; ++index) {
+                const trace_event &event = ring.event_list[index & (TRACE_RING_SIZE - 1)];
+                event_list.emplace_back(
+                        event.name.load(std::memory_order_relaxed), event.start.load(std::memory_order_relaxed),
+                        event.end.load(std::memory_order_relaxed), event.connection_id.load(std::memory_order_relaxed),
+                        event.request_id.load(std::memory_order_relaxed)
+                );
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            // 写入线程正在写的事件会覆盖 write_index - TRACE_RING_SIZE ，所以它也不再有效
+            const uint64_t current_end = ring.write_index.load(std::memory_order_relaxed);
+            const uint64_t valid_begin = current_end + 1 > TRACE_RING_SIZE ? current_end + 1 - TRACE_RING_SIZE : 0;
+
+            for (uint64_t index = std::max(begin, valid_begin); index < end; ++index) {
+                const event_copy &event = event_list[index - begin];
+                begin_event();
+                result.append(R"({"name":")");
+                result.append(event.name);
+                result.append(R"(","cat":"request","ph":"X","pid":)");
+                result.append(std::to_string(worker_index));
+                result.append(R"(,"tid":)");
+                result.append(std::to_string(event.connection_id));
+                result.append(R"(,"ts":)");
+                append_microseconds(result, event.start);
+                result.append(R"(,"dur":)");
+                append_microseconds(result, event.end - event.start);
+                result.append(R"(,"args":{"request":)");
+                result.append(std::to_string(event.request_id));
+                result.append("}}");
+            }
+        }
+        result.append("\n]}\n");
+        return result;
+    }
+
+    bool tracer::trace_buffer::dump(const std::filesystem::path &path) const {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        const std::string trace = format();
+        file.write(trace.data(), static_cast<std::streamsize>(trace.size()));
+        return file.good();
+    }
+
+    void tracer::enable(const size_t sample_interval) noexcept {
+        trace_sample_interval.store(sample_interval, std::memory_order_relaxed);
+    }
+
+    tracer &tracer::get_instance() noexcept {
+        thread_local tracer instance;
+        return instance;
+    }
+
+    void tracer::attach(const trace_buffer &trace_buffer, const size_t worker_index) noexcept {
+        trace_buffer_ = &trace_buffer;
+        trace_ring_ = trace_buffer.get_ring(worker_index);
+        sample_interval_ = trace_sample_interval.load(std::memory_order_relaxed);
+    }
+
+    uint64_t tracer::next_connection_id() noexcept { return ++connection_count_; }
+
+    uint64_t tracer::sample() noexcept {
+        if (trace_ring_ == nullptr) {
+            return 0;
+        }
+        ++request_count_;
+        return request_count_ % sample_interval_ == 0 ? request_count_ : 0;
+    }
+
+    void tracer::record(
+            const char *name, const uint64_t connection_id, const uint64_t request_id,
+            const std::chrono::steady_clock::time_point start
+    ) noexcept {
+        if (request_id != 0) {
+            record(name, connection_id, request_id, start, std::chrono::steady_clock::now());
+        }
+    }
+
+    void tracer::record(
+            const char *name, const uint64_t connection_id, const uint64_t request_id,
+            const std::chrono::steady_clock::time_point start, const std::chrono::steady_clock::time_point end
+    ) noexcept {
+        if (request_id == 0 || trace_ring_ == nullptr) {
+            return;
+        }
+        // 只有当前线程写入，和 format() 中的 acquire 栅栏配对：
+        // 读取线程看到了这个事件的任何一个字段，就一定能看到之前的 write_index ，从而知道旧的事件已经被覆盖
+        const uint64_t index = trace_ring_->write_index.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        trace_event &event = trace_ring_->event_list[index & (TRACE_RING_SIZE - 1)];
+        event.name.store(name, std::memory_order_relaxed);
+        event.start.store(to_nanoseconds(start), std::memory_order_relaxed);
+        event.end.store(to_nanoseconds(end), std::memory_order_relaxed);
+        event.connection_id.store(connection_id, std::memory_order_relaxed);
+        event.request_id.store(request_id, std::memory_order_relaxed);
+        trace_ring_->write_index.store(index + 1, std::memory_order_release);
+    }
+
+    std::chrono::steady_clock::time_point tracer::now_if(const uint64_t request_id) noexcept {
+        return request_id != 0 ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+    }
+
+    std::string tracer::format() const {
+        if (trace_buffer_ == nullptr) {
+            return trace_buffer{0}.format();
+        }
+        return trace_buffer_->format();
+    }
+}
@@ -0,0 +1,88 @@
+#include "constant.h"
+#include "work_stealing_deque.h"
+
+namespace WebServer {
+    work_stealing_deque::ring::ring(const size_t capacity) : element_list_(capacity) {}
+
+    size_t work_stealing_deque::ring::capacity() const noexcept { return element_list_.size(); }
+
+    void *work_stealing_deque::ring::load(const int64_t index) const noexcept {
+        return element_list_[index & (element_list_.size() - 1)].load(std::memory_order_relaxed);
+    }
+
+    void work_stealing_deque::ring::store(const int64_t index, void *const coroutine_address) noexcept {
+        element_list_[index & (element_list_.size() - 1)].store(coroutine_address, std::memory_order_relaxed);
+    }
+
+    work_stealing_deque::work_stealing_deque() {
+        ring_list_.emplace_back(std::make_unique<ring>(WORK_STEALING_DEQUE_SIZE));
+        ring_.store(ring_list_.back().get(), std::memory_order_relaxed);
+    }
+
+    void work_stealing_deque::push(const std::coroutine_handle<> coroutine) {
+        const int64_t bottom = bottom_.load(std::memory_order_relaxed);
+        const int64_t top = top_.load(std::memory_order_acquire);
+        ring *current_ring = ring_.load(std::memory_order_relaxed);
+
+        // 队列已满，把元素复制到一个两倍容量的新数组中
+        if (bottom - top > static_cast<int64_t>(current_ring->capacity()) - 1) {
+            auto new_ring = std::make_unique<ring>(current_ring->capacity() * 2);
+            for (int64_t index = top; index < bottom; ++index) {
+                new_ring->store(index, current_ring->load(index));
+            }
+            current_ring = new_ring.get();
+            ring_list_.emplace_back(std::move(new_ring));
+            ring_.store(current_ring, std::memory_order_release);
+        }
+
+        current_ring->store(bottom, coroutine.address());
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+    }
+
+    std::coroutine_handle<> work_stealing_deque::pop() {
+        const int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+        ring *const current_ring = ring_.load(std::memory_order_relaxed);
+        bottom_.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = top_.load(std::memory_order_relaxed);
+
+        if (top > bottom) {
+            // 队列为空，恢复 bottom_
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        void *coroutine_address = current_ring->load(bottom);
+        if (top == bottom) {
+            // 只剩最后一个元素，和窃取的线程竞争
+            if (!top_.compare_exchange_strong(
+                    top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed
+            )) {
+                coroutine_address = nullptr;
+            }
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+        }
+        return std::coroutine_handle<>::from_address(coroutine_address);
+    }
+
+    std::coroutine_handle<> work_stealing_deque::steal() {
+        int64_t top = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t bottom = bottom_.load(std::memory_order_acquire);
+
+        if (top >= bottom) {
+            return nullptr;
+        }
+
+        void *const coroutine_address = ring_.load(std::memory_order_acquire)->load(top);
+        if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return std::coroutine_handle<>::from_address(coroutine_address);
+    }
+
+    bool work_stealing_deque::empty() const noexcept {
+        return top_.load(std::memory_order_acquire) >= bottom_.load(std::memory_order_acquire);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef BENCH_CONSTANT_H
+#define BENCH_CONSTANT_H
+
+#include <chrono>
+#include <cstddef>
+
+namespace WebServer {
+
+    // 响应头的最大长度，超过时认为响应格式错误
+    constexpr size_t MAX_RESPONSE_HEADER_SIZE = 64 * 1024;
+
+    // 默认的压测参数
+    constexpr std::chrono::seconds DEFAULT_BENCH_DURATION{10};
+
+    constexpr size_t DEFAULT_BENCH_CONNECTION_COUNT = 64;
+
+    // 一个请求等待响应的最长时间，超过之后关闭连接并记为超时
+    constexpr std::chrono::seconds DEFAULT_BENCH_REQUEST_TIMEOUT{10};
+
+    // 微基准重复运行的轮数，报告最好的一轮，减少其他进程的干扰
+    constexpr size_t DEFAULT_MICRO_BENCH_ROUND_COUNT = 3;
+
+    // 调度微基准的默认负载：2000 个协程，每个重新调度自己 1000 次
+    constexpr size_t DEFAULT_SCHEDULER_BENCH_COROUTINE_COUNT = 2000;
+
+    constexpr size_t DEFAULT_SCHEDULER_BENCH_RESCHEDULE_COUNT = 1000;
+
+    // 解析器微基准的默认负载：流水线中的请求数，以及两种切分数据的大小
+    // 前者和中等的接收缓冲区一样大，后者足够小，几乎每个请求都跨越多个片段
+    constexpr size_t DEFAULT_PARSER_BENCH_REQUEST_COUNT = 100000;
+
+    constexpr size_t DEFAULT_PARSER_BENCH_BUFFER_SIZE = 16 * 1024;
+
+    constexpr size_t DEFAULT_PARSER_BENCH_FRAGMENT_SIZE = 7;
+
+    // 零拷贝微基准的默认负载：消息的长度从 1 KiB 开始每次加倍，直到 1 MiB ，每种长度和方式发送 256 MiB
+    constexpr size_t DEFAULT_ZERO_COPY_BENCH_MIN_SIZE = 1024;
+
+    constexpr size_t DEFAULT_ZERO_COPY_BENCH_MAX_SIZE = 1024 * 1024;
+
+    constexpr size_t DEFAULT_ZERO_COPY_BENCH_BYTE_COUNT = 256 * 1024 * 1024;
+
+}
+
+#endif
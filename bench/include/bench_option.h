@@ -0,0 +1,29 @@
+#ifndef BENCH_OPTION_H
+#define BENCH_OPTION_H
+
+#include <charconv>
+#include <cstdlib>
+#include <iostream>
+#include <string_view>
+
+namespace WebServer {
+
+    // 如果 argument 是 "<name><数值>" 的形式，把数值写入 value 并返回 true ，数值格式错误时退出进程
+    // 压测工具和各个微基准共用
+    template<typename T>
+    bool parse_number(const std::string_view argument, const std::string_view name, T &value) {
+        if (!argument.starts_with(name)) {
+            return false;
+        }
+        const std::string_view text = argument.substr(name.size());
+        if (const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+                error != std::errc{} || end != text.data() + text.size()) {
+            std::cerr << "invalid argument: " << argument << std::endl;
+            std::exit(1);
+        }
+        return true;
+    }
+
+}
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef LOAD_GENERATOR_H
+#define LOAD_GENERATOR_H
+
+#include <array>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <linux/time_types.h>
+#include <sys/socket.h>
+#include "bench_constant.h"
+#include "constant.h"
+#include "io_uring.h"
+#include "socket.h"
+#include "task.h"
+#include "timer_wheel.h"
+
+namespace WebServer {
+
+    // 压测的参数，所有线程共享
+    class bench_config {
+    public:
+        // 服务器的地址，以及请求中的 Host 头
+        sockaddr_storage address{};
+        socklen_t address_size = 0;
+        std::string host;
+
+        // 所有线程的连接总数
+        size_t connection_count = DEFAULT_BENCH_CONNECTION_COUNT;
+        std::chrono::nanoseconds duration = DEFAULT_BENCH_DURATION;
+        // 一个请求等待响应的时间，为 0 表示不限制
+        std::chrono::milliseconds request_timeout = DEFAULT_BENCH_REQUEST_TIMEOUT;
+
+        // 所有线程每秒发送的请求数。为 0 时使用闭环模式：每个连接收到响应之后才发送下一个请求
+        // 否则使用开环模式：请求按照固定的间隔发送，延迟从计划发送的时间开始计算，不会因为服务器变慢而少发请求
+        // 这样可以避免协调遗漏（ coordinated omission ）：服务器停顿期间本应发出的请求也会记录下它们等待的时间
+        double rate = 0;
+        // 每个连接上最多同时在途的请求数，大于 1 时使用流水线
+        size_t pipeline_depth = 1;
+        // 为 false 时每个请求都使用一个新的连接，延迟包括建立连接的时间
+        bool keep_alive = true;
+
+        // 请求的 URL 和它的权重，每个请求按照权重随机选择一个 URL
+        std::vector<std::tuple<std::string, unsigned int>> url_list;
+    };
+
+    // 压测的结果，每个线程一个，结束之后合并
+    class bench_result {
+    public:
+        uint64_t response_count = 0;
+        // 4xx 和 5xx 的响应
+        uint64_t error_response_count = 0;
+        uint64_t connect_error_count = 0;
+        // 连接在收到所有响应之前被关闭、发送失败或者响应格式错误
+        uint64_t connection_error_count = 0;
+        // 等待响应超时的连接
+        uint64_t timeout_count = 0;
+        uint64_t received_byte = 0;
+
+        // 延迟的直方图，和 metrics::histogram 使用相同的桶
+        std::array<uint64_t, HISTOGRAM_BUCKET_COUNT> latency_bucket_list{};
+        uint64_t latency_sum = 0;
+        uint64_t latency_max = 0;
+
+        void record_latency(std::chrono::nanoseconds latency) noexcept;
+
+        void merge(const bench_result &other) noexcept;
+
+        // 第一个累计数量达到 quantile 的桶的上界（纳秒），不超过实际的最大值
+        [[nodiscard]] uint64_t get_latency_percentile(double quantile) const noexcept;
+    };
+
+    // 在一个线程上运行的 HTTP/1.1 负载生成器，使用和服务器相同的 io_uring 、client_socket 和 task
+    // 每个连接由两个协程处理：发送协程按照模式决定何时发送下一个请求，接收协程解析响应并记录延迟
+    // 两个协程在同一个线程上运行，通过直接恢复对方来交接，不需要任何同步
+    class load_generator {
+    public:
+        // connection_count 是这个线程负责的连接数，seed 用于选择 URL
+        load_generator(const bench_config &config, size_t connection_count, uint64_t seed);
+
+        // 在当前线程上运行压测，直到 start_time 之后的 duration 结束，并且所有在途的请求都已经完成
+        bench_result run(std::chrono::steady_clock::time_point start_time);
+
+    private:
+        // 一个连接槽，连接断开之后在同一个槽中重新连接
+        // 开环模式下，槽中的计划发送时间在重新连接之后继续推进，断开期间的请求不会被跳过
+        class connection_slot {
+        public:
+            std::chrono::steady_clock::time_point next_send_time;
+        };
+
+        // 一个已经建立的连接，由 run_keep_alive_connection 或者 run_close_connection 持有
+        class connection {
+        public:
+            explicit connection(client_socket &socket);
+
+            client_socket &socket;
+            // 已经发送、还没有收到响应的请求的计划发送时间，响应按照请求的顺序到达
+            std::deque<std::chrono::steady_clock::time_point> pending_list;
+            // 因为在途的请求达到流水线深度而等待的发送协程
+            std::coroutine_handle<> waiting_sender;
+            // 连接关闭之后等待发送协程结束的协程
+            std::coroutine_handle<> waiting_receiver;
+            // 发送协程不会再发送请求了，接收协程收到所有在途的响应之后结束
+            bool sender_done = false;
+            // 接收协程已经结束，发送协程应该尽快结束
+            bool closed = false;
+        };
+
+        // 把当前协程保存在 handle 中挂起，由其他协程恢复
+        class park_awaiter {
+        public:
+            explicit park_awaiter(std::coroutine_handle<> &handle);
+
+            [[nodiscard]] bool await_ready() const noexcept;
+
+            void await_suspend(std::coroutine_handle<> coroutine) noexcept;
+
+            void await_resume() const noexcept;
+
+        private:
+            std::coroutine_handle<> &handle_;
+        };
+
+        // 等到 time_point ，已经过了这个时间时不挂起
+        class sleep_awaiter {
+        public:
+            explicit sleep_awaiter(std::chrono::steady_clock::time_point time_point);
+
+            [[nodiscard]] bool await_ready() const noexcept;
+
+            void await_suspend(std::coroutine_handle<> coroutine);
+
+            void await_resume() const noexcept;
+
+        private:
+            const std::chrono::steady_clock::time_point time_point_;
+            __kernel_timespec timeout_{};
+            sqe_data sqe_data_;
+        };
+
+        // 在 slot 上保持一个连接，断开之后重新连接，直到压测结束
+        task<> run_keep_alive_connection(connection_slot &slot);
+
+        // 在 slot 上为每个请求建立一个新的连接，收到响应之后关闭
+        task<> run_close_connection(connection_slot &slot);
+
+        // 保持连接时的发送协程
+        task<> send_requests(connection_slot &slot, connection &connection);
+
+        // 接收 connection 上的响应，直到发送协程结束并且所有在途的请求都收到了响应，这时返回 true
+        // 连接被关闭、出错或者超时时返回 false
+        task<bool> receive_responses(connection &connection, timer_wheel::timer &timer);
+
+        // 取出 slot 中的下一个计划发送时间，只用于开环模式
+        std::chrono::steady_clock::time_point take_send_time(connection_slot &slot);
+
+        // 按照权重随机选择一个请求
+        const std::string &pick_request();
+
+        // 创建一个还没有连接的套接字
+        [[nodiscard]] client_socket create_socket() const;
+
+        // 处理来自 io_uring 的完成事件，直到所有的连接都已经结束
+        void event_loop();
+
+        const bench_config &config_;
+        const size_t connection_count_;
+        // 开环模式下每个连接发送请求的间隔，闭环模式下为 0
+        const std::chrono::nanoseconds send_interval_;
+
+        // 每个 URL 预先构造好的请求，以及累计的权重
+        std::vector<std::string> request_list_;
+        std::vector<unsigned int> cumulative_weight_list_;
+        std::minstd_rand random_engine_;
+
+        std::chrono::steady_clock::time_point end_time_;
+        std::vector<connection_slot> slot_list_;
+        size_t active_connection_count_ = 0;
+        bench_result result_;
+    };
+}
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef RESPONSE_PARSER_H
+#define RESPONSE_PARSER_H
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace WebServer {
+
+    // 可以恢复的 HTTP/1.1 响应解析器，只解析压测需要的状态码和 content-length ，响应体直接跳过
+    // 响应头跨越多个缓冲区时，未完成的部分保存在内部的缓冲区中
+    class response_parser {
+    public:
+        // 解析 data 中的数据，每解析出一个完整的响应，就把它的状态码追加到 status_list 的末尾
+        void feed(std::span<const char> data, std::vector<unsigned int> &status_list);
+
+        // 响应格式错误或者使用了不支持的 chunked 编码，之后的数据都不会再被解析，应该关闭连接
+        [[nodiscard]] bool has_error() const noexcept;
+
+        // 是否已经收到了一个响应的一部分
+        [[nodiscard]] bool has_partial_response() const noexcept;
+
+    private:
+        // 解析完整的响应头，成功时设置 status_ 和 remaining_body_size_
+        bool parse_header();
+
+        // 还没有接收完的响应头
+        std::string header_;
+        // 当前响应的状态码，以及响应体中还没有收到的字节数
+        unsigned int status_ = 0;
+        uint64_t remaining_body_size_ = 0;
+        bool in_body_ = false;
+        bool error_ = false;
+    };
+}
+
+#endif
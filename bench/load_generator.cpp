@@ -0,0 +1,371 @@
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include <liburing.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "buffer_ring.h"
+#include "load_generator.h"
+#include "metrics.h"
+#include "response_parser.h"
+
+namespace WebServer {
+    void bench_result::record_latency(const std::chrono::nanoseconds latency) noexcept {
+        const auto value = static_cast<uint64_t>(std::max<int64_t>(latency.count(), 0));
+        ++latency_bucket_list[metrics::histogram::get_bucket_index(value)];
+        latency_sum += value;
+        latency_max = std::max(latency_max, value);
+    }
+
+    void bench_result::merge(const bench_result &other) noexcept {
+        response_count += other.response_count;
+        error_response_count += other.error_response_count;
+        connect_error_count += other.connect_error_count;
+        connection_error_count += other.connection_error_count;
+        timeout_count += other.timeout_count;
+        received_byte += other.received_byte;
+        for (size_t index = 0; index < HISTOGRAM_BUCKET_COUNT; ++index) {
+            latency_bucket_list[index] += other.latency_bucket_list[index];
+        }
+        latency_sum += other.latency_sum;
+        latency_max = std::max(latency_max, other.latency_max);
+    }
+
+    uint64_t bench_result::get_latency_percentile(const double quantile) const noexcept {
+        uint64_t count = 0;
+        for (const uint64_t bucket: latency_bucket_list) {
+            count += bucket;
+        }
+        const auto target = std::max<uint64_t>(static_cast<uint64_t>(quantile * static_cast<double>(count) + 0.5), 1);
+        uint64_t cumulative_count = 0;
+        for (size_t index = 0; index < HISTOGRAM_BUCKET_COUNT && count > 0; ++index) {
+            cumulative_count += latency_bucket_list[index];
+            if (cumulative_count >= target) {
+                return std::min(metrics::histogram::get_bucket_upper_bound(index), latency_max);
+            }
+        }
+        return 0;
+    }
+
+    load_generator::load_generator(const bench_config &config, const size_t connection_count, const uint64_t seed)
+            : config_{config}, connection_count_{connection_count},
+              send_interval_{config.rate > 0 ? std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::duration<double>(static_cast<double>(config.connection_count) / config.rate)
+              ) : std::chrono::nanoseconds{0}},
+              random_engine_{static_cast<std::minstd_rand::result_type>(seed)}, slot_list_(connection_count) {
+        unsigned int total_weight = 0;
+        for (const auto &[url, weight]: config_.url_list) {
+            std::string request = "GET " + url + " HTTP/1.1\r\nhost: " + config_.host + "\r\n";
+            if (!config_.keep_alive) {
+                request += "connection: close\r\n";
+            }
+            request += "\r\n";
+            request_list_.emplace_back(std::move(request));
+            total_weight += weight;
+            cumulative_weight_list_.emplace_back(total_weight);
+        }
+    }
+
+    bench_result load_generator::run(const std::chrono::steady_clock::time_point start_time) {
+        // 接收响应使用和服务器相同的缓冲区环
+        buffer_ring::get_instance().register_buffer_ring();
+
+        // 等待响应的超时由时间轮处理
+        task<> timer_wheel_task = timer_wheel::get_instance().run();
+        timer_wheel_task.resume();
+        timer_wheel_task.detach();
+
+        end_time_ = start_time + config_.duration;
+        for (size_t index = 0; index < connection_count_; ++index) {
+            // 开环模式下，这个线程的连接在第一个发送间隔中均匀错开，不会同时发出第一批请求
+            connection_slot &slot = slot_list_[index];
+            slot.next_send_time = start_time + send_interval_ * static_cast<int64_t>(index) /
+                                              static_cast<int64_t>(connection_count_);
+
+            task<> connection_task = config_.keep_alive ? run_keep_alive_connection(slot) : run_close_connection(slot);
+            ++active_connection_count_;
+            connection_task.resume();
+            connection_task.detach();
+        }
+
+        event_loop();
+        return result_;
+    }
+
+    load_generator::connection::connection(client_socket &socket) : socket{socket} {}
+
+    load_generator::park_awaiter::park_awaiter(std::coroutine_handle<> &handle) : handle_{handle} {}
+
+    bool load_generator::park_awaiter::await_ready() const noexcept { return false; }
+
+    void load_generator::park_awaiter::await_suspend(const std::coroutine_handle<> coroutine) noexcept {
+        handle_ = coroutine;
+    }
+
+    void load_generator::park_awaiter::await_resume() const noexcept {}
+
+    load_generator::sleep_awaiter::sleep_awaiter(const std::chrono::steady_clock::time_point time_point)
+            : time_point_{time_point} {}
+
+    bool load_generator::sleep_awaiter::await_ready() const noexcept {
+        return std::chrono::steady_clock::now() >= time_point_;
+    }
+
+    void load_generator::sleep_awaiter::await_suspend(const std::coroutine_handle<> coroutine) {
+        const auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                time_point_ - std::chrono::steady_clock::now()
+        );
+        const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(duration);
+        timeout_.tv_sec = std::max<int64_t>(seconds.count(), 0);
+        timeout_.tv_nsec = std::max<int64_t>((duration - seconds).count(), 0);
+        sqe_data_.coroutine = coroutine.address();
+        io_uring::get_instance().submit_timeout_request(&sqe_data_, &timeout_);
+    }
+
+    void load_generator::sleep_awaiter::await_resume() const noexcept {}
+
+    task<> load_generator::run_keep_alive_connection(connection_slot &slot) {
+        while (std::chrono::steady_clock::now() < end_time_) {
+            client_socket socket = create_socket();
+            if (co_await socket.connect(reinterpret_cast<const sockaddr *>(&config_.address), config_.address_size) < 0) {
+                ++result_.connect_error_count;
+                continue;
+            }
+
+            connection connection(socket);
+            // 超时时取消套接字上所有的请求，接收协程会返回 false
+            timer_wheel::timer timer([this, &socket]() {
+                ++result_.timeout_count;
+                socket.cancel();
+            });
+
+            task<> send_task = send_requests(slot, connection);
+            send_task.resume();
+            send_task.detach();
+
+            const bool finished = co_await receive_responses(connection, timer);
+            if (!finished && !timer.is_expired()) {
+                ++result_.connection_error_count;
+            }
+
+            // 让发送协程尽快结束：唤醒等待流水线的发送协程，取消正在进行的发送
+            // 发送协程还在等待开环模式的发送时间时，它醒来之后就会结束，之后才能销毁 connection
+            connection.closed = true;
+            if (!finished) {
+                socket.cancel();
+            }
+            if (connection.waiting_sender != nullptr) {
+                std::exchange(connection.waiting_sender, nullptr).resume();
+            }
+            if (!connection.sender_done) {
+                co_await park_awaiter(connection.waiting_receiver);
+            }
+        }
+        --active_connection_count_;
+    }
+
+    task<> load_generator::run_close_connection(connection_slot &slot) {
+        while (true) {
+            std::chrono::steady_clock::time_point send_time;
+            if (send_interval_.count() > 0) {
+                send_time = take_send_time(slot);
+                if (send_time >= end_time_) {
+                    break;
+                }
+                co_await sleep_awaiter(send_time);
+            } else {
+                send_time = std::chrono::steady_clock::now();
+                if (send_time >= end_time_) {
+                    break;
+                }
+            }
+
+            client_socket socket = create_socket();
+            if (co_await socket.connect(reinterpret_cast<const sockaddr *>(&config_.address), config_.address_size) < 0) {
+                ++result_.connect_error_count;
+                continue;
+            }
+
+            connection connection(socket);
+            timer_wheel::timer timer([this, &socket]() {
+                ++result_.timeout_count;
+                socket.cancel();
+            });
+
+            // 每个连接只发送一个请求，没有单独的发送协程
+            const std::string &request = pick_request();
+            connection.pending_list.emplace_back(send_time);
+            connection.sender_done = true;
+            if (co_await socket.send(request, request.size()) == -1) {
+                ++result_.connection_error_count;
+                continue;
+            }
+
+            if (!co_await receive_responses(connection, timer) && !timer.is_expired()) {
+                ++result_.connection_error_count;
+            }
+        }
+        --active_connection_count_;
+    }
+
+    task<> load_generator::send_requests(connection_slot &slot, connection &connection) {
+        while (!connection.closed) {
+            std::chrono::steady_clock::time_point send_time;
+            if (send_interval_.count() > 0) {
+                // 开环模式：先等到计划发送的时间，再等待流水线中的空位，等待空位的时间也计入延迟
+                send_time = take_send_time(slot);
+                if (send_time >= end_time_) {
+                    break;
+                }
+                co_await sleep_awaiter(send_time);
+                while (!connection.closed && connection.pending_list.size() >= config_.pipeline_depth) {
+                    co_await park_awaiter(connection.waiting_sender);
+                }
+            } else {
+                // 闭环模式：流水线中有空位时立即发送
+                while (!connection.closed && connection.pending_list.size() >= config_.pipeline_depth) {
+                    co_await park_awaiter(connection.waiting_sender);
+                }
+                send_time = std::chrono::steady_clock::now();
+                if (send_time >= end_time_) {
+                    break;
+                }
+            }
+            if (connection.closed) {
+                break;
+            }
+
+            const std::string &request = pick_request();
+            connection.pending_list.emplace_back(send_time);
+            if (co_await connection.socket.send(request, request.size()) == -1) {
+                // 已经发出的请求不会再有响应了，让接收协程立即结束
+                connection.socket.cancel();
+                break;
+            }
+        }
+
+        // 没有在途的请求时半关闭连接，服务器随后关闭连接，接收协程收到 EOF 之后结束
+        connection.sender_done = true;
+        if (!connection.closed && connection.pending_list.empty()) {
+            shutdown(connection.socket.get_raw_file_descriptor(), SHUT_WR);
+        }
+        // 恢复接收协程之后它会销毁 connection ，所以这必须是最后一个操作
+        if (connection.waiting_receiver != nullptr) {
+            std::exchange(connection.waiting_receiver, nullptr).resume();
+        }
+    }
+
+    task<bool> load_generator::receive_responses(connection &connection, timer_wheel::timer &timer) {
+        buffer_ring &buffer_ring = buffer_ring::get_instance();
+        response_parser response_parser;
+        std::vector<buffer_ring::borrowed_buffer> recv_buffer_list;
+        std::vector<unsigned int> status_list;
+
+        while (!connection.sender_done || !connection.pending_list.empty()) {
+            // 只在有在途的请求时计时，开环模式下两个请求之间的空闲不算超时
+            if (connection.pending_list.empty()) {
+                timer.stop();
+            } else {
+                timer.start(config_.request_timeout);
+            }
+
+            const auto [recv_buffer_group, recv_buffer_id, recv_buffer_size] = co_await connection.socket.recv();
+            if (recv_buffer_size <= 0) {
+                // 发送协程半关闭连接之后，服务器关闭连接是正常的结束
+                co_return connection.sender_done && connection.pending_list.empty();
+            }
+            const auto recv_time = std::chrono::steady_clock::now();
+            result_.received_byte += recv_buffer_size;
+
+            buffer_ring.borrow_buffer_list(recv_buffer_group, recv_buffer_id, recv_buffer_size, recv_buffer_list);
+            for (const auto &[buffer_group, buffer_id, recv_buffer]: recv_buffer_list) {
+                response_parser.feed(recv_buffer, status_list);
+                buffer_ring.return_buffer(buffer_group, buffer_id);
+            }
+
+            // 同一次接收中完成的响应使用相同的接收时间
+            for (const unsigned int status: status_list) {
+                // 没有对应请求的响应
+                if (connection.pending_list.empty()) {
+                    co_return false;
+                }
+                result_.record_latency(recv_time - connection.pending_list.front());
+                connection.pending_list.pop_front();
+                ++result_.response_count;
+                if (status >= 400) {
+                    ++result_.error_response_count;
+                }
+            }
+            if (response_parser.has_error()) {
+                co_return false;
+            }
+
+            // 流水线中有了空位，恢复等待的发送协程
+            if (!status_list.empty() && connection.waiting_sender != nullptr) {
+                std::exchange(connection.waiting_sender, nullptr).resume();
+            }
+            status_list.clear();
+        }
+        timer.stop();
+        co_return true;
+    }
+
+    std::chrono::steady_clock::time_point load_generator::take_send_time(connection_slot &slot) {
+        return std::exchange(slot.next_send_time, slot.next_send_time + send_interval_);
+    }
+
+    const std::string &load_generator::pick_request() {
+        if (request_list_.size() == 1) {
+            return request_list_.front();
+        }
+        std::uniform_int_distribution<unsigned int> distribution(0, cumulative_weight_list_.back() - 1);
+        const unsigned int value = distribution(random_engine_);
+        const auto iterator = std::ranges::upper_bound(cumulative_weight_list_, value);
+        return request_list_[iterator - cumulative_weight_list_.begin()];
+    }
+
+    client_socket load_generator::create_socket() const {
+        const int raw_file_descriptor = ::socket(config_.address.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (raw_file_descriptor == -1) {
+            throw std::runtime_error("failed to invoke 'socket'");
+        }
+        // 请求都很小，不能等待 Nagle 算法合并
+        const int enable = 1;
+        setsockopt(raw_file_descriptor, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        return client_socket{raw_file_descriptor};
+    }
+
+    void load_generator::event_loop() {
+        io_uring &io_uring = io_uring::get_instance();
+        buffer_ring &buffer_ring = buffer_ring::get_instance();
+
+        while (active_connection_count_ > 0) {
+            buffer_ring.flush();
+            io_uring.submit_and_wait(1);
+
+            for (io_uring_cqe *const cqe: io_uring) {
+                auto *sqe_data = reinterpret_cast<struct sqe_data *>(io_uring_cqe_get_data(cqe));
+                if (sqe_data == nullptr) {
+                    io_uring.cqe_seen(cqe);
+                    continue;
+                }
+
+                sqe_data->cqe_res = cqe->res;
+                sqe_data->cqe_flags = cqe->flags;
+                if (sqe_data->cqe_queue != nullptr) {
+                    sqe_data->cqe_queue->emplace(cqe->res, cqe->flags);
+                }
+                void *const coroutine_address = sqe_data->coroutine;
+                io_uring.cqe_seen(cqe);
+
+                if (coroutine_address != nullptr) {
+                    std::coroutine_handle<>::from_address(coroutine_address).resume();
+                }
+            }
+        }
+
+        // 提交最后一批连接关闭时的 cancel 请求
+        io_uring.submit_and_wait(0);
+    }
+}
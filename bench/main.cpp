@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include <netdb.h>
+#include "bench_option.h"
+#include "load_generator.h"
+
+// 解析 "[<权重>:]<路径>" 形式的 URL ，路径总是以 '/' 开头，所以第一个 '/' 之前的部分就是权重
+std::tuple<std::string, unsigned int> parse_url(const std::string_view argument) {
+    const size_t colon = argument.find(':');
+    if (colon == std::string_view::npos || colon > argument.find('/')) {
+        return {std::string(argument), 1};
+    }
+    unsigned int weight = 0;
+    if (const auto [end, error] = std::from_chars(argument.data(), argument.data() + colon, weight);
+            error != std::errc{} || end != argument.data() + colon || weight == 0) {
+        std::cerr << "invalid url: " << argument << std::endl;
+        std::exit(1);
+    }
+    return {std::string(argument.substr(colon + 1)), weight};
+}
+
+void print_usage() {
+    std::cout << "usage: webserver_bench [option]...\n"
+                 "  --host=HOST          server address, default 127.0.0.1\n"
+                 "  --port=PORT          server port, default 18080\n"
+                 "  --threads=N          worker threads, default: number of CPUs\n"
+                 "  --connections=N      total connections, default 64\n"
+                 "  --duration=S         test duration in seconds, default 10\n"
+                 "  --rate=R             total requests per second (open-loop), default 0 (closed-loop)\n"
+                 "  --pipeline=D         requests in flight per connection, default 1\n"
+                 "  --timeout=S          response timeout in seconds, 0 disables, default 10\n"
+                 "  --no-keep-alive      one request per connection\n"
+                 "  --url=[WEIGHT:]PATH  request path, repeat to build a weighted mix, default /\n";
+}
+
+int main(int argc, char *argv[]) {
+    WebServer::bench_config config;
+    std::string host = "127.0.0.1";
+    std::string port = "18080";
+    size_t thread_count = std::thread::hardware_concurrency();
+    unsigned int duration = std::chrono::duration_cast<std::chrono::seconds>(config.duration).count();
+    unsigned int timeout = std::chrono::duration_cast<std::chrono::seconds>(config.request_timeout).count();
+
+    for (int index = 1; index < argc; ++index) {
+        const std::string_view argument(argv[index]);
+        if (argument == "--help") {
+            print_usage();
+            return 0;
+        }
+        if (argument == "--no-keep-alive") {
+            config.keep_alive = false;
+            continue;
+        }
+        if (argument.starts_with("--host=")) {
+            host = argument.substr(std::string_view("--host=").size());
+            continue;
+        }
+        if (argument.starts_with("--port=")) {
+            port = argument.substr(std::string_view("--port=").size());
+            continue;
+        }
+        if (argument.starts_with("--url=")) {
+            config.url_list.emplace_back(parse_url(argument.substr(std::string_view("--url=").size())));
+            continue;
+        }
+        if (WebServer::parse_number(argument, "--threads=", thread_count) ||
+            WebServer::parse_number(argument, "--connections=", config.connection_count) ||
+            WebServer::parse_number(argument, "--duration=", duration) ||
+            WebServer::parse_number(argument, "--rate=", config.rate) ||
+            WebServer::parse_number(argument, "--pipeline=", config.pipeline_depth) ||
+            WebServer::parse_number(argument, "--timeout=", timeout)) {
+            continue;
+        }
+        std::cerr << "unknown argument: " << argument << std::endl;
+        print_usage();
+        return 1;
+    }
+
+    if (config.url_list.empty()) {
+        config.url_list.emplace_back("/", 1);
+    }
+    config.duration = std::chrono::seconds(duration);
+    config.request_timeout = std::chrono::seconds(timeout);
+    config.connection_count = std::max<size_t>(config.connection_count, 1);
+    config.pipeline_depth = config.keep_alive ? std::max<size_t>(config.pipeline_depth, 1) : 1;
+    thread_count = std::clamp<size_t>(thread_count, 1, config.connection_count);
+    config.host = host;
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *address_list = nullptr;
+    if (const int error = getaddrinfo(host.c_str(), port.c_str(), &hints, &address_list); error != 0) {
+        std::cerr << "failed to resolve " << host << ": " << gai_strerror(error) << std::endl;
+        return 1;
+    }
+    std::memcpy(&config.address, address_list->ai_addr, address_list->ai_addrlen);
+    config.address_size = address_list->ai_addrlen;
+    freeaddrinfo(address_list);
+
+    // 服务器关闭连接之后的发送会产生 SIGPIPE ，只需要得到错误码
+    std::signal(SIGPIPE, SIG_IGN);
+
+    std::cout << "Running " << duration << "s test @ " << host << ":" << port << ", "
+              << (config.rate > 0 ? "open-loop" : "closed-loop") << ", " << config.connection_count
+              << " connections, " << thread_count << " threads, pipeline " << config.pipeline_depth
+              << (config.keep_alive ? "" : ", no keep-alive") << std::endl;
+
+    // 连接尽量平均地分配到每个线程，所有线程使用同一个开始时间，开环模式下的发送计划在线程之间是对齐的
+    std::vector<WebServer::bench_result> result_list(thread_count);
+    const auto start_time = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> thread_list;
+        for (size_t thread_index = 0; thread_index < thread_count; ++thread_index) {
+            const size_t connection_count = config.connection_count / thread_count +
+                                            (thread_index < config.connection_count % thread_count ? 1 : 0);
+            thread_list.emplace_back([&config, &result_list, start_time, thread_index, connection_count]() {
+                WebServer::load_generator load_generator(config, connection_count, thread_index + 1);
+                result_list[thread_index] = load_generator.run(start_time);
+            });
+        }
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+
+    WebServer::bench_result result;
+    for (const WebServer::bench_result &thread_result: result_list) {
+        result.merge(thread_result);
+    }
+
+    // 每行一个 "名字 值" ，和服务器的统计数据使用相同的格式，方便用脚本比较
+    const auto print_line = [](const std::string_view name, const auto value) {
+        std::cout << name << ' ' << value << '\n';
+    };
+    print_line("elapsed_s", elapsed.count());
+    print_line("response", result.response_count);
+    print_line("response_per_s", static_cast<double>(result.response_count) / elapsed.count());
+    print_line("received_byte_per_s", static_cast<double>(result.received_byte) / elapsed.count());
+    print_line("error_response", result.error_response_count);
+    print_line("connect_error", result.connect_error_count);
+    print_line("connection_error", result.connection_error_count);
+    print_line("timeout", result.timeout_count);
+    print_line("latency_mean_us", result.response_count == 0
+                                  ? 0.0 : static_cast<double>(result.latency_sum) / result.response_count / 1000);
+    for (const auto &[quantile, name]: {
+            std::tuple{0.5, "latency_p50_us"}, std::tuple{0.99, "latency_p99_us"},
+            std::tuple{0.999, "latency_p999_us"}
+    }) {
+        print_line(name, static_cast<double>(result.get_latency_percentile(quantile)) / 1000);
+    }
+    print_line("latency_max_us", static_cast<double>(result.latency_max) / 1000);
+    std::cout.flush();
+}
@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include "bench_constant.h"
+#include "bench_option.h"
+#include "http_message.h"
+#include "http_parser.h"
+
+// http_parser 的微基准：把同一段包含多个流水线请求的数据按不同的大小切开输入解析器
+// 切成接收缓冲区大小时，绝大多数请求直接在输入的数据上解析；切成很小的片段时，每个请求都要经过内部的缓冲区
+// 每种切法分别使用 SIMD 和逐字节的 find_byte 运行，比较每秒解析的请求数
+namespace WebServer {
+
+    // 一个浏览器风格的 GET 请求，头部的数量和长度接近真实的流量
+    constexpr std::string_view BENCH_REQUEST =
+            "GET /static/js/application.min.js?version=20240101 HTTP/1.1\r\n"
+            "Host: www.example.com\r\n"
+            "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+            "Chrome/120.0.0.0 Safari/537.36\r\n"
+            "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+            "Accept-Language: en-US,en;q=0.9\r\n"
+            "Accept-Encoding: gzip, deflate, br\r\n"
+            "Referer: https://www.example.com/index.html\r\n"
+            "Cookie: session=4f9c2a7e1b3d8c6a5e0f9b2d7c4a1e3f; theme=dark\r\n"
+            "If-None-Match: \"5f3a9c2e-1a2b\"\r\n"
+            "Connection: keep-alive\r\n"
+            "\r\n";
+
+    // 把 stream 切成长度为 fragment_size 的片段依次输入，返回解析出的请求数，解析出错时返回 0
+    size_t parse_stream(const std::string_view stream, const size_t fragment_size) {
+        http_parser http_parser;
+        size_t request_count = 0;
+        for (size_t offset = 0; offset < stream.size(); offset += fragment_size) {
+            http_parser.feed(std::span(stream.data() + offset, std::min(fragment_size, stream.size() - offset)));
+            while (http_parser.next().has_value()) {
+                ++request_count;
+            }
+            if (http_parser.has_error()) {
+                return 0;
+            }
+        }
+        return request_count;
+    }
+
+    // 运行 round_count 轮，返回最好的一轮每秒解析的请求数
+    double measure(const std::string_view stream, const size_t fragment_size, const size_t round_count) {
+        std::chrono::duration<double> best_elapsed = std::chrono::duration<double>::max();
+        size_t request_count = 0;
+        for (size_t _ = 0; _ < round_count; ++_) {
+            const auto start_time = std::chrono::steady_clock::now();
+            request_count = parse_stream(stream, fragment_size);
+            best_elapsed = std::min<std::chrono::duration<double>>(
+                    best_elapsed, std::chrono::steady_clock::now() - start_time
+            );
+        }
+        return static_cast<double>(request_count) / best_elapsed.count();
+    }
+}
+
+void print_usage() {
+    std::cout << "usage: parser_bench [option]...\n"
+                 "  --requests=N     pipelined requests in the stream, default 100000\n"
+                 "  --buffer=BYTES   fragment size of the pipelined run, default 16384\n"
+                 "  --fragment=BYTES fragment size of the fragmented run, default 7\n"
+                 "  --rounds=N       rounds per run, the best one is reported, default 3\n";
+}
+
+int main(int argc, char *argv[]) {
+    size_t request_count = WebServer::DEFAULT_PARSER_BENCH_REQUEST_COUNT;
+    size_t buffer_size = WebServer::DEFAULT_PARSER_BENCH_BUFFER_SIZE;
+    size_t fragment_size = WebServer::DEFAULT_PARSER_BENCH_FRAGMENT_SIZE;
+    size_t round_count = WebServer::DEFAULT_MICRO_BENCH_ROUND_COUNT;
+
+    for (int index = 1; index < argc; ++index) {
+        const std::string_view argument(argv[index]);
+        if (argument == "--help") {
+            print_usage();
+            return 0;
+        }
+        if (WebServer::parse_number(argument, "--requests=", request_count) ||
+            WebServer::parse_number(argument, "--buffer=", buffer_size) ||
+            WebServer::parse_number(argument, "--fragment=", fragment_size) ||
+            WebServer::parse_number(argument, "--rounds=", round_count)) {
+            continue;
+        }
+        std::cerr << "unknown argument: " << argument << std::endl;
+        print_usage();
+        return 1;
+    }
+    buffer_size = std::max<size_t>(buffer_size, 1);
+    fragment_size = std::max<size_t>(fragment_size, 1);
+    round_count = std::max<size_t>(round_count, 1);
+
+    std::string stream;
+    stream.reserve(WebServer::BENCH_REQUEST.size() * request_count);
+    for (size_t _ = 0; _ < request_count; ++_) {
+        stream.append(WebServer::BENCH_REQUEST);
+    }
+    if (WebServer::parse_stream(stream, buffer_size) != request_count) {
+        std::cerr << "failed to parse the request stream" << std::endl;
+        return 1;
+    }
+
+    // 和 webserver_bench 相同，每行一个 "名字 值"
+    const auto print_line = [](const std::string_view name, const auto value) {
+        std::cout << name << ' ' << value << '\n';
+    };
+    print_line("requests", request_count);
+    print_line("request_byte", WebServer::BENCH_REQUEST.size());
+    for (const bool simd: {true, false}) {
+        WebServer::http_parser::enable_simd(simd);
+        const std::string prefix = simd ? "simd_" : "scalar_";
+        print_line(prefix + "pipelined_request_per_s", WebServer::measure(stream, buffer_size, round_count));
+        print_line(prefix + "fragmented_request_per_s", WebServer::measure(stream, fragment_size, round_count));
+    }
+    std::cout.flush();
+}
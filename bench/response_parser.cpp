@@ -0,0 +1,102 @@
+#include <algorithm>
+#include <charconv>
+#include <string_view>
+#include "bench_constant.h"
+#include "http_message.h"
+#include "response_parser.h"
+
+namespace WebServer {
+    void response_parser::feed(std::span<const char> data, std::vector<unsigned int> &status_list) {
+        while (!data.empty() && !error_) {
+            if (in_body_) {
+                const size_t size = std::min<uint64_t>(remaining_body_size_, data.size());
+                remaining_body_size_ -= size;
+                data = data.subspan(size);
+                if (remaining_body_size_ == 0) {
+                    in_body_ = false;
+                    status_list.emplace_back(status_);
+                }
+                continue;
+            }
+
+            // 响应头的结尾可能跨越两个缓冲区，所以从上一次追加的位置之前 3 个字节开始查找
+            const size_t previous_size = header_.size();
+            header_.append(data.data(), data.size());
+            const size_t end = header_.find("\r\n\r\n", previous_size < 3 ? 0 : previous_size - 3);
+            if (end == std::string::npos) {
+                if (header_.size() > MAX_RESPONSE_HEADER_SIZE) {
+                    error_ = true;
+                }
+                break;
+            }
+
+            // 响应头之后的数据属于响应体或者下一个响应，放回 data 中继续解析
+            const size_t header_size = end + 4;
+            data = data.subspan(header_size - previous_size);
+            header_.resize(header_size);
+            if (!parse_header()) {
+                error_ = true;
+                break;
+            }
+            header_.clear();
+            if (remaining_body_size_ > 0) {
+                in_body_ = true;
+            } else if (status_ >= 200) {
+                // 1xx 是中间响应，之后还会有一个最终的响应
+                status_list.emplace_back(status_);
+            }
+        }
+    }
+
+    bool response_parser::has_error() const noexcept { return error_; }
+
+    bool response_parser::has_partial_response() const noexcept { return in_body_ || !header_.empty(); }
+
+    bool response_parser::parse_header() {
+        // 状态行的格式是 "HTTP/1.1 200 OK"
+        const std::string_view header = header_;
+        constexpr std::string_view version = "HTTP/1.1 ";
+        if (!header.starts_with(version) || header.size() < version.size() + 3) {
+            return false;
+        }
+        const char *status_begin = header.data() + version.size();
+        if (const auto [end, error] = std::from_chars(status_begin, status_begin + 3, status_);
+                error != std::errc{} || end != status_begin + 3) {
+            return false;
+        }
+
+        remaining_body_size_ = 0;
+        size_t line_begin = header.find("\r\n") + 2;
+        while (line_begin < header.size() - 2) {
+            const size_t line_end = header.find("\r\n", line_begin);
+            const std::string_view line = header.substr(line_begin, line_end - line_begin);
+            line_begin = line_end + 2;
+
+            const size_t colon = line.find(':');
+            if (colon == std::string_view::npos) {
+                return false;
+            }
+            const std::string_view name = line.substr(0, colon);
+            std::string_view value = line.substr(colon + 1);
+            value.remove_prefix(std::min(value.find_first_not_of(" \t"), value.size()));
+            value.remove_suffix(value.size() - value.find_last_not_of(" \t") - 1);
+
+            if (equal_ignore_case(name, "transfer-encoding")) {
+                return false;
+            }
+            if (equal_ignore_case(name, "content-length")) {
+                if (const auto [end, error] = std::from_chars(
+                            value.data(), value.data() + value.size(), remaining_body_size_
+                    ); error != std::errc{} || end != value.data() + value.size()) {
+                    return false;
+                }
+            }
+        }
+
+        // 1xx 、204 和 304 响应没有响应体
+        if (status_ < 200 || status_ == 204 || status_ == 304) {
+            remaining_body_size_ = 0;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <queue>
+#include <stop_token>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "bench_constant.h"
+#include "bench_option.h"
+#include "task.h"
+#include "thread_pool.h"
+
+// 线程池调度的微基准：大量协程反复通过 co_await schedule() 重新调度自己
+// 同样的负载分别运行在工作窃取的 thread_pool 和改动之前的互斥锁队列上，比较每秒完成的调度次数
+namespace WebServer {
+
+    // 改动之前的线程池，所有线程共享一个由互斥锁保护的队列和一个条件变量，只作为比较的基准
+    class mutex_thread_pool {
+    public:
+        explicit mutex_thread_pool(const std::size_t thread_count) {
+            for (size_t _ = 0; _ < thread_count; ++_) {
+                thread_list_.emplace_back([this]() { thread_loop(); });
+            }
+        }
+
+        ~mutex_thread_pool() {
+            stop_source_.request_stop();
+            condition_variable_.notify_all();
+        }
+
+        class schedule_awaiter {
+        public:
+            explicit schedule_awaiter(mutex_thread_pool &thread_pool) : thread_pool_{thread_pool} {}
+
+            [[nodiscard]] bool await_ready() const noexcept { return false; }
+
+            void await_resume() const noexcept {}
+
+            void await_suspend(std::coroutine_handle<> handle) const noexcept { thread_pool_.enqueue(handle); }
+
+        private:
+            mutex_thread_pool &thread_pool_;
+        };
+
+        schedule_awaiter schedule() { return schedule_awaiter{*this}; }
+
+    private:
+        void thread_loop() {
+            while (!stop_source_.stop_requested()) {
+                std::unique_lock lock(mutex_);
+                condition_variable_.wait(lock, [this]() {
+                    return stop_source_.stop_requested() || !coroutine_queue_.empty();
+                });
+                if (stop_source_.stop_requested()) {
+                    break;
+                }
+                const std::coroutine_handle<> coroutine = coroutine_queue_.front();
+                coroutine_queue_.pop();
+                lock.unlock();
+
+                coroutine.resume();
+            }
+        }
+
+        void enqueue(const std::coroutine_handle<> coroutine) {
+            std::unique_lock lock(mutex_);
+            coroutine_queue_.emplace(coroutine);
+            condition_variable_.notify_one();
+        }
+
+        std::stop_source stop_source_;
+        std::mutex mutex_;
+        std::condition_variable condition_variable_;
+        std::queue<std::coroutine_handle<>> coroutine_queue_;
+
+        // 必须在最后声明，保证析构时先等待所有的线程结束，再销毁它们使用的队列
+        std::list<std::jthread> thread_list_;
+    };
+
+    // 先切换到线程池，再重新调度自己 reschedule_count 次，最后一个结束的协程唤醒等待的主线程
+    template<typename thread_pool_type>
+    task<> reschedule(
+            thread_pool_type &thread_pool, const size_t reschedule_count, std::atomic<size_t> &remaining_count
+    ) {
+        co_await thread_pool.schedule();
+        for (size_t _ = 0; _ < reschedule_count; ++_) {
+            co_await thread_pool.schedule();
+        }
+        if (remaining_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            remaining_count.notify_one();
+        }
+    }
+
+    // 运行一轮负载，返回从提交第一个协程到最后一个协程结束经过的时间
+    template<typename thread_pool_type>
+    std::chrono::duration<double> run_round(
+            const size_t thread_count, const size_t coroutine_count, const size_t reschedule_count
+    ) {
+        std::atomic<size_t> remaining_count = coroutine_count;
+        // 协程帧在线程池析构、所有线程结束之后才销毁，这时每个协程都已经停在 final_suspend
+        std::vector<task<>> task_list;
+        task_list.reserve(coroutine_count);
+
+        thread_pool_type thread_pool(thread_count);
+        const auto start_time = std::chrono::steady_clock::now();
+        for (size_t _ = 0; _ < coroutine_count; ++_) {
+            task_list.emplace_back(reschedule(thread_pool, reschedule_count, remaining_count));
+            task_list.back().resume();
+        }
+        for (size_t count = remaining_count.load(std::memory_order_acquire); count != 0;
+             count = remaining_count.load(std::memory_order_acquire)) {
+            remaining_count.wait(count, std::memory_order_acquire);
+        }
+        return std::chrono::steady_clock::now() - start_time;
+    }
+
+    // 运行 round_count 轮，返回最好的一轮每秒完成的调度次数
+    template<typename thread_pool_type>
+    double measure(
+            const size_t thread_count, const size_t coroutine_count, const size_t reschedule_count,
+            const size_t round_count
+    ) {
+        std::chrono::duration<double> best_elapsed = std::chrono::duration<double>::max();
+        for (size_t _ = 0; _ < round_count; ++_) {
+            best_elapsed = std::min(
+                    best_elapsed, run_round<thread_pool_type>(thread_count, coroutine_count, reschedule_count)
+            );
+        }
+        return static_cast<double>(coroutine_count * (reschedule_count + 1)) / best_elapsed.count();
+    }
+}
+
+void print_usage() {
+    std::cout << "usage: scheduler_bench [option]...\n"
+                 "  --threads=N      pool threads, default: number of CPUs\n"
+                 "  --coroutines=N   concurrently scheduled coroutines, default 2000\n"
+                 "  --reschedules=N  times each coroutine reschedules itself, default 1000\n"
+                 "  --rounds=N       rounds per pool, the best one is reported, default 3\n";
+}
+
+int main(int argc, char *argv[]) {
+    size_t thread_count = std::thread::hardware_concurrency();
+    size_t coroutine_count = WebServer::DEFAULT_SCHEDULER_BENCH_COROUTINE_COUNT;
+    size_t reschedule_count = WebServer::DEFAULT_SCHEDULER_BENCH_RESCHEDULE_COUNT;
+    size_t round_count = WebServer::DEFAULT_MICRO_BENCH_ROUND_COUNT;
+
+    for (int index = 1; index < argc; ++index) {
+        const std::string_view argument(argv[index]);
+        if (argument == "--help") {
+            print_usage();
+            return 0;
+        }
+        if (WebServer::parse_number(argument, "--threads=", thread_count) ||
+            WebServer::parse_number(argument, "--coroutines=", coroutine_count) ||
+            WebServer::parse_number(argument, "--reschedules=", reschedule_count) ||
+            WebServer::parse_number(argument, "--rounds=", round_count)) {
+            continue;
+        }
+        std::cerr << "unknown argument: " << argument << std::endl;
+        print_usage();
+        return 1;
+    }
+    thread_count = std::max<size_t>(thread_count, 1);
+    coroutine_count = std::max<size_t>(coroutine_count, 1);
+    round_count = std::max<size_t>(round_count, 1);
+
+    const double work_stealing_rate = WebServer::measure<WebServer::thread_pool>(
+            thread_count, coroutine_count, reschedule_count, round_count
+    );
+    const double mutex_queue_rate = WebServer::measure<WebServer::mutex_thread_pool>(
+            thread_count, coroutine_count, reschedule_count, round_count
+    );
+
+    // 和 webserver_bench 相同，每行一个 "名字 值"
+    const auto print_line = [](const std::string_view name, const auto value) {
+        std::cout << name << ' ' << value << '\n';
+    };
+    print_line("threads", thread_count);
+    print_line("coroutines", coroutine_count);
+    print_line("reschedules", reschedule_count);
+    print_line("work_stealing_schedule_per_s", work_stealing_rate);
+    print_line("mutex_queue_schedule_per_s", mutex_queue_rate);
+    print_line("speedup", work_stealing_rate / mutex_queue_rate);
+    std::cout.flush();
+}
@@ -0,0 +1,256 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "bench_constant.h"
+#include "bench_option.h"
+#include "file_descriptor.h"
+#include "io_uring.h"
+#include "socket.h"
+#include "task.h"
+
+// 零拷贝发送的微基准：通过回环地址上的一个 TCP 连接，用不同长度的消息发送同样多的数据
+// 每种长度分别使用普通的 send 、零拷贝的 send_zc 以及使用固定缓冲区的 send_zc ，比较每秒发送的字节数
+// 零拷贝开始比普通的 send 更快的最小长度，就是 ZERO_COPY_SEND_THRESHOLD 应该设置的值
+// 回环地址上内核把数据交给接收端时仍然会复制一次，零拷贝只省去了发送端的复制，所以测得的交叉点偏大，可以作为阈值的上界
+namespace WebServer {
+
+    // 发送的方式，和 client_socket::send 选择的路径一一对应
+    enum class send_mode : size_t {
+        copy,
+        zero_copy,
+        // 和响应缓存中的条目一样，数据预先注册为 io_uring 的固定缓冲区
+        zero_copy_registered
+    };
+
+    constexpr std::array<std::string_view, 3> SEND_MODE_NAME_LIST{"copy", "zero_copy", "zero_copy_registered"};
+
+    // 建立一个回环地址上的 TCP 连接，返回发送端和接收端
+    std::tuple<client_socket, file_descriptor> connect_loopback() {
+        const int raw_listen_file_descriptor = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (raw_listen_file_descriptor == -1) {
+            throw std::runtime_error("failed to invoke 'socket'");
+        }
+        const file_descriptor listen_file_descriptor{raw_listen_file_descriptor};
+
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t address_size = sizeof(address);
+        if (bind(raw_listen_file_descriptor, reinterpret_cast<sockaddr *>(&address), address_size) == -1) {
+            throw std::runtime_error("failed to invoke 'bind'");
+        }
+        if (listen(raw_listen_file_descriptor, 1) == -1) {
+            throw std::runtime_error("failed to invoke 'listen'");
+        }
+        // 端口由内核分配
+        if (getsockname(raw_listen_file_descriptor, reinterpret_cast<sockaddr *>(&address), &address_size) == -1) {
+            throw std::runtime_error("failed to invoke 'getsockname'");
+        }
+
+        const int raw_send_file_descriptor = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (raw_send_file_descriptor == -1) {
+            throw std::runtime_error("failed to invoke 'socket'");
+        }
+        client_socket send_socket{raw_send_file_descriptor};
+        if (connect(raw_send_file_descriptor, reinterpret_cast<sockaddr *>(&address), address_size) == -1) {
+            throw std::runtime_error("failed to invoke 'connect'");
+        }
+        const int raw_receive_file_descriptor = accept4(raw_listen_file_descriptor, nullptr, nullptr, SOCK_CLOEXEC);
+        if (raw_receive_file_descriptor == -1) {
+            throw std::runtime_error("failed to invoke 'accept4'");
+        }
+        return {std::move(send_socket), file_descriptor{raw_receive_file_descriptor}};
+    }
+
+    // 在另一个线程中读取并丢弃所有收到的数据，直到连接关闭，received_byte 是已经收到的字节数
+    void receive_loop(const int raw_file_descriptor, std::atomic<size_t> &received_byte) {
+        std::vector<char> buffer(DEFAULT_ZERO_COPY_BENCH_MAX_SIZE);
+        while (true) {
+            const ssize_t result = recv(raw_file_descriptor, buffer.data(), buffer.size(), 0);
+            if (result <= 0) {
+                break;
+            }
+            received_byte.fetch_add(result, std::memory_order_release);
+            received_byte.notify_one();
+        }
+    }
+
+    // 把 payload 发送 message_count 次，结束时把 done 设置为 true
+    task<> send_payload(
+            client_socket &client_socket, const std::span<const char> payload, const size_t message_count,
+            const int buffer_index, bool &done
+    ) {
+        for (size_t _ = 0; _ < message_count; ++_) {
+            if (co_await client_socket.send(payload, payload.size(), buffer_index) == -1) {
+                throw std::runtime_error("failed to invoke 'send'");
+            }
+        }
+        done = true;
+    }
+
+    // 和 webserver_bench 的事件循环相同，直到 done 为 true
+    void event_loop(const bool &done) {
+        io_uring &io_uring = io_uring::get_instance();
+        while (!done) {
+            io_uring.submit_and_wait(1);
+            for (io_uring_cqe *const cqe: io_uring) {
+                auto *sqe_data = reinterpret_cast<struct sqe_data *>(io_uring_cqe_get_data(cqe));
+                if (sqe_data == nullptr) {
+                    io_uring.cqe_seen(cqe);
+                    continue;
+                }
+                sqe_data->cqe_res = cqe->res;
+                sqe_data->cqe_flags = cqe->flags;
+                void *const coroutine_address = sqe_data->coroutine;
+                io_uring.cqe_seen(cqe);
+
+                if (coroutine_address != nullptr) {
+                    std::coroutine_handle<>::from_address(coroutine_address).resume();
+                }
+            }
+        }
+    }
+
+    // 运行 round_count 轮，返回最好的一轮每秒发送的 MiB 数，以接收端收到全部数据为结束
+    double measure(
+            client_socket &client_socket, const std::span<const char> payload, const size_t message_count,
+            const int buffer_index, std::atomic<size_t> &received_byte, const size_t round_count
+    ) {
+        std::chrono::duration<double> best_elapsed = std::chrono::duration<double>::max();
+        for (size_t _ = 0; _ < round_count; ++_) {
+            const size_t target_byte = received_byte.load(std::memory_order_acquire) + payload.size() * message_count;
+            const auto start_time = std::chrono::steady_clock::now();
+
+            bool done = false;
+            const task<> send_task = send_payload(client_socket, payload, message_count, buffer_index, done);
+            send_task.resume();
+            event_loop(done);
+            for (size_t byte = received_byte.load(std::memory_order_acquire); byte < target_byte;
+                 byte = received_byte.load(std::memory_order_acquire)) {
+                received_byte.wait(byte, std::memory_order_acquire);
+            }
+
+            best_elapsed = std::min<std::chrono::duration<double>>(
+                    best_elapsed, std::chrono::steady_clock::now() - start_time
+            );
+        }
+        return static_cast<double>(payload.size() * message_count) / (1024 * 1024) / best_elapsed.count();
+    }
+}
+
+void print_usage() {
+    std::cout << "usage: zero_copy_bench [option]...\n"
+                 "  --min-size=BYTES smallest message, default 1024\n"
+                 "  --max-size=BYTES largest message, sizes double up to it, default 1048576\n"
+                 "  --bytes=BYTES    bytes sent per message size and mode, default 268435456\n"
+                 "  --rounds=N       rounds per run, the best one is reported, default 3\n";
+}
+
+int main(int argc, char *argv[]) {
+    size_t min_size = WebServer::DEFAULT_ZERO_COPY_BENCH_MIN_SIZE;
+    size_t max_size = WebServer::DEFAULT_ZERO_COPY_BENCH_MAX_SIZE;
+    size_t total_byte = WebServer::DEFAULT_ZERO_COPY_BENCH_BYTE_COUNT;
+    size_t round_count = WebServer::DEFAULT_MICRO_BENCH_ROUND_COUNT;
+
+    for (int index = 1; index < argc; ++index) {
+        const std::string_view argument(argv[index]);
+        if (argument == "--help") {
+            print_usage();
+            return 0;
+        }
+        if (WebServer::parse_number(argument, "--min-size=", min_size) ||
+            WebServer::parse_number(argument, "--max-size=", max_size) ||
+            WebServer::parse_number(argument, "--bytes=", total_byte) ||
+            WebServer::parse_number(argument, "--rounds=", round_count)) {
+            continue;
+        }
+        std::cerr << "unknown argument: " << argument << std::endl;
+        print_usage();
+        return 1;
+    }
+    min_size = std::max<size_t>(min_size, 1);
+    max_size = std::max(max_size, min_size);
+    round_count = std::max<size_t>(round_count, 1);
+
+    auto [client_socket, receive_file_descriptor] = WebServer::connect_loopback();
+    std::atomic<size_t> received_byte = 0;
+    std::jthread receive_thread(
+            WebServer::receive_loop, receive_file_descriptor.get_raw_file_descriptor(), std::ref(received_byte)
+    );
+
+    const std::string payload(max_size, 'x');
+    WebServer::io_uring &io_uring = WebServer::io_uring::get_instance();
+    const int buffer_index = io_uring.register_buffer(payload);
+
+    // 和 webserver_bench 相同，每行一个 "名字 值"
+    const auto print_line = [](const std::string_view name, const auto value) {
+        std::cout << name << ' ' << value << '\n';
+    };
+    print_line("min_size", min_size);
+    print_line("max_size", max_size);
+    print_line("byte", total_byte);
+    if (buffer_index == -1) {
+        std::cerr << "failed to register the payload, zero_copy_registered is skipped" << std::endl;
+    }
+
+    // 每种零拷贝方式第一个不比普通的 send 慢的长度，后面更长的消息也都不慢时才算数，为 0 表示没有找到
+    std::array<size_t, WebServer::SEND_MODE_NAME_LIST.size()> crossover_size{};
+    for (size_t size = min_size; size <= max_size; size *= 2) {
+        const std::span<const char> message(payload.data(), size);
+        const size_t message_count = std::max<size_t>(total_byte / size, 1);
+
+        double copy_rate = 0;
+        for (size_t mode = 0; mode < WebServer::SEND_MODE_NAME_LIST.size(); ++mode) {
+            const bool registered = mode == static_cast<size_t>(WebServer::send_mode::zero_copy_registered);
+            if (registered && buffer_index == -1) {
+                continue;
+            }
+            // 阈值为 1 时所有的消息都使用 send_zc ，为 0 时都使用普通的 send
+            const bool copy = mode == static_cast<size_t>(WebServer::send_mode::copy);
+            WebServer::client_socket::set_zero_copy_threshold(copy ? 0 : 1);
+            const double rate = WebServer::measure(
+                    client_socket, message, message_count, registered ? buffer_index : -1, received_byte, round_count
+            );
+            const std::string name = std::string(WebServer::SEND_MODE_NAME_LIST[mode]) + "_" +
+                                     std::to_string(size) + "_mib_per_s";
+            print_line(name, rate);
+
+            if (copy) {
+                copy_rate = rate;
+            } else if (rate < copy_rate) {
+                crossover_size[mode] = 0;
+            } else if (crossover_size[mode] == 0) {
+                crossover_size[mode] = size;
+            }
+        }
+        if (size > max_size / 2) {
+            break;
+        }
+    }
+    for (size_t mode = 1; mode < WebServer::SEND_MODE_NAME_LIST.size(); ++mode) {
+        print_line(std::string(WebServer::SEND_MODE_NAME_LIST[mode]) + "_crossover_byte", crossover_size[mode]);
+    }
+    std::cout.flush();
+
+    if (buffer_index != -1) {
+        io_uring.unregister_buffer(buffer_index);
+    }
+    // 关闭发送的方向，接收线程读到连接关闭之后退出
+    shutdown(client_socket.get_raw_file_descriptor(), SHUT_WR);
+}